@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+
+#include "bundle.hh"
+#include "general.hh"
+#include "networking.hh"
+#include "pathlock.hh"
+#include "stats.hh"
+
+#define BUNDLEMAX 4096 // most files in one bundle
+#define BUNDLECHUNK 65536 // bytes of bundle handed out at a time
+
+void open_entry(bundle_ctx& bundle, std::string& chunk);
+bool read_file_part(bundle_ctx& bundle, std::string& chunk, size_t len);
+
+bool parse_bundle_list(const std::string& body, std::vector<std::string>& uris)
+{
+	uris.clear();
+	std::vector<std::string> lines = split_string(body, '\n');
+	std::vector<std::string>::iterator it;
+	for (it = lines.begin(); it != lines.end(); it++)
+	{
+		it->erase(std::remove(it->begin(), it->end(), '\0'), it->end()); // terminator of payloads formed as strings
+		if (!it->empty() && it->at(it->length() - 1) == '\r')
+			it->erase(it->length() - 1);
+		if (it->empty())
+			continue;
+		if (uris.size() == BUNDLEMAX)
+			return false;
+		uris.push_back(*it);
+	}
+	return !uris.empty();
+}
+
+bool bundle_source(void* ctx, std::string& chunk)
+{
+	bundle_ctx* bundle = (bundle_ctx*)ctx;
+	chunk.clear();
+	while (chunk.length() < BUNDLECHUNK)
+	{
+		if (bundle->remaining > 0)
+		{
+			if (!read_file_part(*bundle, chunk, std::min(bundle->remaining, BUNDLECHUNK - chunk.length())))
+				return false;
+			continue;
+		}
+		bundle->file.reset();
+		bundle->content.reset();
+		if (bundle->next == bundle->entries.size())
+			break;
+		open_entry(*bundle, chunk);
+	}
+	return true;
+}
+
+/*
+ * Open next file of bundle and add its frame line to chunk
+ */
+void open_entry(bundle_ctx& bundle, std::string& chunk)
+{
+	const bundle_entry& entry = bundle.entries[bundle.next++];
+	http_status status = entry.status;
+	if (status == http_status::NOT_SET_ST)
+	{
+		std::string path = bundle.servpath + entry.uri;
+		pathlock_shared(path);
+		file_status filestatus = filecache_open(path, bundle.file, bundle.content);
+		pathlock_release(path);
+		status = filestatus == file_status::OK ? http_status::OK_200 :
+			filestatus == file_status::DOES_NOT_EXIST ? http_status::NOT_FOUND_404 : http_status::FORBIDDEN_403;
+	}
+	bundle.offset = 0;
+	bundle.remaining = status == http_status::OK_200 ? bundle.file->st.st_size : 0;
+	if (status == http_status::OK_200)
+		stat_add(BUNDLE_FILES, 1);
+
+	std::string statusline = bundle.conf->to_str(status);
+	std::stringstream framess;
+	framess << statusline.substr(0, statusline.find(' ')) << " " << bundle.remaining << " " << entry.uri << "\n";
+	chunk += framess.str();
+}
+
+/*
+ * Add next part of file being sent to chunk, from memory if its contents are held there
+ */
+bool read_file_part(bundle_ctx& bundle, std::string& chunk, size_t len)
+{
+	if (bundle.content)
+		chunk.append(*bundle.content, bundle.offset, len);
+	else
+	{
+		size_t start = chunk.length();
+		chunk.resize(start + len);
+		size_t readsofar = 0;
+		ssize_t readnow;
+		while (readsofar < len &&
+			   (readnow = pread(bundle.file->fd, &chunk[start + readsofar], len - readsofar, bundle.offset + readsofar)) > 0)
+			readsofar += readnow;
+		if (readsofar < len)
+		{
+			std::cerr << "file shrank while sending bundle" << std::endl;
+			return false;
+		}
+	}
+	bundle.offset += len;
+	bundle.remaining -= len;
+	return true;
+}
@@ -0,0 +1,86 @@
+/* Bundles of many files sent back to back in one response */
+
+#ifndef NETPROG_BUNDLE_HH
+#define NETPROG_BUNDLE_HH
+
+#include <string>
+#include <vector>
+
+#include "filecache.hh"
+#include "httpconf.hh"
+
+/*
+ * A bundle is a sequence of files, each framed by a line "<status code> <length> <uri>\n" followed by
+ * length bytes of the file, in the order of the requested list; files that could not be sent have
+ * a status other than 200 and length 0
+ */
+
+/* file of a bundle being sent */
+struct bundle_entry
+{
+	std::string uri;
+	http_status status; // decided before sending (e.g. forbidden), NOT_SET_ST to open the file when its turn comes
+};
+
+/* state of a bundle being sent */
+struct bundle_ctx
+{
+	const http_conf* conf;
+	std::string servpath;
+	std::vector<bundle_entry> entries;
+	size_t next; // next entry to open
+	cached_file_ptr file; // file being sent
+	cached_content_ptr content;
+	size_t offset; // next byte of file to send
+	size_t remaining; // bytes of file left to send
+};
+
+/* state of a bundle being unpacked into a directory */
+struct bundle_unpack_ctx
+{
+	std::string dirpath;
+	std::string line; // frame line received so far
+	std::string uri; // file being written
+	int fd; // file being written, -1 if none
+	size_t remaining; // bytes of file still to come
+	unsigned long received; // files written
+	unsigned long failed; // files the server could not send
+};
+
+/*
+ * Parse list of URIs of a bundle request, one per line
+ *
+ * body: request payload
+ * uris: URIs in order
+ * return: true on success, false if list is empty or too long
+ */
+bool parse_bundle_list(const std::string& body, std::vector<std::string>& uris);
+
+/*
+ * Source of bundle payload for send_chunked, opening files in turn and packing small files together
+ *
+ * ctx: pointer to bundle_ctx, next, offset and remaining set to 0 to start
+ * chunk: next piece of bundle, left empty when all files are sent
+ * return: true on success, false if a file could not be read (framing can't be kept)
+ */
+bool bundle_source(void* ctx, std::string& chunk);
+
+/*
+ * Sink writing files of a bundle under a directory as they arrive
+ *
+ * ctx: pointer to bundle_unpack_ctx, fd set to -1 and the rest to 0 or empty to start
+ * data: next bytes of bundle
+ * len: number of bytes
+ * return: true to continue, false on malformed bundle or write error
+ */
+bool bundle_unpack_sink(void* ctx, const char* data, size_t len);
+
+/*
+ * Check that a bundle ended on a file boundary
+ *
+ * ctx: state after the last call of bundle_unpack_sink
+ * return: true if bundle was complete
+ */
+bool bundle_unpack_complete(const bundle_unpack_ctx& ctx);
+
+#endif
@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <unistd.h>
+
+#include "bundle.hh"
+#include "general.hh"
+#include "networking.hh"
+
+#define FRAMELINEMAX 4096 // longest frame line accepted when unpacking
+
+bool start_file(bundle_unpack_ctx& unpack);
+bool finish_file(bundle_unpack_ctx& unpack);
+
+bool bundle_unpack_sink(void* ctx, const char* data, size_t len)
+{
+	bundle_unpack_ctx* unpack = (bundle_unpack_ctx*)ctx;
+	while (len > 0)
+	{
+		/* contents of current file */
+		if (unpack->remaining > 0)
+		{
+			size_t part = std::min(len, unpack->remaining);
+			if (!fd_sink(&unpack->fd, data, part))
+				return false;
+			data += part;
+			len -= part;
+			if ((unpack->remaining -= part) == 0 && !finish_file(*unpack))
+				return false;
+			continue;
+		}
+
+		/* frame line of next file */
+		const char* newline = (const char*)memchr(data, '\n', len);
+		size_t part = newline ? newline - data : len;
+		unpack->line.append(data, part);
+		if (unpack->line.length() > FRAMELINEMAX)
+		{
+			std::cerr << "malformed bundle: frame line too long" << std::endl;
+			return false;
+		}
+		if (!newline)
+			break;
+		data += part + 1;
+		len -= part + 1;
+		if (!start_file(*unpack))
+			return false;
+		unpack->line.clear();
+	}
+	return true;
+}
+
+bool bundle_unpack_complete(const bundle_unpack_ctx& ctx)
+{
+	return ctx.remaining == 0 && ctx.line.empty() && ctx.fd < 0;
+}
+
+/*
+ * Parse frame line and create file it announces, refusing paths that would leave the directory
+ */
+bool start_file(bundle_unpack_ctx& unpack)
+{
+	size_t first = unpack.line.find(' ');
+	size_t second = first == std::string::npos ? std::string::npos : unpack.line.find(' ', first + 1);
+	if (second == std::string::npos)
+	{
+		std::cerr << "malformed bundle: bad frame line" << std::endl;
+		return false;
+	}
+	unsigned long code = std::strtoul(unpack.line.substr(0, first).c_str(), NULL, 10);
+	unpack.remaining = std::strtoull(unpack.line.substr(first + 1, second - first - 1).c_str(), NULL, 10);
+	unpack.uri = unpack.line.substr(second + 1);
+	if (unpack.uri.empty() || unpack.uri.at(0) != '/' || ("/" + unpack.uri + "/").find("/../") != std::string::npos)
+	{
+		std::cerr << "malformed bundle: bad path " << unpack.uri << std::endl;
+		return false;
+	}
+	if (code != 200)
+	{
+		std::cerr << unpack.uri << ": " << code << std::endl;
+		unpack.failed++;
+		return unpack.remaining == 0;
+	}
+
+	std::string path = unpack.dirpath + unpack.uri;
+	if (!make_dirs(path.substr(0, path.rfind('/'))))
+		return false;
+	if ((unpack.fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)) < 0)
+	{
+		perror("open");
+		return false;
+	}
+	return unpack.remaining > 0 || finish_file(unpack);
+}
+
+/*
+ * Close completely written file
+ */
+bool finish_file(bundle_unpack_ctx& unpack)
+{
+	int fd = unpack.fd;
+	unpack.fd = -1;
+	if (close(fd) < 0)
+	{
+		perror("close");
+		return false;
+	}
+	std::cout << "unpacked " << unpack.uri << std::endl;
+	unpack.received++;
+	return true;
+}
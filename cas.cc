@@ -0,0 +1,136 @@
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include "cas.hh"
+#include "durable.hh"
+#include "general.hh"
+#include "networking.hh"
+#include "stats.hh"
+
+#define DIGESTATTR "user.sha256" // extended attribute holding the digest of stored content, with the file version it is of
+#define DIGESTLEN 64 // hex digits of a digest
+#define DIGESTATTRMAX 128 // digest, modification time and size
+
+bool casenabled = false;
+
+std::string digest_attr(const std::string& digest, const struct stat& st);
+bool read_digest(ssize_t len, const char* value, const struct stat& st, std::string& digest);
+
+void cas_set_enabled(bool enabled)
+{
+	casenabled = enabled;
+}
+
+bool cas_enabled()
+{
+	return casenabled;
+}
+
+bool hashed_upload_sink(void* ctx, const char* data, size_t len)
+{
+	hashed_upload* upload = (hashed_upload*)ctx;
+	if (!fd_sink(&upload->fd, data, len))
+		return false;
+	sha256_update(upload->hash, data, len);
+	return true;
+}
+
+bool cas_commit(const std::string& casdir, int fd, const std::string& temppath, const std::string& path,
+				const std::string& digest)
+{
+	/* blobs are spread over subdirectories by the first two digits */
+	std::string blobdir = casdir + "/" + digest.substr(0, 2);
+	std::string blobpath = blobdir + "/" + digest;
+	if (!make_dirs(blobdir))
+		return durable_commit(fd, temppath, path); // stored as is
+
+	struct stat st;
+	if (fstat(fd, &st) < 0)
+	{
+		perror("fstat");
+		return durable_commit(fd, temppath, path);
+	}
+
+	/* digest goes with the content, to all names linked to it */
+	std::string attr = digest_attr(digest, st);
+	if (fsetxattr(fd, DIGESTATTR, attr.data(), attr.length(), 0) < 0)
+		perror("fsetxattr"); // file is served with a metadata based tag
+	if (link(temppath.c_str(), blobpath.c_str()) == 0)
+	{
+		stat_add(CAS_STORED, 1);
+		return durable_commit(fd, temppath, path); // new content is the blob (its own name is made durable by a later sync)
+	}
+	if (errno != EEXIST)
+	{
+		perror("link");
+		return durable_commit(fd, temppath, path);
+	}
+
+	/* blob is trusted only while it still holds the content its name promises */
+	struct stat blobst;
+	std::string blobdigest;
+	if (stat(blobpath.c_str(), &blobst) < 0 || !cas_path_digest(blobpath, blobst, blobdigest) || blobdigest != digest ||
+		blobst.st_size != st.st_size)
+	{
+		std::cerr << "stored content " << blobpath << " does not match its digest, upload stored as is" << std::endl;
+		return durable_commit(fd, temppath, path);
+	}
+
+	/* same content stored already, drop the copy */
+	durable_abort(fd, temppath);
+	if (!durable_link(blobpath, path))
+		return false;
+	std::cout << "upload deduplicated to " << blobpath << std::endl;
+	stat_add(CAS_DEDUPLICATED, 1);
+	stat_add(CAS_BYTES_SAVED, st.st_size);
+	return true;
+}
+
+bool cas_digest(int fd, const struct stat& st, std::string& digest)
+{
+	if (!casenabled)
+		return false;
+	char value[DIGESTATTRMAX];
+	return read_digest(fgetxattr(fd, DIGESTATTR, value, sizeof(value)), value, st, digest);
+}
+
+bool cas_path_digest(const std::string& path, const struct stat& st, std::string& digest)
+{
+	if (!casenabled)
+		return false;
+	char value[DIGESTATTRMAX];
+	return read_digest(getxattr(path.c_str(), DIGESTATTR, value, sizeof(value)), value, st, digest);
+}
+
+/*
+ * Value of the extended attribute: digest of the file version with the given modification time and size
+ * (change time can't be used, it moves with every name linked to the content)
+ */
+std::string digest_attr(const std::string& digest, const struct stat& st)
+{
+	std::stringstream attrss;
+	attrss << digest << " " << (long long)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec << " " << st.st_size;
+	return attrss.str();
+}
+
+/*
+ * Take digest from the value of the extended attribute, if there was one of the right form and the file was
+ * not written in place since
+ */
+bool read_digest(ssize_t len, const char* value, const struct stat& st, std::string& digest)
+{
+	if (len < 0 && errno != ENODATA && errno != ENOENT && errno != ENOTSUP && errno != ERANGE)
+		perror("getxattr");
+	if (len <= DIGESTLEN)
+		return false;
+	digest.assign(value, DIGESTLEN);
+	if (digest.find_first_not_of("0123456789abcdef") != std::string::npos ||
+		std::string(value, len) != digest_attr(digest, st))
+		return false;
+	return true;
+}
@@ -0,0 +1,80 @@
+/* Content-addressed storage of uploaded files, each distinct content stored once under its digest */
+
+#ifndef NETPROG_CAS_HH
+#define NETPROG_CAS_HH
+
+#include <string>
+#include <sys/stat.h>
+
+#include "sha256.hh"
+
+/* upload written to a file while its digest is computed */
+struct hashed_upload
+{
+	int fd;
+	sha256_ctx hash;
+};
+
+/*
+ * Enable storing uploads by content, called before serving
+ *
+ * enabled: true to store uploads by content, false to store them as is (default)
+ */
+void cas_set_enabled(bool enabled);
+
+/*
+ * Check if uploads are stored by content
+ *
+ * return: true if enabled
+ */
+bool cas_enabled();
+
+/*
+ * Sink writing payload to a file and adding it to the digest, for recv_to_sink and recv_chunked
+ *
+ * ctx: pointer to hashed_upload
+ * data: data received
+ * len: length of data
+ * return: true on success, false on write error
+ */
+bool hashed_upload_sink(void* ctx, const char* data, size_t len);
+
+/*
+ * Commit a completely written temporary file in place of a file, storing its content once in the blob
+ * directory: if content with the same digest is stored already, the file becomes a hard link to it and
+ * the temporary file is dropped, otherwise the temporary file becomes the stored content
+ * Stored content must not be written in place, as all files with that content share it
+ * The name of the file is made durable by durable_sync_name afterwards
+ *
+ * casdir: directory of stored content
+ * fd: file descriptor from durable_create, flushed by durable_flush, closed
+ * temppath: path to temporary file
+ * path: path to file to replace
+ * digest: digest of contents of temporary file
+ * return: true on success, false on failure (as durable_commit)
+ */
+bool cas_commit(const std::string& casdir, int fd, const std::string& temppath, const std::string& path,
+				const std::string& digest);
+
+/*
+ * Get digest of a stored file without reading it
+ *
+ * fd: open file
+ * st: current status of file, a digest recorded for another modification time or size is stale
+ * digest: digest on success
+ * return: true if file has a digest, false if it was not stored by content or was written in place since
+ */
+bool cas_digest(int fd, const struct stat& st, std::string& digest);
+
+/*
+ * Get digest of a stored file by path without reading it
+ *
+ * path: path to file
+ * st: current status of file, a digest recorded for another modification time or size is stale
+ * digest: digest on success
+ * return: true if file has a digest, false if it does not exist, was not stored by content or was written in
+ * place since
+ */
+bool cas_path_digest(const std::string& path, const struct stat& st, std::string& digest);
+
+#endif
@@ -1,48 +1,214 @@
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <fcntl.h>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <pthread.h>
+#include <sstream>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include "bundle.hh"
+#include "dns.hh"
 #include "general.hh"
 #include "http.hh"
+#include "loadgen.hh"
 #include "networking.hh"
 
+/* load mode parameters, shared read-only by load generator threads */
+struct client_load_ctx
+{
+	std::string hostname;
+	std::string port;
+	std::string filename;
+	std::string username;
+	std::string dirpath;
+	std::string queryname;
+	std::string querytype;
+	std::vector<std::string> schedule; // method of each slot, weights expanded
+	const http_conf* conf;
+};
+
+#define BATCHATTEMPTS 3 // sends of one request before giving up
+#define LOADREQUESTMS 10000 // deadline of one request in load mode, a stalled request fails
+#define RANGEBLOCK (1 << 20) // bytes fetched per ranged request, unit of resuming
+#define PARTSUFFIX ".part" // download in progress
+#define STATESUFFIX ".state" // completed blocks of download in progress
+
+/* one transfer of batch mode */
+struct batch_item
+{
+	std::string filename; // GET and PUT
+	std::string queryname; // POST
+	std::string querytype;
+	unsigned int attempts; // touched only by the thread holding the item
+};
+
+/* batch mode state shared by connection threads */
+struct batch_ctx
+{
+	std::string hostname;
+	std::string port;
+	std::string method;
+	std::string username;
+	std::string dirpath;
+	unsigned int depth; // requests in flight per connection
+	std::vector<batch_item> items;
+	std::atomic<size_t> next; // next item to take
+	std::atomic<unsigned long> succeeded;
+	std::atomic<unsigned long> failed;
+	const http_conf* conf;
+};
+
+/* ranged download state shared by connection threads */
+struct range_ctx
+{
+	std::string hostname;
+	std::string port;
+	std::string filename;
+	std::string username;
+	int fd; // output file
+	int statefd; // state file: header line, then one byte per block, '1' when written
+	size_t stateheaderlen;
+	size_t filesize;
+	std::string etag; // version of the file being downloaded, ranges are asked for only of it
+	std::vector<char> done; // blocks written before this run
+	std::atomic<size_t> next; // next block to take
+	std::atomic<unsigned long> fetched;
+	std::atomic<unsigned long> failed;
+	std::atomic<bool> changed; // file was replaced on server during download
+	const http_conf* conf;
+};
+
+http_request form_get(const http_conf& conf, const batch_opts& opts, const std::string& dirpath, const std::string& filename,
+					  const std::string& hostname, const std::string& username);
+void finish_get(const http_response& resp, const batch_opts& opts, const std::string& path);
+int run_load_mode(const load_opts& load, client_load_ctx& ctx);
+bool load_request(void* ctx, unsigned long seq, int& sockfd);
+int run_batch_mode(const batch_opts& opts, batch_ctx& batch, const std::string& querytype);
+void* batch_worker(void* arg);
+int run_ranged_download(const batch_opts& opts, const std::string& hostname, const std::string& port,
+						const std::string& filename, const std::string& username, const std::string& dirpath);
+bool load_download_state(range_ctx& ctx, const std::string& statepath);
+bool has_download_state(const std::string& statepath);
+void* range_worker(void* arg);
+int run_bundle_download(const batch_opts& opts, const std::string& hostname, const std::string& port,
+						const std::string& username, const std::string& dirpath);
+
 int main(int argc, char *argv[])
 {
 	std::string hostname, port, method, filename, username, dirpath, queryname;
-	if (get_client_opts(argc, argv, hostname, port, method, filename, username, dirpath, queryname) < 0)
+	std::string querytype = SQUERYTYPE;
+	load_opts load;
+	load.enabled = false;
+	load.connections = 8;
+	load.requests = 0;
+	load.durationms = 10000;
+	load.rate = 0;
+	load.poisson = false;
+	batch_opts batch;
+	batch.connections = 4;
+	batch.depth = 1;
+	batch.parts = 0;
+	batch.tostdout = false;
+	batch.conditional = false;
+	batch.compressed = false;
+	batch.bundled = false;
+	if (get_client_opts(argc, argv, hostname, port, method, filename, username, dirpath, queryname, querytype, load, batch) < 0)
 		return -1;
 
 	/* create directory for files if it doesn't exist */
-	if (method != "POST" && create_dir(dirpath) < 0)
+	if (!dirpath.empty() && create_dir(dirpath) < 0)
 		return -1;
 
+	if (load.enabled)
+	{
+		client_load_ctx ctx;
+		ctx.hostname = hostname;
+		ctx.port = port;
+		ctx.filename = filename;
+		ctx.username = username;
+		ctx.dirpath = dirpath;
+		ctx.queryname = queryname;
+		ctx.querytype = querytype;
+		if (load.mix.empty())
+			ctx.schedule.push_back(method);
+		std::vector<std::pair<std::string, unsigned int> >::const_iterator it;
+		for (it = load.mix.begin(); it != load.mix.end(); it++)
+			ctx.schedule.insert(ctx.schedule.end(), it->second, it->first);
+		return run_load_mode(load, ctx);
+	}
+	if (batch.parts > 0)
+		return run_ranged_download(batch, hostname, port, filename, username, dirpath);
+	if (batch.bundled)
+		return run_bundle_download(batch, hostname, port, username, dirpath);
+	if (!batch.listpath.empty())
+	{
+		batch_ctx ctx;
+		ctx.hostname = hostname;
+		ctx.port = port;
+		ctx.method = method;
+		ctx.username = username;
+		ctx.dirpath = dirpath;
+		return run_batch_mode(batch, ctx, querytype);
+	}
+
+	/* stdout carries only the payload when streaming */
+	std::streambuf* coutbuf = std::cout.rdbuf();
+	if (batch.tostdout)
+		std::cout.rdbuf(NULL);
+
 	/* connect to server */
 	int sockfd;
 	if ((sockfd = tcp_connect(hostname, port)) < 0)
 		return -1;
 
+	int status = 0;
 	try
 	{
-		const http_conf conf("");
+		const http_conf conf("", "");
 
 		/* create request header based on command line parameters */
-		http_request req = http_request::form_header(conf, method, dirpath, filename, hostname, username, queryname);
+		http_request req = batch.conditional || batch.compressed ? form_get(conf, batch, dirpath, filename, hostname, username) :
+			http_request::form_header(conf, method, dirpath, filename, hostname, username, queryname, querytype);
 		req.print_header();
 
 		/* send the request */
-		if (!req.send(sockfd, dirpath))
+		if (!req.send(sockfd, dirpath, deadline::none()))
 			std::cerr << "failed to send the request" << std::endl;
+		else if (batch.tostdout)
+		{
+			/* hand payload to stdout as it arrives */
+			int outfd = STDOUT_FILENO;
+			http_response resp = http_response::receive_stream(conf, sockfd, req.method, fd_sink, &outfd, deadline::none());
+			if (resp.status != http_status::OK_200)
+			{
+				std::cerr << "server responded " << conf.to_str(resp.status) << std::endl;
+				status = -1;
+			}
+		}
 		else
 		{
 			/* read response from socket */
-			http_response resp = http_response::receive(conf, sockfd, req.method, dirpath, req.uri);
+			http_response resp = http_response::receive(conf, sockfd, req.method, dirpath, req.uri, deadline::none());
 			resp.print_header();
 			resp.print_payload();
+			if (batch.conditional || batch.compressed)
+				finish_get(resp, batch, dirpath + filename);
 		}
 	}
 	catch (const general_exception& e)
 	{
 		std::cerr << e.what() << std::endl;
+		status = -1;
 	}
+	std::cout.rdbuf(coutbuf);
+	std::cout.clear();
 
 	if (close(sockfd) < 0)
 	{
@@ -50,5 +216,628 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
+	return batch.tostdout ? status : 0;
+}
+
+/*
+ * Form GET request that, if conditional, is answered with 304 if local copy is up to date (plain GET if there
+ * is no local copy) and, if compressed, accepts gzip and deflate coded payloads
+ */
+http_request form_get(const http_conf& conf, const batch_opts& opts, const std::string& dirpath, const std::string& filename,
+					  const std::string& hostname, const std::string& username)
+{
+	struct stat st;
+	std::string since;
+	if (opts.conditional && stat((dirpath + filename).c_str(), &st) == 0)
+		since = format_http_date(st.st_mtime);
+	return http_request::form_get_header(conf, filename, hostname, username, "", since, opts.compressed ? "gzip, deflate" : "");
+}
+
+/*
+ * Decode downloaded copy if it came compressed and give it the modification time of the file on the server,
+ * so that it is compared against it next time
+ */
+void finish_get(const http_response& resp, const batch_opts& opts, const std::string& path)
+{
+	time_t modified;
+	if (resp.status == http_status::NOT_MODIFIED_304)
+		std::cout << "local copy " << path << " is up to date" << std::endl;
+	else if (resp.status != http_status::OK_200)
+		return;
+	else if (!resp.content_encoding.empty() && !decode_file(path))
+		std::cerr << "failed to decode " << resp.content_encoding << " payload of " << path << std::endl;
+	else if (opts.conditional && parse_http_date(resp.last_modified, modified))
+	{
+		struct timespec times[2];
+		times[0].tv_sec = 0;
+		times[0].tv_nsec = UTIME_OMIT; // access time
+		times[1].tv_sec = modified;
+		times[1].tv_nsec = 0;
+		if (utimensat(AT_FDCWD, path.c_str(), times, 0) < 0)
+			perror("utimensat");
+	}
+}
+
+/*
+ * Drive concurrent connections from this process and report the result
+ */
+int run_load_mode(const load_opts& load, client_load_ctx& ctx)
+{
+	const http_conf conf("", "");
+	ctx.conf = &conf;
+
+	printf("load: %u connections, mix of %lu slots, ", load.connections, ctx.schedule.size());
+	if (load.rate > 0)
+		printf("open loop at %.1f requests/s (%s), ", load.rate, load.poisson ? "poisson" : "uniform");
+	if (load.requests > 0)
+		printf("%lu requests\n", load.requests);
+	else
+		printf("%lu ms\n", load.durationms);
+
+	/* request and response tracing would dominate the measurement */
+	std::streambuf* coutbuf = std::cout.rdbuf(NULL);
+	load_result result;
+	if (load.rate > 0)
+		result = run_load_rate(load.connections, load.requests, load.durationms, load.rate, load.poisson, load_request,
+							   &ctx);
+	else
+		result = run_load(load.connections, load.requests, load.durationms, load_request, &ctx);
+	std::cout.rdbuf(coutbuf);
+	std::cout.clear();
+
+	print_load_result(result);
+	if (!load.summarypath.empty() && !write_load_summary(load.summarypath, result))
+		return -1;
 	return 0;
 }
+
+/*
+ * One request over the thread's persistent connection, opened again after a failure; method taken from the mix
+ * by sequence number, payloads of responses discarded as they arrive
+ */
+bool load_request(void* ctx, unsigned long seq, int& sockfd)
+{
+	client_load_ctx* load = (client_load_ctx*)ctx;
+	const std::string& method = load->schedule[seq % load->schedule.size()];
+
+	if (sockfd < 0 && (sockfd = tcp_connect(load->hostname, load->port)) < 0)
+		return false;
+
+	const deadline dl = deadline::after_ms(LOADREQUESTMS);
+	bool ok = false;
+	bool reusable = false;
+	try
+	{
+		http_request req = http_request::form_header(*load->conf, method, load->dirpath, load->filename, load->hostname,
+													 load->username, load->queryname, load->querytype);
+		if (req.send(sockfd, load->dirpath, dl))
+		{
+			http_response resp = http_response::receive_stream(*load->conf, sockfd, req.method, discard_sink, NULL, dl);
+			ok = resp.status == http_status::OK_200 || resp.status == http_status::CREATED_201;
+			reusable = resp.keepalive;
+		}
+	}
+	catch (const general_exception& e)
+	{
+		std::cerr << e.what() << std::endl; // includes deadline exceeded
+	}
+
+	/* connection state is unknown after a failure to send or receive */
+	if (!reusable)
+	{
+		close(sockfd);
+		sockfd = -1;
+	}
+	return ok;
+}
+
+/*
+ * Transfer all files or queries of a list over a pool of persistent connections
+ */
+int run_batch_mode(const batch_opts& opts, batch_ctx& batch, const std::string& querytype)
+{
+	std::ifstream fs(opts.listpath.c_str());
+	if (!fs.good())
+	{
+		std::cerr << "file stream error" << std::endl;
+		return -1;
+	}
+	std::string line;
+	while (std::getline(fs, line))
+	{
+		std::vector<std::string> tokens = split_string(line, ' ');
+		if (tokens.empty() || tokens[0].empty())
+			continue;
+		batch_item item;
+		item.attempts = 0;
+		if (batch.method == "POST")
+		{
+			item.queryname = tokens[0];
+			item.querytype = tokens.size() > 1 ? to_upper(tokens[1]) : querytype;
+		}
+		else
+			item.filename = tokens[0].at(0) == '/' ? tokens[0] : "/" + tokens[0];
+		batch.items.push_back(item);
+	}
+	fs.close();
+
+	const http_conf conf("", "");
+	batch.conf = &conf;
+	batch.depth = opts.depth;
+	batch.next = 0;
+	batch.succeeded = 0;
+	batch.failed = 0;
+
+	printf("batch: %lu requests over %u connections, %u in flight per connection\n", batch.items.size(),
+		   opts.connections, opts.depth);
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* request and response tracing would hide the summary */
+	std::streambuf* coutbuf = std::cout.rdbuf(NULL);
+	std::vector<pthread_t> tids(opts.connections);
+	unsigned int i, started = 0;
+	for (i = 0; i < opts.connections && i < batch.items.size(); i++)
+	{
+		if ((errno = pthread_create(&tids[i], NULL, batch_worker, &batch)) != 0)
+		{
+			perror("pthread_create");
+			break;
+		}
+		started++;
+	}
+	for (i = 0; i < started; i++)
+	{
+		if ((errno = pthread_join(tids[i], NULL)) != 0)
+			perror("pthread_join");
+	}
+	std::cout.rdbuf(coutbuf);
+	std::cout.clear();
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("requests: %lu succeeded, %lu failed in %.3f s (%.1f requests/s)\n", (unsigned long)batch.succeeded,
+		   (unsigned long)batch.failed, seconds, seconds > 0 ? batch.items.size() / seconds : 0);
+	return batch.failed == 0 ? 0 : -1;
+}
+
+/*
+ * Thread routine: take items and transfer them over one persistent connection, keeping up to
+ * depth requests in flight; requests left unanswered when the connection ends are sent again
+ */
+void* batch_worker(void* arg)
+{
+	batch_ctx* batch = (batch_ctx*)arg;
+	int sockfd = -1;
+	std::deque<size_t> inflight; // sent, responses arrive in this order
+	std::deque<size_t> resend; // to send again on a new connection
+	while (1)
+	{
+		/* fill the pipeline */
+		bool broken = false;
+		while (!broken && inflight.size() < batch->depth)
+		{
+			size_t idx;
+			if (!resend.empty())
+			{
+				idx = resend.front();
+				resend.pop_front();
+			}
+			else if ((idx = batch->next.fetch_add(1)) >= batch->items.size())
+				break;
+			batch_item& item = batch->items[idx];
+			item.attempts++;
+
+			if (sockfd < 0 && (sockfd = tcp_connect(batch->hostname, batch->port)) < 0)
+			{
+				batch->failed++;
+				continue;
+			}
+			try
+			{
+				http_request req = http_request::form_header(*batch->conf, batch->method, batch->dirpath, item.filename,
+															 batch->hostname, batch->username, item.queryname, item.querytype);
+				if (req.expect_continue && !inflight.empty())
+				{
+					/* 100 Continue can't be told apart from earlier responses, wait until they are read */
+					item.attempts--;
+					resend.push_front(idx);
+					break;
+				}
+				broken = !req.send(sockfd, batch->dirpath, deadline::none());
+			}
+			catch (const general_exception& e)
+			{
+				std::cerr << e.what() << std::endl; // request not sent
+				batch->failed++;
+				continue;
+			}
+			inflight.push_back(idx);
+		}
+		if (inflight.empty() && !broken)
+			break; // list done
+
+		/* read the oldest response */
+		if (!broken)
+		{
+			const batch_item& item = batch->items[inflight.front()];
+			try
+			{
+				http_method method = batch->conf->to_method(batch->method);
+				http_response resp = http_response::receive(*batch->conf, sockfd, method, batch->dirpath, item.filename,
+															deadline::none());
+				if (resp.status == http_status::OK_200 || resp.status == http_status::CREATED_201)
+				{
+					/* files are written by receive, DNS answers are saved per query */
+					if (method == http_method::POST && !batch->dirpath.empty())
+					{
+						std::ofstream out((batch->dirpath + "/" + item.queryname + "." + item.querytype).c_str());
+						out << resp.body;
+					}
+					batch->succeeded++;
+				}
+				else
+					batch->failed++;
+				inflight.pop_front();
+				broken = !resp.keepalive; // server closes after this response
+			}
+			catch (const general_exception& e)
+			{
+				std::cerr << e.what() << std::endl;
+				broken = true;
+			}
+		}
+
+		if (broken)
+		{
+			close(sockfd);
+			sockfd = -1;
+			while (!inflight.empty())
+			{
+				if (batch->items[inflight.front()].attempts < BATCHATTEMPTS)
+					resend.push_back(inflight.front());
+				else
+					batch->failed++;
+				inflight.pop_front();
+			}
+		}
+	}
+	if (sockfd >= 0)
+		close(sockfd);
+	return arg;
+}
+
+/*
+ * Download one file as concurrent ranges written in place into a preallocated file;
+ * an interrupted download is resumed from its state file
+ */
+int run_ranged_download(const batch_opts& opts, const std::string& hostname, const std::string& port,
+						const std::string& filename, const std::string& username, const std::string& dirpath)
+{
+	const http_conf conf("", "");
+	range_ctx ctx;
+	ctx.hostname = hostname;
+	ctx.port = port;
+	ctx.filename = filename;
+	ctx.username = username;
+	ctx.conf = &conf;
+	ctx.next = 0;
+	ctx.fetched = 0;
+	ctx.failed = 0;
+	ctx.changed = false;
+
+	std::string path = dirpath + filename;
+	std::string partpath = path + PARTSUFFIX;
+	std::string statepath = partpath + STATESUFFIX;
+	if ((ctx.fd = open(partpath.c_str(), O_RDWR | O_CREAT, 0644)) < 0)
+	{
+		perror("open");
+		return -1;
+	}
+
+	/* first byte tells the size of the file */
+	set_trace(NULL);
+	int sockfd;
+	bool probed = false;
+	bool whole = false; // server sent whole file instead of range
+	if ((sockfd = tcp_connect(hostname, port)) >= 0)
+	{
+		try
+		{
+			http_request req = http_request::form_range_header(conf, filename, hostname, username, 0, 1, "");
+			if (req.send(sockfd, dirpath, deadline::none()))
+			{
+				http_response resp = http_response::receive_range(conf, sockfd, ctx.fd, deadline::none());
+				ctx.filesize = resp.file_size;
+				ctx.etag = resp.etag;
+				whole = resp.status == http_status::OK_200;
+				probed = resp.status == http_status::PARTIAL_CONTENT_206 || resp.status == http_status::OK_200 ||
+						 resp.status == http_status::RANGE_NOT_SATISFIABLE_416;
+				if (!probed)
+					std::cerr << "server responded " << conf.to_str(resp.status) << std::endl;
+			}
+		}
+		catch (const general_exception& e)
+		{
+			std::cerr << e.what() << std::endl;
+		}
+		close(sockfd);
+	}
+	set_trace(&std::cout);
+	if (!probed || whole)
+	{
+		/* a longer part file of an earlier attempt must not leave its tail behind */
+		if (whole && ftruncate(ctx.fd, ctx.filesize) < 0)
+		{
+			perror("ftruncate");
+			whole = false;
+		}
+		close(ctx.fd);
+		if (!probed && !has_download_state(statepath))
+			unlink(partpath.c_str()); // nothing to resume, part file was created by this attempt
+		if (whole && rename(partpath.c_str(), path.c_str()) < 0)
+		{
+			perror("rename");
+			return -1;
+		}
+		if (whole)
+			unlink(statepath.c_str());
+		return whole ? 0 : -1;
+	}
+
+	size_t blocks = (ctx.filesize + RANGEBLOCK - 1) / RANGEBLOCK;
+	std::stringstream headerss;
+	headerss << ctx.filesize << " " << RANGEBLOCK << " " << ctx.etag << "\n";
+	ctx.stateheaderlen = headerss.str().length();
+
+	/* resume if state of an earlier download of the same version exists */
+	size_t resumed = 0;
+	if (load_download_state(ctx, statepath) && ctx.done.size() == blocks)
+	{
+		for (size_t i = 0; i < blocks; i++)
+			resumed += ctx.done[i] == '1';
+	}
+	else
+	{
+		ctx.done.assign(blocks, '0');
+		std::ofstream statefs(statepath.c_str(), std::ios::trunc);
+		statefs << headerss.str() << std::string(ctx.done.begin(), ctx.done.end());
+		statefs.close();
+		if (!statefs.good())
+		{
+			std::cerr << "file stream error" << std::endl;
+			close(ctx.fd);
+			return -1;
+		}
+	}
+	if ((ctx.statefd = open(statepath.c_str(), O_WRONLY)) < 0)
+	{
+		perror("open");
+		close(ctx.fd);
+		return -1;
+	}
+	if (ftruncate(ctx.fd, ctx.filesize) < 0 || (ctx.filesize > 0 && (errno = posix_fallocate(ctx.fd, 0, ctx.filesize)) != 0))
+		perror("preallocate"); // blocks are still written in place, just not reserved up front
+
+	std::cout << "download: " << ctx.filesize << " bytes in " << blocks << " blocks over " << opts.parts
+			  << " connections, " << resumed << " blocks done earlier" << std::endl;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	set_trace(NULL);
+	std::vector<pthread_t> tids(opts.parts);
+	unsigned int i, started = 0;
+	for (i = 0; i < opts.parts && i < blocks - resumed; i++)
+	{
+		if ((errno = pthread_create(&tids[i], NULL, range_worker, &ctx)) != 0)
+		{
+			perror("pthread_create");
+			break;
+		}
+		started++;
+	}
+	for (i = 0; i < started; i++)
+	{
+		if ((errno = pthread_join(tids[i], NULL)) != 0)
+			perror("pthread_join");
+	}
+	set_trace(&std::cout);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (started == 0 && resumed < blocks)
+		ctx.failed++;
+	close(ctx.statefd);
+	if (close(ctx.fd) < 0)
+	{
+		perror("close");
+		ctx.failed++;
+	}
+
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	std::stringstream reportss;
+	reportss << std::fixed << std::setprecision(3) << "blocks: " << ctx.fetched << " fetched, " << ctx.failed
+			 << " failed in " << seconds << " s (" << std::setprecision(1)
+			 << (seconds > 0 ? ctx.fetched * (double)RANGEBLOCK / seconds / 1e6 : 0) << " MB/s)";
+	std::cout << reportss.str() << std::endl;
+	if (ctx.changed)
+	{
+		std::cerr << "file changed on server during download, run again to start over" << std::endl;
+		unlink(statepath.c_str());
+		return -1;
+	}
+	if (ctx.failed > 0)
+	{
+		std::cerr << "download incomplete, run again to resume" << std::endl;
+		return -1;
+	}
+
+	/* complete: move into place and forget state */
+	if (rename(partpath.c_str(), path.c_str()) < 0)
+	{
+		perror("rename");
+		return -1;
+	}
+	unlink(statepath.c_str());
+	return 0;
+}
+
+/*
+ * Read state of earlier download, false if there is none for this version of the file (one without entity tag
+ * can't be told apart from another of the same size, so it is never resumed)
+ */
+bool load_download_state(range_ctx& ctx, const std::string& statepath)
+{
+	std::ifstream statefs(statepath.c_str());
+	size_t filesize, blocksize;
+	std::string etag, bitmap;
+	if (ctx.etag.empty() || !statefs.good() || !(statefs >> filesize >> blocksize >> etag) || filesize != ctx.filesize ||
+		blocksize != RANGEBLOCK || etag != ctx.etag)
+		return false;
+	statefs.ignore(1); // newline ending header
+	std::getline(statefs, bitmap);
+	ctx.done.assign(bitmap.begin(), bitmap.end());
+	return true;
+}
+
+/*
+ * Tell whether an earlier attempt left a state file to resume from, whatever version of the file it belongs to
+ */
+bool has_download_state(const std::string& statepath)
+{
+	std::ifstream statefs(statepath.c_str());
+	size_t filesize, blocksize;
+	std::string etag;
+	return statefs.good() && (statefs >> filesize >> blocksize >> etag) && blocksize == RANGEBLOCK;
+}
+
+/*
+ * Thread routine: fetch blocks not yet written over one persistent connection
+ */
+void* range_worker(void* arg)
+{
+	range_ctx* ctx = (range_ctx*)arg;
+	size_t blocks = ctx->done.size();
+	int sockfd = -1;
+	size_t idx;
+	while (!ctx->changed && (idx = ctx->next.fetch_add(1)) < blocks)
+	{
+		if (ctx->done[idx] == '1')
+			continue;
+		size_t offset = idx * (size_t)RANGEBLOCK;
+		size_t length = std::min((size_t)RANGEBLOCK, ctx->filesize - offset);
+
+		bool ok = false;
+		unsigned int attempt;
+		for (attempt = 0; attempt < BATCHATTEMPTS && !ok && !ctx->changed; attempt++)
+		{
+			if (sockfd < 0 && (sockfd = tcp_connect(ctx->hostname, ctx->port)) < 0)
+				continue;
+			bool reusable = false;
+			try
+			{
+				http_request req = http_request::form_range_header(*ctx->conf, ctx->filename, ctx->hostname, ctx->username,
+																   offset, length, ctx->etag);
+				if (req.send(sockfd, "", deadline::none()))
+				{
+					http_response resp = http_response::receive_range(*ctx->conf, sockfd, ctx->fd, deadline::none());
+					ok = resp.status == http_status::PARTIAL_CONTENT_206 && resp.range_offset == offset &&
+						 resp.content_length == length;
+					if (resp.status == http_status::OK_200)
+						ctx->changed = true; // If-Range did not match, whole new version was sent
+					reusable = resp.keepalive;
+				}
+			}
+			catch (const general_exception& e)
+			{
+				std::cerr << e.what() << std::endl;
+			}
+			if (!reusable)
+			{
+				close(sockfd);
+				sockfd = -1;
+			}
+		}
+
+		/* block is marked done only after its data has been written */
+		if (ok && pwrite(ctx->statefd, "1", 1, ctx->stateheaderlen + idx) == 1)
+			ctx->fetched++;
+		else
+			ctx->failed++;
+	}
+	if (sockfd >= 0)
+		close(sockfd);
+	return arg;
+}
+
+/*
+ * Get files of the list in one bundle response over one connection, unpacked into dirpath as they arrive
+ */
+int run_bundle_download(const batch_opts& opts, const std::string& hostname, const std::string& port,
+						const std::string& username, const std::string& dirpath)
+{
+	std::ifstream fs(opts.listpath.c_str());
+	if (!fs.good())
+	{
+		std::cerr << "file stream error" << std::endl;
+		return -1;
+	}
+	std::vector<std::string> uris;
+	std::string line;
+	while (std::getline(fs, line))
+	{
+		std::vector<std::string> tokens = split_string(line, ' ');
+		if (tokens.empty() || tokens[0].empty())
+			continue;
+		uris.push_back(tokens[0].at(0) == '/' ? tokens[0] : "/" + tokens[0]);
+	}
+	fs.close();
+
+	int sockfd;
+	if ((sockfd = tcp_connect(hostname, port)) < 0)
+		return -1;
+
+	bundle_unpack_ctx unpack;
+	unpack.dirpath = dirpath;
+	unpack.fd = -1;
+	unpack.remaining = 0;
+	unpack.received = 0;
+	unpack.failed = 0;
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int status = -1;
+	try
+	{
+		const http_conf conf("", "");
+		http_request req = http_request::form_bundle_header(conf, uris, hostname, username);
+		req.print_header();
+		if (!req.send(sockfd, dirpath, deadline::none()))
+			std::cerr << "failed to send the request" << std::endl;
+		else
+		{
+			http_response resp = http_response::receive_stream(conf, sockfd, req.method, bundle_unpack_sink, &unpack,
+															   deadline::none());
+			resp.print_header();
+			if (resp.status != http_status::OK_200)
+				std::cerr << "server responded " << conf.to_str(resp.status) << std::endl;
+			else if (!bundle_unpack_complete(unpack))
+				std::cerr << "bundle ended in the middle of " << unpack.uri << std::endl;
+			else
+				status = unpack.failed == 0 ? 0 : -1;
+		}
+	}
+	catch (const general_exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+	}
+	if (unpack.fd >= 0 && close(unpack.fd) < 0)
+		perror("close");
+	if (close(sockfd) < 0)
+		perror("close");
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("bundle: %lu of %lu files received, %lu failed in %.3f s\n", unpack.received, (unsigned long)uris.size(),
+		   unpack.failed, seconds);
+	return status;
+}
@@ -0,0 +1,330 @@
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+#include <unistd.h>
+
+#include "clientlib.hh"
+#include "general.hh"
+#include "http.hh"
+#include "networking.hh"
+
+/* request waiting for or running on a pool connection */
+struct client_job
+{
+	http_method method;
+	std::string filename;
+	std::string dirpath;
+	std::string queryname;
+	std::string querytype;
+	recv_sink_fn sink; // payload of GET streamed here if set
+	void* sinkctx;
+	std::promise<client_result> promise; // result goes here if there is no callback
+	client_callback cb;
+	void* arg;
+};
+
+/* user sink of a job, wrapped to know whether payload was already handed over */
+struct job_sink
+{
+	const client_job* job;
+	bool delivered;
+};
+
+client_job* new_job(http_method method, std::string filename, std::string dirpath, std::string queryname,
+					std::string querytype, client_callback cb, void* arg);
+bool forward_to_sink(void* ctx, const char* data, size_t len);
+void complete_job(client_job* job, const client_result& result);
+
+std::atomic<bool> tracechosen(false); // progress messages were directed by the embedding program
+
+http_client::http_client(std::string hostname, std::string port, std::string username, client_limits limits) :
+		hostname(hostname), port(port), username(username), limits(limits), conf("", ""), jobs(), stopping(false),
+		mutex(PTHREAD_MUTEX_INITIALIZER), condv(PTHREAD_COND_INITIALIZER), threads()
+{ }
+
+http_client* http_client::create(std::string hostname, std::string port, std::string username, client_limits limits)
+{
+	if (limits.connections == 0)
+	{
+		std::cerr << "client needs at least one connection" << std::endl;
+		return NULL;
+	}
+
+	if (!tracechosen)
+		set_trace(NULL); // library stays quiet on stdout of the embedding program
+
+	http_client* client = new http_client(hostname, port, username, limits);
+	unsigned int i;
+	for (i = 0; i < limits.connections; i++)
+	{
+		pthread_t tid;
+		if ((errno = pthread_create(&tid, NULL, connection_routine, client)) != 0)
+		{
+			perror("pthread_create");
+			delete client; // stops threads started so far
+			return NULL;
+		}
+		client->threads.push_back(tid);
+	}
+	return client;
+}
+
+void http_client::set_trace_output(std::ostream* os)
+{
+	tracechosen = true;
+	set_trace(os);
+}
+
+http_client::~http_client()
+{
+	std::deque<client_job*> abandoned;
+	if ((errno = pthread_mutex_lock(&mutex)) != 0)
+		perror("pthread_mutex_lock");
+	stopping = true;
+	abandoned.swap(jobs);
+	if ((errno = pthread_cond_broadcast(&condv)) != 0)
+		perror("pthread_cond_broadcast");
+	if ((errno = pthread_mutex_unlock(&mutex)) != 0)
+		perror("pthread_mutex_unlock");
+
+	client_result result;
+	result.ok = false;
+	result.status = http_status::NOT_SET_ST;
+	result.error = "client stopped";
+	std::deque<client_job*>::iterator it;
+	for (it = abandoned.begin(); it != abandoned.end(); it++)
+		complete_job(*it, result);
+
+	std::vector<pthread_t>::const_iterator tit;
+	for (tit = threads.begin(); tit != threads.end(); tit++)
+	{
+		if ((errno = pthread_join(*tit, NULL)) != 0)
+			perror("pthread_join");
+	}
+}
+
+std::future<client_result> http_client::dns_query(std::string queryname, std::string querytype)
+{
+	client_job* job = new_job(http_method::POST, "", "", queryname, to_upper(querytype), NULL, NULL);
+	std::future<client_result> result = job->promise.get_future();
+	submit(job);
+	return result;
+}
+
+void http_client::dns_query(std::string queryname, std::string querytype, client_callback cb, void* arg)
+{
+	submit(new_job(http_method::POST, "", "", queryname, to_upper(querytype), cb, arg));
+}
+
+std::future<client_result> http_client::get(std::string filename, std::string dirpath)
+{
+	client_job* job = new_job(http_method::GET, filename, dirpath, "", "", NULL, NULL);
+	std::future<client_result> result = job->promise.get_future();
+	submit(job);
+	return result;
+}
+
+void http_client::get(std::string filename, std::string dirpath, client_callback cb, void* arg)
+{
+	submit(new_job(http_method::GET, filename, dirpath, "", "", cb, arg));
+}
+
+std::future<client_result> http_client::get_stream(std::string filename, recv_sink_fn sink, void* ctx)
+{
+	client_job* job = new_job(http_method::GET, filename, "", "", "", NULL, NULL);
+	job->sink = sink;
+	job->sinkctx = ctx;
+	std::future<client_result> result = job->promise.get_future();
+	submit(job);
+	return result;
+}
+
+void http_client::get_stream(std::string filename, recv_sink_fn sink, void* ctx, client_callback cb, void* arg)
+{
+	client_job* job = new_job(http_method::GET, filename, "", "", "", cb, arg);
+	job->sink = sink;
+	job->sinkctx = ctx;
+	submit(job);
+}
+
+std::future<client_result> http_client::put(std::string filename, std::string dirpath)
+{
+	client_job* job = new_job(http_method::PUT, filename, dirpath, "", "", NULL, NULL);
+	std::future<client_result> result = job->promise.get_future();
+	submit(job);
+	return result;
+}
+
+void http_client::put(std::string filename, std::string dirpath, client_callback cb, void* arg)
+{
+	submit(new_job(http_method::PUT, filename, dirpath, "", "", cb, arg));
+}
+
+void http_client::submit(client_job* job)
+{
+	bool queued = false;
+	if ((errno = pthread_mutex_lock(&mutex)) != 0)
+		perror("pthread_mutex_lock");
+	else
+	{
+		if (!stopping && jobs.size() < limits.queued)
+		{
+			jobs.push_back(job);
+			queued = true;
+			if ((errno = pthread_cond_signal(&condv)) != 0)
+				perror("pthread_cond_signal");
+		}
+		if ((errno = pthread_mutex_unlock(&mutex)) != 0)
+			perror("pthread_mutex_unlock");
+	}
+
+	if (!queued)
+	{
+		client_result result;
+		result.ok = false;
+		result.status = http_status::NOT_SET_ST;
+		result.error = "request queue full";
+		complete_job(job, result);
+	}
+}
+
+void* http_client::connection_routine(void* arg)
+{
+	http_client* client = (http_client*)arg;
+	int sockfd = -1; // persistent connection of this thread, opened on first job
+	while (1)
+	{
+		if ((errno = pthread_mutex_lock(&client->mutex)) != 0)
+		{
+			perror("pthread_mutex_lock");
+			break;
+		}
+		while (client->jobs.empty() && !client->stopping)
+		{
+			if ((errno = pthread_cond_wait(&client->condv, &client->mutex)) != 0)
+			{
+				perror("pthread_cond_wait");
+				break;
+			}
+		}
+		client_job* job = NULL;
+		if (!client->jobs.empty())
+		{
+			job = client->jobs.front();
+			client->jobs.pop_front();
+		}
+		if ((errno = pthread_mutex_unlock(&client->mutex)) != 0)
+			perror("pthread_mutex_unlock");
+		if (job == NULL)
+			break; // stopping
+
+		complete_job(job, client->run_job(*job, sockfd));
+	}
+	if (sockfd >= 0)
+		close(sockfd);
+	return arg;
+}
+
+client_result http_client::run_job(const client_job& job, int& sockfd)
+{
+	client_result result;
+	result.ok = false;
+	result.status = http_status::NOT_SET_ST;
+
+	job_sink js;
+	js.job = &job;
+	js.delivered = false;
+
+	int attempt;
+	for (attempt = 0; attempt < 2; attempt++)
+	{
+		bool reused = sockfd >= 0;
+		if (sockfd < 0 && (sockfd = tcp_connect(hostname, port)) < 0)
+		{
+			result.error = "failed to connect";
+			return result;
+		}
+
+		const deadline dl = limits.timeoutms > 0 ? deadline::after_ms(limits.timeoutms) : deadline::none();
+		bool formed = false;
+		try
+		{
+			http_request req = http_request::form_header(conf, conf.to_str(job.method), job.dirpath, job.filename, hostname,
+														 username, job.queryname, job.querytype);
+			formed = true;
+			if (req.send(sockfd, job.dirpath, dl))
+			{
+				http_response resp = job.sink != NULL ?
+					http_response::receive_stream(conf, sockfd, req.method, forward_to_sink, &js, dl) :
+					http_response::receive(conf, sockfd, req.method, job.dirpath, req.uri, dl);
+				result.ok = true;
+				result.status = resp.status;
+				result.body = resp.body;
+				result.error.clear();
+				if (!resp.keepalive)
+				{
+					close(sockfd);
+					sockfd = -1;
+				}
+				return result;
+			}
+			result.error = "failed to send request";
+		}
+		catch (const general_exception& e)
+		{
+			result.error = e.what();
+			if (!formed)
+				return result; // nothing was sent, connection is still usable
+		}
+		close(sockfd);
+		sockfd = -1;
+
+		/* only a reused connection may have been closed by server while idle,
+		 * and streamed payload cannot be taken back from the sink */
+		if (!reused || dl.expired() || js.delivered)
+			break;
+	}
+	return result;
+}
+
+/*
+ * Allocate job, freed when completed
+ */
+client_job* new_job(http_method method, std::string filename, std::string dirpath, std::string queryname,
+					std::string querytype, client_callback cb, void* arg)
+{
+	client_job* job = new client_job;
+	job->method = method;
+	job->filename = filename.empty() || filename.at(0) == '/' ? filename : "/" + filename;
+	job->dirpath = dirpath;
+	job->queryname = queryname;
+	job->querytype = querytype;
+	job->sink = NULL;
+	job->sinkctx = NULL;
+	job->cb = cb;
+	job->arg = arg;
+	return job;
+}
+
+/*
+ * Pass payload on to the sink of a job
+ */
+bool forward_to_sink(void* ctx, const char* data, size_t len)
+{
+	job_sink* js = (job_sink*)ctx;
+	js->delivered = true;
+	return js->job->sink(js->job->sinkctx, data, len);
+}
+
+/*
+ * Hand result to callback or future and free job
+ */
+void complete_job(client_job* job, const client_result& result)
+{
+	if (job->cb != NULL)
+		job->cb(result, job->arg);
+	else
+		job->promise.set_value(result);
+	delete job;
+}
@@ -0,0 +1,191 @@
+/* Asynchronous client library for embedding in other programs */
+
+#ifndef NETPROG_CLIENTLIB_HH
+#define NETPROG_CLIENTLIB_HH
+
+#include <deque>
+#include <future>
+#include <iosfwd>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+#include "httpconf.hh"
+#include "networking.hh"
+
+/* outcome of an asynchronous request */
+struct client_result
+{
+	bool ok; // true if a response was received
+	http_status status; // status of response
+	std::string body; // payload of response held in memory (DNS answers)
+	std::string error; // reason if no response was received
+};
+
+/*
+ * Completion callback, run on a library thread: it must not block for long
+ *
+ * result: outcome of request
+ * arg: argument given with request
+ */
+typedef void (*client_callback)(const client_result& result, void* arg);
+
+/* pool limits of a client */
+struct client_limits
+{
+	unsigned int connections; // persistent connections, i.e. requests in flight
+	unsigned int queued; // requests waiting for a connection before new ones are refused
+	unsigned long timeoutms; // deadline of each request from when it is taken into a connection
+};
+
+struct client_job;
+
+/*
+ * Client of one server with a shared pool of persistent connections
+ * Requests are queued without blocking and completed by pool threads, which keep
+ * their connections open between requests
+ */
+class http_client
+{
+public:
+
+	/*
+	 * Create client and start its connection threads
+	 *
+	 * hostname: server hostname
+	 * port: server port
+	 * username: iam header field
+	 * limits: pool limits
+	 * return: client object (delete to stop it), NULL on failure
+	 */
+	static http_client* create(std::string hostname, std::string port, std::string username, client_limits limits);
+
+	/*
+	 * Direct progress messages of requests (headers, payload transfers) of all clients to a stream,
+	 * they are discarded unless this is called
+	 *
+	 * os: stream for messages, NULL to discard them again
+	 */
+	static void set_trace_output(std::ostream* os);
+
+	/*
+	 * Destructor, fails queued requests and waits for requests in flight
+	 */
+	~http_client();
+
+	/*
+	 * Query DNS through the server
+	 *
+	 * queryname: name to query
+	 * querytype: query type (A or AAAA)
+	 * return: future of the result
+	 */
+	std::future<client_result> dns_query(std::string queryname, std::string querytype);
+
+	/*
+	 * Query DNS through the server, result passed to callback
+	 *
+	 * queryname: name to query
+	 * querytype: query type (A or AAAA)
+	 * cb: completion callback, also called (on the calling thread) if request is refused
+	 * arg: argument passed to callback
+	 */
+	void dns_query(std::string queryname, std::string querytype, client_callback cb, void* arg);
+
+	/*
+	 * Download file from the server
+	 *
+	 * filename: filename (URI)
+	 * dirpath: directory to write file to
+	 * return: future of the result
+	 */
+	std::future<client_result> get(std::string filename, std::string dirpath);
+
+	/*
+	 * Download file from the server, result passed to callback
+	 *
+	 * filename: filename (URI)
+	 * dirpath: directory to write file to
+	 * cb: completion callback, also called (on the calling thread) if request is refused
+	 * arg: argument passed to callback
+	 */
+	void get(std::string filename, std::string dirpath, client_callback cb, void* arg);
+
+	/*
+	 * Download file from the server, payload handed to sink in fixed-size buffers as it
+	 * arrives (on a library thread) instead of being written to a file
+	 *
+	 * filename: filename (URI)
+	 * sink: consumer of payload, returning false aborts the request
+	 * ctx: context passed to sink
+	 * return: future of the result
+	 */
+	std::future<client_result> get_stream(std::string filename, recv_sink_fn sink, void* ctx);
+
+	/*
+	 * Download file from the server into a sink, result passed to callback
+	 *
+	 * filename: filename (URI)
+	 * sink: consumer of payload, returning false aborts the request
+	 * ctx: context passed to sink
+	 * cb: completion callback, also called (on the calling thread) if request is refused
+	 * arg: argument passed to callback
+	 */
+	void get_stream(std::string filename, recv_sink_fn sink, void* ctx, client_callback cb, void* arg);
+
+	/*
+	 * Upload file to the server
+	 *
+	 * filename: filename (URI)
+	 * dirpath: directory to read file from
+	 * return: future of the result
+	 */
+	std::future<client_result> put(std::string filename, std::string dirpath);
+
+	/*
+	 * Upload file to the server, result passed to callback
+	 *
+	 * filename: filename (URI)
+	 * dirpath: directory to read file from
+	 * cb: completion callback, also called (on the calling thread) if request is refused
+	 * arg: argument passed to callback
+	 */
+	void put(std::string filename, std::string dirpath, client_callback cb, void* arg);
+
+private:
+
+	/*
+	 * Private constructor
+	 * Class instances are created by static member functions
+	 */
+	http_client(std::string hostname, std::string port, std::string username, client_limits limits);
+
+	/*
+	 * Queue job for pool threads, completed at once with an error if queue is full
+	 */
+	void submit(client_job* job);
+
+	/*
+	 * Thread routine of a pool connection
+	 */
+	static void* connection_routine(void* arg);
+
+	/*
+	 * Run job over connection, reconnecting once if a reused connection turns out closed
+	 */
+	client_result run_job(const client_job& job, int& sockfd);
+
+	const std::string hostname;
+	const std::string port;
+	const std::string username;
+	const client_limits limits;
+	const http_conf conf;
+
+	std::deque<client_job*> jobs; // waiting jobs, access protected by mutex
+	bool stopping;
+	pthread_mutex_t mutex;
+	pthread_cond_t condv; // condition of interest: jobs queued or stopping
+	std::vector<pthread_t> threads;
+};
+
+#endif
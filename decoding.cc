@@ -0,0 +1,108 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include <zlib.h>
+
+#include "encoding.hh"
+#include "networking.hh"
+
+#define ZBUFSIZE 65536 // chunk size of decompression
+#define AUTOWINDOW (15 + 32) // zlib window bits detecting gzip or zlib format
+
+bool inflate_to(int srcfd, int dstfd);
+
+bool decode_file(const std::string& path)
+{
+	std::cout << "decoding file: " << path << std::endl;
+	int srcfd;
+	if ((srcfd = open(path.c_str(), O_RDONLY)) < 0)
+	{
+		perror("open");
+		return false;
+	}
+	struct stat st;
+	std::string tmppath = path + ".XXXXXX";
+	std::vector<char> tmpname(tmppath.begin(), tmppath.end());
+	tmpname.push_back('\0');
+	int dstfd;
+	if (fstat(srcfd, &st) < 0 || (dstfd = mkstemp(&tmpname[0])) < 0)
+	{
+		perror("decode_file");
+		close(srcfd);
+		return false;
+	}
+	bool decoded = inflate_to(srcfd, dstfd);
+	if (decoded && fchmod(dstfd, st.st_mode & 07777) < 0)
+		perror("fchmod");
+	close(srcfd);
+	if (close(dstfd) < 0)
+	{
+		perror("close");
+		decoded = false;
+	}
+	if (decoded && rename(&tmpname[0], path.c_str()) < 0)
+	{
+		perror("rename");
+		decoded = false;
+	}
+	if (!decoded)
+		unlink(&tmpname[0]);
+	return decoded;
+}
+
+/*
+ * Decompress gzip or zlib format file into another file
+ */
+bool inflate_to(int srcfd, int dstfd)
+{
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	if (inflateInit2(&zs, AUTOWINDOW) != Z_OK)
+	{
+		std::cerr << "inflateInit2 failed" << std::endl;
+		return false;
+	}
+
+	std::vector<char> in(ZBUFSIZE), out(ZBUFSIZE);
+	int ret = Z_OK;
+	while (ret != Z_STREAM_END)
+	{
+		ssize_t readnow;
+		if ((readnow = read(srcfd, &in[0], ZBUFSIZE)) <= 0)
+		{
+			if (readnow < 0)
+				perror("read");
+			else
+				std::cerr << "compressed data ended too early" << std::endl;
+			break;
+		}
+		zs.next_in = (Bytef*)&in[0];
+		zs.avail_in = readnow;
+		do
+		{
+			zs.next_out = (Bytef*)&out[0];
+			zs.avail_out = ZBUFSIZE;
+			ret = inflate(&zs, Z_NO_FLUSH);
+			if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+			{
+				std::cerr << "inflate failed: " << (zs.msg != NULL ? zs.msg : "invalid data") << std::endl;
+				inflateEnd(&zs);
+				return false;
+			}
+			if (!fd_sink(&dstfd, &out[0], ZBUFSIZE - zs.avail_out))
+			{
+				inflateEnd(&zs);
+				return false;
+			}
+		} while (zs.avail_out == 0 && ret != Z_STREAM_END);
+	}
+
+	inflateEnd(&zs);
+	return ret == Z_STREAM_END;
+}
@@ -1,20 +1,31 @@
 #include <arpa/inet.h>
+#include <cerrno>
 #include <inttypes.h>
 #include <cstdio>
 #include <cstring>
+#include <ctime>
 #include <iostream>
 #include <iomanip>
-#include <sstream>
+#include <map>
+#include <poll.h>
+#include <pthread.h>
 #include <string>
+#include <strings.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <unordered_map>
 #include <vector>
 
 #include "dns.hh"
 #include "networking.hh"
 
 #define UDPBUFSIZE 2048 // maximum datagram size sent and received
-#define DNSPORT "53" // well-known DNS port number
+#define DNSMAXCHAIN 8 // maximum number of CNAME links followed for one query
+#define DNSCACHEMAX 65536 // maximum number of cached answer sets
+
+#define DNSTYPE_A 1
+#define DNSTYPE_CNAME 5
+#define DNSTYPE_AAAA 28
 
 /* DNS header */
 struct dns_header
@@ -47,40 +58,135 @@ struct dns_question
 	uint16_t qclass;
 };
 
-/* DNS message resource record */
-struct dns_res_record
+#define DNSMAXRDATA 16 // longest record data stored inline (IPv6 address)
+
+/* DNS answer record packed for contiguous storage, owner name interned and data inline */
+struct dns_packed_rr
 {
-	std::string rname;
+	uint32_t nameoff; // offset of owner name in the name table of the answer set
+	uint32_t rttl;
 	uint16_t rtype;
 	uint16_t rclass;
-	uint32_t rttl;
-	uint16_t rdlength;
-	std::vector<uint8_t> rdata; // only IPv4 address supported
+	uint8_t rdlength;
+	uint8_t rdata[DNSMAXRDATA];
+};
+
+/* DNS answer set: packed records in one array, owner names interned in one NUL-separated table */
+class dns_answer_set
+{
+public:
+
+	/*
+	 * Append record to the set, interning its owner name
+	 */
+	void add(const char* rname, uint16_t rtype, uint16_t rclass, uint32_t rttl, const uint8_t* rdata, uint8_t rdlength);
+
+	/*
+	 * Append CNAME record to the set, interning both owner and target names
+	 */
+	void add_cname(const char* rname, uint16_t rclass, uint32_t rttl, const char* target);
+
+	/*
+	 * Split records into sets by owner name and type
+	 *
+	 * groups: sets keyed by cache key of owner name and type
+	 */
+	void split(std::map<std::string, dns_answer_set>& groups) const;
+
+	/*
+	 * Render records as response text, appending to out
+	 *
+	 * age: seconds to subtract from the TTLs
+	 */
+	void render(std::string& out, uint32_t age) const;
+
+	/*
+	 * Target name of the first CNAME record in the set
+	 */
+	std::string cname_target() const;
+
+	/*
+	 * Smallest TTL of the records in the set
+	 */
+	uint32_t min_ttl() const;
+
+	/*
+	 * Release unused capacity of the arrays
+	 */
+	void shrink();
+
+	/*
+	 * Number of records in the set
+	 */
+	size_t size() const;
+
+	/*
+	 * Memory used by the set in bytes (including heap storage)
+	 */
+	size_t footprint() const;
+
+private:
+
+	/*
+	 * Find owner name from the name table or append it
+	 *
+	 * return: offset of the name in the table
+	 */
+	uint32_t intern(const char* name, size_t len);
+
+	/*
+	 * Copy record from another set, re-interning its names into this set
+	 */
+	void copy_record(const dns_answer_set& source, const dns_packed_rr& rr);
+
+	std::vector<dns_packed_rr> records;
+	std::string names;
+};
+
+/* cached answer set of one name and type */
+struct dns_cache_entry
+{
+	time_t stored; // time of storing
+	time_t expires; // time of expiry based on smallest TTL in the set
+	std::multimap<time_t, std::string>::iterator expiryit; // position in expiry index
+	dns_answer_set answers;
 };
 
-bool send_query(int sockfd, struct sockaddr* destaddr, socklen_t addrlen, std::string queryname);
-bool recv_response(int sockfd, std::string& formedresp);
+/* DNS cache shared by request processing threads, keyed by name and type, access protected by mutex */
+std::unordered_map<std::string, dns_cache_entry> dnscache;
+std::multimap<time_t, std::string> dnsexpiry; // keys of cache by expiry time, soonest first
+pthread_mutex_t dnscachemutex = PTHREAD_MUTEX_INITIALIZER;
+
+bool query_server(std::string dnsservip, std::string dnsport, std::string queryname, uint16_t qtype,
+				  std::map<std::string, dns_answer_set>& groups, const deadline& dl, int watchfd);
+bool find_link(const std::map<std::string, dns_answer_set>& fetched, const std::string& name, uint16_t type,
+			   dns_answer_set& answers, uint32_t& age);
+bool cache_lookup(const std::string& key, dns_answer_set& answers, uint32_t& age);
+void cache_store(const std::string& key, const dns_answer_set& answers);
+std::string cache_key(const std::string& name, uint16_t type);
+uint16_t str_to_qtype(const std::string& querytype);
+bool send_query(int sockfd, struct sockaddr* destaddr, socklen_t addrlen, std::string queryname, uint16_t qtype);
+bool recv_response(int sockfd, dns_answer_set& answers, const deadline& dl, int watchfd);
 void init_query_header(dns_header* header);
-void init_query_question(dns_question* question, std::string queryname);
+void init_query_question(dns_question* question, std::string queryname, uint16_t qtype);
 uint8_t* serialize_header(uint8_t* buffer, dns_header* source, size_t& msglen);
 uint8_t* serialize_question(uint8_t* buffer, dns_question* source, size_t& msglen);
 uint8_t* deserialize_header(uint8_t* headerstart, dns_header* header);
 uint8_t* deserialize_question(uint8_t* msgstart, uint8_t* quesstart, dns_question* question);
-uint8_t* deserialize_res_rec(uint8_t* msgstart, uint8_t* rrstart, dns_res_record* resrec, bool& supported);
-std::string form_response(const std::vector<dns_res_record>& answers);
-std::string remove_last_dot(std::string str);
-std::string addr_type_to_str(uint16_t addrtype);
-std::string addr_class_to_str(uint16_t addrclass);
-std::string ipv4_addr_to_str(std::vector<uint8_t> addrdata);
+uint8_t* deserialize_res_rec(uint8_t* msgstart, uint8_t* rrstart, dns_answer_set& answers);
+const char* addr_type_to_str(uint16_t addrtype);
+const char* addr_class_to_str(uint16_t addrclass);
 void to_dns_name_enc(char* dnsformat, char* hostformat);
 uint8_t* process_name(uint8_t *bstart, uint8_t *bcur, char *name);
 uint8_t get_bit(uint8_t byte, int bitidx);
 
-dns_query_response do_dns_query(std::string dnsservip, std::string queryname, std::string querytype)
+dns_query_response do_dns_query(std::string dnsservip, std::string dnsport, std::string queryname, std::string querytype,
+								const deadline& dl, int watchfd)
 {
 	dns_query_response resp;
 
-	if (!querytype.compare(SQUERYTYPE)) // only type A currently supported
+	uint16_t qtype = str_to_qtype(querytype);
+	if (qtype == 0) // only types A and AAAA currently supported
 	{
 		std::cerr << "unsupported DNS query type" << std::endl;
 		resp.status = dns_query_status::FAIL;
@@ -93,43 +199,224 @@ dns_query_response do_dns_query(std::string dnsservip, std::string queryname, st
 		return resp;
 	}
 
-	int sockfd;
-	struct sockaddr* destaddr;
-	socklen_t addrlen;
+	/*
+	 * Resolve name link by link: each CNAME link and the final answer set are looked up
+	 * separately, so links shared by several names (e.g. CDN targets) are fetched once
+	 */
+	std::string formedresp = "DNS answers:\n\n"; // string to be returned as a response
+	std::map<std::string, dns_answer_set> fetched; // answer sets received from DNS server during this query
+	std::string name = queryname;
+	bool queried = false; // true if DNS server has been asked about current name
+	int links = 0;
+	while (links <= DNSMAXCHAIN)
+	{
+		dns_answer_set link;
+		uint32_t age;
+		if (find_link(fetched, name, qtype, link, age))
+		{
+			link.render(formedresp, age);
+			break;
+		}
+		if (find_link(fetched, name, DNSTYPE_CNAME, link, age))
+		{
+			link.render(formedresp, age);
+			name = link.cname_target();
+			queried = false;
+			links++;
+			continue;
+		}
+		if (queried)
+			break; // no (more) answers for the name
 
-	if ((sockfd = init_udp(dnsservip.c_str(), DNSPORT, &destaddr, &addrlen)) < 0)
+		std::map<std::string, dns_answer_set> received;
+		if (!query_server(dnsservip, dnsport, name, qtype, received, dl, watchfd))
+		{
+			if (dl.expired())
+				resp.status = dns_query_status::TIMEOUT;
+			else if (watchfd >= 0 && peer_hung_up(watchfd))
+				resp.status = dns_query_status::CANCELLED;
+			else
+				resp.status = dns_query_status::FAIL;
+			return resp;
+		}
+		std::map<std::string, dns_answer_set>::const_iterator it;
+		for (it = received.begin(); it != received.end(); it++)
+		{
+			cache_store(it->first, it->second);
+			fetched[it->first] = it->second;
+		}
+		queried = true;
+	}
+	if (links > DNSMAXCHAIN)
 	{
+		std::cerr << "too long CNAME chain" << std::endl;
 		resp.status = dns_query_status::FAIL;
 		return resp;
 	}
 
-	if (!send_query(sockfd, destaddr, addrlen, queryname))
+	resp.status = dns_query_status::SUCCESS;
+	resp.response = formedresp;
+	resp.resp_len = resp.response.length();
+	return resp;
+}
+
+/*
+ * Query DNS server, split supported answer records into sets by owner name and type
+ */
+bool query_server(std::string dnsservip, std::string dnsport, std::string queryname, uint16_t qtype,
+				  std::map<std::string, dns_answer_set>& groups, const deadline& dl, int watchfd)
+{
+	int sockfd;
+	struct sockaddr_storage destaddr;
+	socklen_t addrlen;
+
+	if ((sockfd = init_udp(dnsservip.c_str(), dnsport.c_str(), &destaddr, &addrlen)) < 0)
+		return false;
+
+	if (!send_query(sockfd, (struct sockaddr*)&destaddr, addrlen, queryname, qtype))
 	{
 		if (close(sockfd) < 0) perror("close");
-		resp.status = dns_query_status::FAIL;
-		return resp;
+		return false;
 	}
 
-	std::string formedresp; // string to be returned as a response
-	if (!recv_response(sockfd, formedresp))
+	dns_answer_set answers;
+	if (!recv_response(sockfd, answers, dl, watchfd))
 	{
 		if (close(sockfd) < 0) perror("close");
-		resp.status = dns_query_status::FAIL;
-		return resp;
+		return false;
 	}
 
 	if (close(sockfd) < 0) perror("close");
 
-	resp.status = dns_query_status::SUCCESS;
-	resp.response = formedresp;
-	resp.resp_len = strlen(resp.response.c_str());
-	return resp;
+	answers.split(groups);
+	return true;
+}
+
+/*
+ * Find answer set for name and type from sets fetched during the query or from cache
+ */
+bool find_link(const std::map<std::string, dns_answer_set>& fetched, const std::string& name, uint16_t type,
+			   dns_answer_set& answers, uint32_t& age)
+{
+	std::string key = cache_key(name, type);
+	std::map<std::string, dns_answer_set>::const_iterator it = fetched.find(key);
+	if (it != fetched.end())
+	{
+		answers = it->second;
+		age = 0;
+		return true;
+	}
+	if (cache_lookup(key, answers, age))
+	{
+		std::cout << "DNS cache hit: " << key << std::endl;
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Look up unexpired answer set from cache
+ */
+bool cache_lookup(const std::string& key, dns_answer_set& answers, uint32_t& age)
+{
+	bool found = false;
+	time_t now = time(NULL);
+
+	if ((errno = pthread_mutex_lock(&dnscachemutex)) != 0)
+	{
+		perror("pthread_mutex_lock");
+		return false;
+	}
+	std::unordered_map<std::string, dns_cache_entry>::iterator it = dnscache.find(key);
+	if (it != dnscache.end())
+	{
+		if (it->second.expires > now)
+		{
+			answers = it->second.answers;
+			age = (uint32_t)(now - it->second.stored);
+			found = true;
+		}
+		else
+		{
+			dnsexpiry.erase(it->second.expiryit); // expired
+			dnscache.erase(it);
+		}
+	}
+	if ((errno = pthread_mutex_unlock(&dnscachemutex)) != 0)
+		perror("pthread_mutex_unlock");
+
+	return found;
+}
+
+/*
+ * Store answer set into cache until its smallest TTL expires
+ */
+void cache_store(const std::string& key, const dns_answer_set& answers)
+{
+	uint32_t ttl = answers.min_ttl();
+	if (ttl == 0)
+		return; // must not be cached
+
+	time_t now = time(NULL);
+	if ((errno = pthread_mutex_lock(&dnscachemutex)) != 0)
+	{
+		perror("pthread_mutex_lock");
+		return;
+	}
+	std::unordered_map<std::string, dns_cache_entry>::iterator it = dnscache.find(key);
+	if (it != dnscache.end())
+	{
+		dnsexpiry.erase(it->second.expiryit); // replaced
+		dnscache.erase(it);
+	}
+
+	/* drop expired entries, then the ones expiring first while cache is full */
+	while (!dnsexpiry.empty() && (dnsexpiry.begin()->first <= now || dnscache.size() >= DNSCACHEMAX))
+	{
+		dnscache.erase(dnsexpiry.begin()->second);
+		dnsexpiry.erase(dnsexpiry.begin());
+	}
+	dns_cache_entry& entry = dnscache[key];
+	entry.stored = now;
+	entry.expires = now + ttl;
+	entry.expiryit = dnsexpiry.insert(std::make_pair(entry.expires, key));
+	entry.answers = answers;
+	if ((errno = pthread_mutex_unlock(&dnscachemutex)) != 0)
+		perror("pthread_mutex_unlock");
+}
+
+/*
+ * Form cache key from name and type (names compared case-insensitively, without last dot)
+ */
+std::string cache_key(const std::string& name, uint16_t type)
+{
+	std::string key = name;
+	if (key.length() > 0 && key[key.length() - 1] == '.')
+		key.erase(key.length() - 1);
+	std::string::iterator it;
+	for (it = key.begin(); it != key.end(); it++)
+		*it = tolower(*it);
+	char typebuf[8];
+	snprintf(typebuf, sizeof(typebuf), "/%u", (unsigned int)type);
+	return key + typebuf;
+}
+
+/*
+ * Convert query type string to type value, 0 if unsupported
+ */
+uint16_t str_to_qtype(const std::string& querytype)
+{
+	if (strcasecmp(querytype.c_str(), "A") == 0)
+		return DNSTYPE_A;
+	if (strcasecmp(querytype.c_str(), "AAAA") == 0)
+		return DNSTYPE_AAAA;
+	return 0;
 }
 
 /*
  * Send DNS query
  */
-bool send_query(int sockfd, struct sockaddr* destaddr, socklen_t addrlen, std::string queryname)
+bool send_query(int sockfd, struct sockaddr* destaddr, socklen_t addrlen, std::string queryname, uint16_t qtype)
 {
 	uint8_t msg[UDPBUFSIZE];
 	uint8_t* msgcur = msg; // address to write next
@@ -142,7 +429,7 @@ bool send_query(int sockfd, struct sockaddr* destaddr, socklen_t addrlen, std::s
 
 	/* init question structure, serialize for sending to network */
 	dns_question question;
-	init_query_question(&question, queryname);
+	init_query_question(&question, queryname, qtype);
 	msgcur = serialize_question(msgcur, &question, msglen);
 
 	ssize_t sent;
@@ -158,10 +445,12 @@ bool send_query(int sockfd, struct sockaddr* destaddr, socklen_t addrlen, std::s
 /*
  * Receive DNS response
  */
-bool recv_response(int sockfd, std::string& formedresp)
+bool recv_response(int sockfd, dns_answer_set& answers, const deadline& dl, int watchfd)
 {
 	uint8_t udpmsg[UDPBUFSIZE];
 	ssize_t recvd;
+	if (!wait_ready_watch(sockfd, POLLIN, watchfd, dl))
+		return false;
 	if ((recvd = recvfrom(sockfd, udpmsg, UDPBUFSIZE, 0, NULL, NULL)) < 0)
 	{
 		perror("recvfrom");
@@ -194,20 +483,14 @@ bool recv_response(int sockfd, std::string& formedresp)
 		questions.push_back(question);
 	}
 
-	/* construct resource record structures for supported answer types based on received data */
-	std::vector<dns_res_record> answerresrecs;
+	/* pack supported answer records into answer set based on received data */
 	uint16_t ai;
 	for (ai = 0; ai < header.ancount; ai++)
-	{
-		dns_res_record answerresrec;
-		bool supported;
-		msgcur = deserialize_res_rec(udpmsg, msgcur, &answerresrec, supported);
-		if (supported)
-			answerresrecs.push_back(answerresrec);
-	}
-
-	/* form response string from answers */
-	formedresp = form_response(answerresrecs);
+		msgcur = deserialize_res_rec(udpmsg, msgcur, answers);
+	answers.shrink();
+	if (answers.size() > 0)
+		std::cout << "answer set: " << answers.size() << " records, " << answers.footprint() << " bytes ("
+				  << answers.footprint() / answers.size() << " bytes per answer)" << std::endl;
 
 	return true;
 }
@@ -242,14 +525,14 @@ void init_query_header(dns_header* header)
 /*
  * Initialize values to query question structure
  */
-void init_query_question(dns_question* question, std::string queryname)
+void init_query_question(dns_question* question, std::string queryname, uint16_t qtype)
 {
 	char host[300];
 	strcpy(host, queryname.c_str());
 	char qname[300];
 	to_dns_name_enc(qname, host);
 	question->qname = qname;
-	question->qtype = 1; // type A
+	question->qtype = qtype;
 	question->qclass = 1; // class IN
 }
 
@@ -476,9 +759,9 @@ uint8_t* deserialize_question(uint8_t* msgstart, uint8_t* quesstart, dns_questio
 }
 
 /*
- * Deserialize data from buffer into resource record structure
+ * Deserialize resource record from buffer, append to answer set if supported
  */
-uint8_t* deserialize_res_rec(uint8_t* msgstart, uint8_t* rrstart, dns_res_record* resrec, bool& supported)
+uint8_t* deserialize_res_rec(uint8_t* msgstart, uint8_t* rrstart, dns_answer_set& answers)
 {
 	std::cout << std::endl << "deserializing DNS resource record:" << std::endl;
 	uint8_t* msgcur = rrstart;
@@ -486,115 +769,215 @@ uint8_t* deserialize_res_rec(uint8_t* msgstart, uint8_t* rrstart, dns_res_record
 	/* process name */
 	char rname[1024];
 	msgcur = process_name(msgstart, msgcur, rname);
-	resrec->rname = rname;
-	std::cout << "rname: " << resrec->rname << std::endl;
+	std::cout << "rname: " << rname << std::endl;
 
 	/* process type */
 	uint16_t rtypenbo;
 	memcpy(&rtypenbo, msgcur, sizeof(uint16_t));
-	resrec->rtype = ntohs(rtypenbo);
-	std::cout << "rtype: " << resrec->rtype << std::endl;
+	uint16_t rtype = ntohs(rtypenbo);
+	std::cout << "rtype: " << rtype << std::endl;
 	msgcur += sizeof(uint16_t);
 
 	/* process class */
 	uint16_t rclassnbo;
 	memcpy(&rclassnbo, msgcur, sizeof(uint16_t));
-	resrec->rclass = ntohs(rclassnbo);
-	std::cout << "rclass: " << resrec->rclass << std::endl;
+	uint16_t rclass = ntohs(rclassnbo);
+	std::cout << "rclass: " << rclass << std::endl;
 	msgcur += sizeof(uint16_t);
 
 	/* process ttl */
 	uint32_t rttlnbo;
 	memcpy(&rttlnbo, msgcur, sizeof(uint32_t));
-	resrec->rttl = ntohl(rttlnbo);
-	std::cout << "rttl: " << resrec->rttl << std::endl;
+	uint32_t rttl = ntohl(rttlnbo);
+	std::cout << "rttl: " << rttl << std::endl;
 	msgcur += sizeof(uint32_t);
 
 	/* process data length */
 	uint16_t rdlengthnbo;
 	memcpy(&rdlengthnbo, msgcur, sizeof(uint16_t));
-	resrec->rdlength = ntohs(rdlengthnbo);
-	std::cout << "rdlength: " << resrec->rdlength << std::endl;
+	uint16_t rdlength = ntohs(rdlengthnbo);
+	std::cout << "rdlength: " << rdlength << std::endl;
 	msgcur += sizeof(uint16_t);
 
 	/* process data */
-	if (resrec->rtype == 1 && resrec->rclass == 1 && resrec->rdlength == 4)
+	if (rtype == DNSTYPE_A && rclass == 1 && rdlength == 4)
 	{
-		std::vector<uint8_t> rdata;
-		int i;
-		for (i = 0; i < 4; i++)
-			rdata.push_back(msgcur[i]);
-		resrec->rdata = rdata;
-		std::cout << "rdata: " << ipv4_addr_to_str(resrec->rdata) << std::endl;
+		answers.add(rname, rtype, rclass, rttl, msgcur, 4);
 		msgcur += 4;
-		supported = true;
+	}
+	else if (rtype == DNSTYPE_AAAA && rclass == 1 && rdlength == 16)
+	{
+		answers.add(rname, rtype, rclass, rttl, msgcur, 16);
+		msgcur += 16;
+	}
+	else if (rtype == DNSTYPE_CNAME && rclass == 1)
+	{
+		char target[1024];
+		process_name(msgstart, msgcur, target);
+		std::cout << "rdata: " << target << std::endl;
+		answers.add_cname(rname, rclass, rttl, target);
+		msgcur += rdlength;
 	}
 	else
 	{
 		std::cout << "unsupported combination of type, class and data length, skipping data" << std::endl;
-		msgcur += resrec->rdlength; // skip unsupported data
-		supported = false;
+		msgcur += rdlength; // skip unsupported data
 	}
 
 	return msgcur;
 }
 
-/*
- * Form DNS response string to be returned
- */
-std::string form_response(const std::vector<dns_res_record>& answers)
+void dns_answer_set::add(const char* rname, uint16_t rtype, uint16_t rclass, uint32_t rttl, const uint8_t* rdata, uint8_t rdlength)
 {
-	std::stringstream ss;
-	ss << "DNS answers:" << std::endl << std::endl;
+	size_t namelen = strlen(rname);
+	if (namelen > 0 && rname[namelen - 1] == '.') // remove last dot
+		namelen--;
+
+	dns_packed_rr rr;
+	rr.nameoff = intern(rname, namelen);
+	rr.rttl = rttl;
+	rr.rtype = rtype;
+	rr.rclass = rclass;
+	rr.rdlength = rdlength;
+	memcpy(rr.rdata, rdata, rdlength);
+	records.push_back(rr);
+}
+
+void dns_answer_set::add_cname(const char* rname, uint16_t rclass, uint32_t rttl, const char* target)
+{
+	size_t targetlen = strlen(target);
+	if (targetlen > 0 && target[targetlen - 1] == '.') // remove last dot
+		targetlen--;
+	uint32_t targetoff = intern(target, targetlen); // data holds offset of target name
+
+	add(rname, DNSTYPE_CNAME, rclass, rttl, (const uint8_t*)&targetoff, sizeof(uint32_t));
+}
 
-	std::vector<dns_res_record>::const_iterator it;
-	for (it = answers.begin(); it != answers.end(); it++)
+void dns_answer_set::split(std::map<std::string, dns_answer_set>& groups) const
+{
+	std::vector<dns_packed_rr>::const_iterator it;
+	for (it = records.begin(); it != records.end(); it++)
+		groups[cache_key(names.c_str() + it->nameoff, it->rtype)].copy_record(*this, *it);
+
+	std::map<std::string, dns_answer_set>::iterator git;
+	for (git = groups.begin(); git != groups.end(); git++)
+		git->second.shrink();
+}
+
+void dns_answer_set::render(std::string& out, uint32_t age) const
+{
+	char numbuf[16];
+	char addrbuf[INET6_ADDRSTRLEN];
+	std::vector<dns_packed_rr>::const_iterator it;
+	for (it = records.begin(); it != records.end(); it++)
 	{
-		ss << "Answer:" << std::endl
-		   << "Name: " << remove_last_dot(it->rname) << std::endl
-		   << "Type: " << addr_type_to_str(it->rtype) << std::endl
-		   << "Class: " << addr_class_to_str(it->rclass) << std::endl
-		   << "TTL: " << it->rttl << " seconds" << std::endl
-		   << "Data: " << ipv4_addr_to_str(it->rdata) << std::endl << std::endl;
+		out += "Answer:\nName: ";
+		out += names.c_str() + it->nameoff;
+		out += "\nType: ";
+		out += addr_type_to_str(it->rtype);
+		out += "\nClass: ";
+		out += addr_class_to_str(it->rclass);
+		out += "\nTTL: ";
+		snprintf(numbuf, sizeof(numbuf), "%" PRIu32, it->rttl > age ? it->rttl - age : 0);
+		out += numbuf;
+		out += " seconds\nData: ";
+		if (it->rtype == DNSTYPE_CNAME)
+		{
+			uint32_t targetoff;
+			memcpy(&targetoff, it->rdata, sizeof(uint32_t));
+			out += names.c_str() + targetoff;
+		}
+		else if (inet_ntop(it->rtype == DNSTYPE_AAAA ? AF_INET6 : AF_INET, it->rdata, addrbuf, sizeof(addrbuf)) != NULL)
+			out += addrbuf;
+		out += "\n\n";
 	}
+}
 
-	return ss.str();
+std::string dns_answer_set::cname_target() const
+{
+	std::vector<dns_packed_rr>::const_iterator it;
+	for (it = records.begin(); it != records.end(); it++)
+	{
+		if (it->rtype == DNSTYPE_CNAME)
+		{
+			uint32_t targetoff;
+			memcpy(&targetoff, it->rdata, sizeof(uint32_t));
+			return std::string(names.c_str() + targetoff);
+		}
+	}
+	return "";
 }
 
-/*
- * Convert data to IPv4 address string
- */
-std::string ipv4_addr_to_str(std::vector<uint8_t> addrdata)
+uint32_t dns_answer_set::min_ttl() const
 {
-	std::stringstream ss;
-	ss << (unsigned short)addrdata[0] << "." << (unsigned short)addrdata[1] << "."
-	   << (unsigned short)addrdata[2] << "." << (unsigned short)addrdata[3];
-	return ss.str();
+	uint32_t minttl = 0;
+	std::vector<dns_packed_rr>::const_iterator it;
+	for (it = records.begin(); it != records.end(); it++)
+	{
+		if (it == records.begin() || it->rttl < minttl)
+			minttl = it->rttl;
+	}
+	return minttl;
 }
 
-/*
- * Remove last dot from a string
- */
-std::string remove_last_dot(std::string str)
+void dns_answer_set::shrink()
 {
-	if (str.length() > 0)
+	std::vector<dns_packed_rr>(records).swap(records);
+	std::string(names).swap(names);
+}
+
+size_t dns_answer_set::size() const
+{
+	return records.size();
+}
+
+size_t dns_answer_set::footprint() const
+{
+	return sizeof(*this) + records.capacity() * sizeof(dns_packed_rr) + names.capacity();
+}
+
+uint32_t dns_answer_set::intern(const char* name, size_t len)
+{
+	/* answer sets are small and owner names repeat, so a linear scan of the table is enough */
+	size_t off = 0;
+	while (off < names.length())
+	{
+		size_t curlen = strlen(names.c_str() + off);
+		if (curlen == len && names.compare(off, len, name, len) == 0)
+			return (uint32_t)off;
+		off += curlen + 1;
+	}
+	names.append(name, len);
+	names.push_back('\0');
+	return (uint32_t)off;
+}
+
+void dns_answer_set::copy_record(const dns_answer_set& source, const dns_packed_rr& rr)
+{
+	const char* rname = source.names.c_str() + rr.nameoff;
+	if (rr.rtype == DNSTYPE_CNAME)
 	{
-		std::string::iterator it = str.end() - 1;
-		if (*it == '.') // remove last dot
-			str.erase(it);
+		uint32_t targetoff;
+		memcpy(&targetoff, rr.rdata, sizeof(uint32_t));
+		add_cname(rname, rr.rclass, rr.rttl, source.names.c_str() + targetoff);
 	}
-	return str;
+	else
+		add(rname, rr.rtype, rr.rclass, rr.rttl, rr.rdata, rr.rdlength);
 }
 
 /*
  * Convert type to string
  */
-std::string addr_type_to_str(uint16_t addrtype)
+const char* addr_type_to_str(uint16_t addrtype)
 {
 	switch (addrtype)
 	{
-	case 1:
+	case DNSTYPE_A:
 		return "A";
+	case DNSTYPE_CNAME:
+		return "CNAME";
+	case DNSTYPE_AAAA:
+		return "AAAA";
 	default:
 		return "UNSUPPORTED";
 	}
@@ -603,7 +986,7 @@ std::string addr_type_to_str(uint16_t addrtype)
 /*
  * Convert class to string
  */
-std::string addr_class_to_str(uint16_t addrclass)
+const char* addr_class_to_str(uint16_t addrclass)
 {
 	switch (addrclass)
 	{
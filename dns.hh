@@ -5,13 +5,18 @@
 
 #include <string>
 
-#define SQUERYTYPE "A" // supported DNS query type
+#include "networking.hh"
+
+#define SQUERYTYPE "A" // default DNS query type (A and AAAA supported)
+#define DNSPORT "53" // well-known DNS port number
 
 /* DNS query status */
 typedef enum
 {
 	SUCCESS,
-	FAIL
+	FAIL,
+	TIMEOUT, // request deadline exceeded
+	CANCELLED // client of the request disconnected
 } dns_query_status;
 
 /* DNS query response */
@@ -23,13 +28,17 @@ struct dns_query_response
 };
 
 /*
- * Perform a DNS query
+ * Perform a DNS query, following CNAME chains and using cached links
  *
  * dnsservip: IP of DNS server to use
+ * dnsport: port of DNS server
  * queryname: name to be queried
  * querytype: query type
+ * dl: deadline of the request
+ * watchfd: client connection watched for hangup while waiting, -1 for none
  * return: DNS query response structure
  */
-dns_query_response do_dns_query(std::string dnsservip, std::string queryname, std::string querytype);
+dns_query_response do_dns_query(std::string dnsservip, std::string dnsport, std::string queryname, std::string querytype,
+								const deadline& dl, int watchfd);
 
 #endif
@@ -0,0 +1,129 @@
+/* Resolver path benchmark: closed-loop DNS queries through the HTTP server */
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+
+#include "dns.hh"
+#include "general.hh"
+#include "http.hh"
+#include "loadgen.hh"
+#include "networking.hh"
+
+/* benchmark parameters, shared read-only by load generator threads */
+struct dnsbench_ctx
+{
+	std::string hostname;
+	std::string port;
+	std::string username;
+	std::string querytype;
+	unsigned long names; // number of distinct names queried
+	const http_conf* conf;
+};
+
+bool dns_request(void* ctx, unsigned long seq, int& keptfd);
+
+/*
+ * Main function
+ */
+int main(int argc, char *argv[])
+{
+	dnsbench_ctx ctx;
+	ctx.port = "";
+	ctx.username = "dnsbench";
+	ctx.querytype = SQUERYTYPE;
+	ctx.names = 1000;
+	unsigned int concurrency = 8;
+	unsigned long requests = 0;
+	unsigned long durationms = 10000;
+	int opt;
+	while ((opt = getopt(argc, argv, "h:p:c:n:T:k:t:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'h':
+			ctx.hostname = std::string(optarg);
+			break;
+		case 'p':
+			ctx.port = std::string(optarg);
+			break;
+		case 'c':
+			concurrency = (unsigned int)std::strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			requests = std::strtoul(optarg, NULL, 0);
+			break;
+		case 'T':
+			durationms = std::strtoul(optarg, NULL, 0);
+			break;
+		case 'k':
+			ctx.names = std::strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			ctx.querytype = to_upper(std::string(optarg));
+			break;
+		default:
+			break;
+		}
+	}
+	if (ctx.hostname.empty() || ctx.port.empty() || concurrency == 0 || ctx.names == 0)
+	{
+		std::cerr << "usage: ./dnsbench -h hostname -p port [-c concurrency] [-n requests | -T durationms] "
+				  << "[-k distinctnames] [-t querytype]" << std::endl;
+		return -1;
+	}
+
+	const http_conf conf("", "");
+	ctx.conf = &conf;
+
+	printf("dnsbench: %u connections, %lu distinct names, type %s, ", concurrency, ctx.names, ctx.querytype.c_str());
+	if (requests > 0)
+		printf("%lu requests\n", requests);
+	else
+		printf("%lu ms\n", durationms);
+
+	/* request and response tracing would dominate the measurement */
+	std::streambuf* coutbuf = std::cout.rdbuf(NULL);
+	load_result result = run_load(concurrency, requests, durationms, dns_request, &ctx);
+	std::cout.rdbuf(coutbuf);
+	std::cout.clear();
+
+	print_load_result(result);
+	return 0;
+}
+
+/*
+ * One DNS query request over a new connection (connection setup is part of what is measured)
+ */
+bool dns_request(void* ctx, unsigned long seq, int&)
+{
+	dnsbench_ctx* bench = (dnsbench_ctx*)ctx;
+
+	std::stringstream namess;
+	namess << "name" << seq % bench->names << ".bench.test";
+
+	int sockfd;
+	if ((sockfd = tcp_connect(bench->hostname, bench->port)) < 0)
+		return false;
+
+	bool ok = false;
+	try
+	{
+		http_request req = http_request::form_header(*bench->conf, "POST", "", "", bench->hostname, bench->username,
+													 namess.str(), bench->querytype);
+		if (req.send(sockfd, "", deadline::none()))
+		{
+			http_response resp = http_response::receive(*bench->conf, sockfd, req.method, "", "", deadline::none());
+			ok = resp.status == http_status::OK_200;
+		}
+	}
+	catch (const general_exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+	}
+
+	close(sockfd);
+	return ok;
+}
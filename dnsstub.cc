@@ -0,0 +1,313 @@
+/* Local authoritative DNS stand-in for benchmarking the resolver path */
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <netinet/in.h>
+#include <poll.h>
+#include <queue>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#define UDPBUFSIZE 2048 // maximum datagram size sent and received
+#define DNSHEADERLEN 12
+
+/* stand-in behaviour, set from command line */
+struct stub_opts
+{
+	unsigned short port;
+	unsigned long latencyms; // delay before each reply
+	unsigned long jitterms; // random extra delay up to this
+	uint32_t ttl; // TTL of answer records
+	unsigned int answers; // number of answer records per reply
+	unsigned int failpct; // percentage of queries answered with SERVFAIL
+	unsigned int droppct; // percentage of queries left unanswered
+};
+
+/* reply waiting for its send time */
+struct pending_reply
+{
+	struct timespec due;
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	std::vector<uint8_t> msg;
+};
+
+/* orders pending replies so that the earliest due is on top */
+struct later_due
+{
+	bool operator()(const pending_reply& a, const pending_reply& b) const
+	{
+		return a.due.tv_sec > b.due.tv_sec || (a.due.tv_sec == b.due.tv_sec && a.due.tv_nsec > b.due.tv_nsec);
+	}
+};
+
+volatile sig_atomic_t stopping = 0;
+
+int get_stub_opts(int argc, char** argv, stub_opts& opts);
+bool form_reply(const stub_opts& opts, const uint8_t* query, size_t querylen, std::vector<uint8_t>& reply, bool servfail);
+void put_uint16(std::vector<uint8_t>& msg, uint16_t value);
+int ms_until(const struct timespec& due);
+void on_signal(int signo);
+
+/*
+ * Main function
+ */
+int main(int argc, char *argv[])
+{
+	stub_opts opts;
+	if (get_stub_opts(argc, argv, opts) < 0)
+		return -1;
+
+	int sockfd;
+	if ((sockfd = socket(AF_INET6, SOCK_DGRAM, 0)) < 0)
+	{
+		perror("socket");
+		return -1;
+	}
+	struct sockaddr_in6 servaddr;
+	memset(&servaddr, 0, sizeof(servaddr));
+	servaddr.sin6_family = AF_INET6;
+	servaddr.sin6_addr = in6addr_any; // any interface, IPv4 clients as mapped addresses
+	servaddr.sin6_port = htons(opts.port);
+	if (bind(sockfd, (struct sockaddr*)&servaddr, sizeof(servaddr)) < 0)
+	{
+		perror("bind");
+		return -1;
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	srand(time(NULL));
+
+	std::cout << "dnsstub listening on port " << opts.port << " (latency " << opts.latencyms << "+" << opts.jitterms
+			  << " ms, ttl " << opts.ttl << ", " << opts.answers << " answers, " << opts.failpct << "% servfail, "
+			  << opts.droppct << "% dropped)" << std::endl;
+
+	std::priority_queue<pending_reply, std::vector<pending_reply>, later_due> pending;
+	unsigned long queries = 0, answered = 0, failed = 0, dropped = 0;
+	while (!stopping)
+	{
+		/* send replies that are due */
+		while (!pending.empty() && ms_until(pending.top().due) == 0)
+		{
+			const pending_reply& reply = pending.top();
+			if (sendto(sockfd, &reply.msg[0], reply.msg.size(), 0, (const struct sockaddr*)&reply.addr, reply.addrlen) < 0)
+				perror("sendto");
+			pending.pop();
+		}
+
+		/* wait for next query or next due reply */
+		struct pollfd pfd;
+		pfd.fd = sockfd;
+		pfd.events = POLLIN;
+		int timeout = pending.empty() ? -1 : ms_until(pending.top().due);
+		int ready = poll(&pfd, 1, timeout);
+		if (ready < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+		if (ready == 0)
+			continue;
+
+		pending_reply reply;
+		uint8_t query[UDPBUFSIZE];
+		reply.addrlen = sizeof(reply.addr);
+		ssize_t recvd;
+		if ((recvd = recvfrom(sockfd, query, UDPBUFSIZE, 0, (struct sockaddr*)&reply.addr, &reply.addrlen)) < 0)
+		{
+			perror("recvfrom");
+			continue;
+		}
+		queries++;
+
+		unsigned int roll = rand() % 100;
+		if (roll < opts.droppct)
+		{
+			dropped++;
+			continue;
+		}
+		bool servfail = roll < opts.droppct + opts.failpct;
+		if (!form_reply(opts, query, recvd, reply.msg, servfail))
+			continue; // malformed query, ignore
+		if (servfail)
+			failed++;
+		else
+			answered++;
+
+		unsigned long delayms = opts.latencyms + (opts.jitterms > 0 ? rand() % (opts.jitterms + 1) : 0);
+		clock_gettime(CLOCK_MONOTONIC, &reply.due);
+		reply.due.tv_sec += delayms / 1000;
+		reply.due.tv_nsec += (delayms % 1000) * 1000000;
+		if (reply.due.tv_nsec >= 1000000000)
+		{
+			reply.due.tv_sec++;
+			reply.due.tv_nsec -= 1000000000;
+		}
+		pending.push(reply);
+	}
+
+	std::cout << "queries: " << queries << ", answered: " << answered << ", servfail: " << failed
+			  << ", dropped: " << dropped << std::endl;
+	close(sockfd);
+	return 0;
+}
+
+/*
+ * Get command line options
+ */
+int get_stub_opts(int argc, char** argv, stub_opts& opts)
+{
+	opts.port = 0;
+	opts.latencyms = 0;
+	opts.jitterms = 0;
+	opts.ttl = 300;
+	opts.answers = 1;
+	opts.failpct = 0;
+	opts.droppct = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "p:l:j:t:n:f:x:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'p':
+			opts.port = (unsigned short)std::strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			opts.latencyms = std::strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			opts.jitterms = std::strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			opts.ttl = (uint32_t)std::strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			opts.answers = (unsigned int)std::strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			opts.failpct = (unsigned int)std::strtoul(optarg, NULL, 0);
+			break;
+		case 'x':
+			opts.droppct = (unsigned int)std::strtoul(optarg, NULL, 0);
+			break;
+		default:
+			break;
+		}
+	}
+	if (opts.port == 0 || opts.answers > 100 || opts.failpct + opts.droppct > 100)
+	{
+		std::cerr << "usage: ./dnsstub -p port [-l latencyms] [-j jitterms] [-t ttl] [-n answers] [-f servfailpct] [-x droppct]"
+				  << std::endl;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Form reply to a query: question copied from query, answers generated from the name
+ */
+bool form_reply(const stub_opts& opts, const uint8_t* query, size_t querylen, std::vector<uint8_t>& reply, bool servfail)
+{
+	if (querylen < DNSHEADERLEN || query[4] != 0 || query[5] != 1)
+		return false; // exactly one question supported
+
+	/* find end of question, hash the name for generated addresses */
+	size_t idx = DNSHEADERLEN;
+	uint32_t namehash = 2166136261u;
+	while (idx < querylen && query[idx] != 0)
+	{
+		if ((query[idx] & 0xc0) != 0 || idx + 1 + query[idx] > querylen)
+			return false;
+		size_t labelend = idx + 1 + query[idx];
+		for (idx++; idx < labelend; idx++)
+			namehash = (namehash ^ tolower(query[idx])) * 16777619u;
+	}
+	if (idx + 5 > querylen)
+		return false;
+	size_t questionend = idx + 5; // terminating zero, type and class
+	uint16_t qtype = (query[idx + 1] << 8) | query[idx + 2];
+
+	unsigned int ancount = 0;
+	if (!servfail && (qtype == 1 || qtype == 28))
+		ancount = opts.answers;
+
+	/* header: same id, response with authoritative answer, recursion desired copied */
+	reply.assign(query, query + 2);
+	reply.push_back(0x84 | (query[2] & 0x79)); // qr, opcode, aa, rd
+	reply.push_back(0x80 | (servfail ? 2 : 0)); // ra, rcode
+	put_uint16(reply, 1);
+	put_uint16(reply, ancount);
+	put_uint16(reply, 0);
+	put_uint16(reply, 0);
+	reply.insert(reply.end(), query + DNSHEADERLEN, query + questionend);
+
+	unsigned int ai;
+	for (ai = 0; ai < ancount; ai++)
+	{
+		put_uint16(reply, 0xc000 | DNSHEADERLEN); // pointer to name in question
+		put_uint16(reply, qtype);
+		put_uint16(reply, 1); // class IN
+		put_uint16(reply, opts.ttl >> 16);
+		put_uint16(reply, opts.ttl & 0xffff);
+		if (qtype == 1)
+		{
+			put_uint16(reply, 4);
+			reply.push_back(10);
+			reply.push_back((namehash >> 16) & 0xff);
+			reply.push_back((namehash >> 8) & 0xff);
+			reply.push_back(ai + 1);
+		}
+		else
+		{
+			put_uint16(reply, 16);
+			put_uint16(reply, 0xfd00);
+			int word;
+			for (word = 0; word < 4; word++)
+				put_uint16(reply, 0);
+			put_uint16(reply, namehash >> 16);
+			put_uint16(reply, namehash & 0xffff);
+			put_uint16(reply, ai + 1);
+		}
+	}
+	return true;
+}
+
+/*
+ * Append 16-bit value in network byte order
+ */
+void put_uint16(std::vector<uint8_t>& msg, uint16_t value)
+{
+	msg.push_back(value >> 8);
+	msg.push_back(value & 0xff);
+}
+
+/*
+ * Milliseconds until given monotonic time, 0 if passed
+ */
+int ms_until(const struct timespec& due)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long long remaining = (long long)(due.tv_sec - now.tv_sec) * 1000 + (due.tv_nsec - now.tv_nsec + 999999) / 1000000;
+	return remaining > 0 ? (int)remaining : 0;
+}
+
+/*
+ * Stop main loop on termination signals
+ */
+void on_signal(int signo)
+{
+	(void)signo;
+	stopping = 1;
+}
@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <iostream>
+#include <pthread.h>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "durable.hh"
+#include "stats.hh"
+
+#define GROUPWINDOWUS 2000 // time a group leader waits for other uploads to join before syncing
+
+/* directory waiting for group commit */
+struct pending_commit
+{
+	std::string dir;
+	bool* synced; // result for the committing thread
+};
+
+sync_policy policy = sync_policy::SYNC_NONE;
+std::atomic<unsigned long> tempseq(0); // makes temporary names unique within the process
+std::atomic<int> uploads(0); // temporary files being written, i.e. possible members of a later group
+std::atomic<int> unsynced(0); // files renamed into place whose directories are not synced yet, i.e. members of next group
+
+/* group commit state, access protected by groupmutex */
+std::vector<pending_commit> groupmembers; // directories of files joined to the group being filled
+unsigned long fillinggroup = 1; // number of group being filled
+unsigned long syncedgroup = 0; // number of last group synced
+bool leading = false; // a thread is collecting or syncing a group
+pthread_mutex_t groupmutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t groupcond = PTHREAD_COND_INITIALIZER;
+
+std::string temp_path(const std::string& path);
+std::string dir_of(const std::string& path);
+bool sync_file(int fd);
+bool sync_dir(const std::string& dir);
+bool group_commit(const std::string& dir);
+void commit_members(const std::vector<pending_commit>& members);
+
+void durable_set_policy(sync_policy newpolicy)
+{
+	policy = newpolicy;
+}
+
+int durable_create(const std::string& path, std::string& temppath)
+{
+	temppath = temp_path(path);
+	int fd;
+	if ((fd = open(temppath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666)) < 0)
+	{
+		perror("open");
+		return -1;
+	}
+	struct stat st;
+	if (stat(path.c_str(), &st) == 0 && fchmod(fd, st.st_mode & 07777) < 0)
+		perror("fchmod");
+	uploads++;
+	return fd;
+}
+
+bool durable_flush(int fd)
+{
+	/* each upload flushes its own data, so flushes of concurrent uploads run in parallel */
+	return policy == sync_policy::SYNC_NONE || sync_file(fd);
+}
+
+bool durable_commit(int fd, const std::string& temppath, const std::string& path)
+{
+	uploads--; // no longer a possible member of a later group
+	bool ok = rename(temppath.c_str(), path.c_str()) == 0;
+	if (ok)
+		unsynced++;
+	else
+	{
+		perror("rename");
+		if (unlink(temppath.c_str()) < 0)
+			perror("unlink");
+	}
+	if (close(fd) < 0)
+	{
+		perror("close");
+		ok = false;
+	}
+	return ok;
+}
+
+void durable_abort(int fd, const std::string& temppath)
+{
+	uploads--;
+	if (close(fd) < 0)
+		perror("close");
+	if (unlink(temppath.c_str()) < 0)
+		perror("unlink");
+}
+
+bool durable_link(const std::string& existing, const std::string& path)
+{
+	std::string temppath = temp_path(path);
+	if (link(existing.c_str(), temppath.c_str()) < 0)
+	{
+		perror("link");
+		return false;
+	}
+	if (rename(temppath.c_str(), path.c_str()) < 0)
+	{
+		perror("rename");
+		if (unlink(temppath.c_str()) < 0)
+			perror("unlink");
+		return false;
+	}
+	unsynced++;
+	return true;
+}
+
+bool durable_sync_name(const std::string& path)
+{
+	sync_policy now = policy;
+	if (now == sync_policy::SYNC_GROUP)
+		return group_commit(dir_of(path));
+	unsynced--;
+	return now == sync_policy::SYNC_NONE || sync_dir(dir_of(path));
+}
+
+/*
+ * Hidden name for a temporary file in the same directory as a file, so that rename stays within the file system
+ */
+std::string temp_path(const std::string& path)
+{
+	size_t slash = path.rfind('/');
+	std::stringstream tempss;
+	tempss << path.substr(0, slash + 1) << "." << path.substr(slash + 1) << ".put." << getpid() << "." << tempseq++;
+	return tempss.str();
+}
+
+/*
+ * Directory holding a file
+ */
+std::string dir_of(const std::string& path)
+{
+	size_t slash = path.rfind('/');
+	return slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+}
+
+/*
+ * Flush data of a file to disk
+ */
+bool sync_file(int fd)
+{
+	stat_add(SYNC_CALLS, 1);
+	stat_add(SYNC_FILES, 1);
+	if (fdatasync(fd) < 0)
+	{
+		perror("fdatasync");
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Flush directory to disk, making renames into it durable
+ */
+bool sync_dir(const std::string& dir)
+{
+	int dirfd;
+	if ((dirfd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+	{
+		perror("open");
+		return false;
+	}
+	stat_add(SYNC_CALLS, 1);
+	bool ok = fsync(dirfd) == 0;
+	if (!ok)
+		perror("fsync");
+	if (close(dirfd) < 0)
+		perror("close");
+	return ok;
+}
+
+/*
+ * Join directory of a file renamed into it to a group commit and wait until the group is committed
+ * First thread to find no leader leads: it lets other uploads in progress join for a moment,
+ * then syncs the directories of the whole group while files arriving meanwhile form the next one
+ */
+bool group_commit(const std::string& dir)
+{
+	pending_commit member;
+	bool synced = false;
+	member.dir = dir;
+	member.synced = &synced;
+
+	if ((errno = pthread_mutex_lock(&groupmutex)) != 0)
+	{
+		perror("pthread_mutex_lock");
+		return false;
+	}
+	unsigned long mygroup = fillinggroup;
+	groupmembers.push_back(member);
+	unsynced--;
+	while (syncedgroup < mygroup)
+	{
+		if (leading)
+		{
+			if ((errno = pthread_cond_wait(&groupcond, &groupmutex)) != 0)
+				perror("pthread_cond_wait");
+			continue;
+		}
+
+		/* lead, waiting only if someone could still join */
+		leading = true;
+		if ((errno = pthread_mutex_unlock(&groupmutex)) != 0)
+			perror("pthread_mutex_unlock");
+		if (uploads > 0 || unsynced > 0)
+			usleep(GROUPWINDOWUS);
+		if ((errno = pthread_mutex_lock(&groupmutex)) != 0)
+			perror("pthread_mutex_lock");
+		std::vector<pending_commit> members;
+		members.swap(groupmembers);
+		unsigned long group = fillinggroup++;
+		if ((errno = pthread_mutex_unlock(&groupmutex)) != 0)
+			perror("pthread_mutex_unlock");
+
+		commit_members(members);
+
+		if ((errno = pthread_mutex_lock(&groupmutex)) != 0)
+			perror("pthread_mutex_lock");
+		syncedgroup = group;
+		leading = false;
+		if ((errno = pthread_cond_broadcast(&groupcond)) != 0)
+			perror("pthread_cond_broadcast");
+	}
+	if ((errno = pthread_mutex_unlock(&groupmutex)) != 0)
+		perror("pthread_mutex_unlock");
+	return synced;
+}
+
+/*
+ * Commit files of a group, each flushed by its uploader and renamed already: each directory renamed into
+ * is flushed once
+ */
+void commit_members(const std::vector<pending_commit>& members)
+{
+	std::vector<std::string> dirs;
+	std::vector<pending_commit>::const_iterator it;
+	for (it = members.begin(); it != members.end(); it++)
+	{
+		if (std::find(dirs.begin(), dirs.end(), it->dir) == dirs.end())
+			dirs.push_back(it->dir);
+	}
+
+	std::vector<std::string> faileddirs;
+	std::vector<std::string>::const_iterator dirit;
+	for (dirit = dirs.begin(); dirit != dirs.end(); dirit++)
+	{
+		if (!sync_dir(*dirit))
+			faileddirs.push_back(*dirit);
+	}
+	for (it = members.begin(); it != members.end(); it++)
+		*it->synced = std::find(faileddirs.begin(), faileddirs.end(), it->dir) == faileddirs.end();
+	std::cout << "group commit of " << members.size() << " files into " << dirs.size() << " directories" << std::endl;
+}
@@ -0,0 +1,74 @@
+/* Atomic and durable replacement of files written by PUT */
+
+#ifndef NETPROG_DURABLE_HH
+#define NETPROG_DURABLE_HH
+
+#include <string>
+
+#include "general.hh"
+
+/*
+ * Set how committed files are made durable, called before serving
+ *
+ * policy: none (default), fsync per file, or group commit
+ */
+void durable_set_policy(sync_policy policy);
+
+/*
+ * Create temporary file next to a file, written in place of it and then committed or aborted
+ * An existing file keeps its permissions
+ *
+ * path: path to file to replace
+ * temppath: path to temporary file
+ * return: file descriptor opened for writing, -1 on error
+ */
+int durable_create(const std::string& path, std::string& temppath);
+
+/*
+ * Flush data of a completely written temporary file according to policy, before its commit
+ * so that no lock of the path has to be held while waiting for the disk
+ *
+ * fd: file descriptor from durable_create
+ * return: true on success, false on failure
+ */
+bool durable_flush(int fd);
+
+/*
+ * Replace file with a completely written and flushed temporary file, so that readers see either the old
+ * or the new contents, its name made durable by durable_sync_name afterwards
+ *
+ * fd: file descriptor from durable_create, closed
+ * temppath: path to temporary file
+ * path: path to file to replace
+ * return: true on success, false on failure (temporary file removed)
+ */
+bool durable_commit(int fd, const std::string& temppath, const std::string& path);
+
+/*
+ * Replace file with a hard link to an existing file, e.g. stored content with the same digest, its name
+ * made durable by durable_sync_name afterwards
+ *
+ * existing: path to file to link
+ * path: path to file to replace
+ * return: true on success, false on failure
+ */
+bool durable_link(const std::string& existing, const std::string& path);
+
+/*
+ * Make name of a committed file durable according to policy by syncing its directory, once per group
+ * of files committed at the same time with group commit
+ *
+ * path: path to file replaced by durable_commit or durable_link
+ * return: true on success, false on failure
+ */
+bool durable_sync_name(const std::string& path);
+
+/*
+ * Drop a temporary file, leaving file as it was
+ *
+ * fd: file descriptor from durable_create, closed
+ * temppath: path to temporary file
+ */
+void durable_abort(int fd, const std::string& temppath);
+
+#endif
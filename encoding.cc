@@ -0,0 +1,371 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <dirent.h>
+#include <fcntl.h>
+#include <iostream>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_set>
+#include <vector>
+#include <zlib.h>
+
+#include "encoding.hh"
+#include "general.hh"
+#include "networking.hh"
+#include "stats.hh"
+
+#define COMPRESSMIN 256 // smaller files are sent as is
+#define COMPRESSMAX 67108864 // larger files are sent as is, compressing one would hold up other variants too long
+#define BUILDQUEUEMAX 64 // variants waiting to be built, files of further GETs are sent as is without queueing
+#define ZBUFSIZE 65536 // chunk size of compression
+#define GZIPWINDOW (15 + 16) // zlib window bits selecting gzip format
+
+/* variant waiting for the builder thread */
+struct variant_job
+{
+	std::string dir;
+	std::string base;
+	std::string variantpath;
+	cached_file_ptr file; // keeps the version the variant is made of open
+	content_coding coding;
+};
+
+std::deque<variant_job> buildqueue; // access protected by buildmutex
+std::unordered_set<std::string> building; // paths of variants queued or being built, access protected by buildmutex
+pthread_mutex_t buildmutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t buildcondv = PTHREAD_COND_INITIALIZER; // condition of interest: jobs queued
+
+void queue_variant(const std::string& dir, const std::string& base, const std::string& variantpath,
+				   const cached_file_ptr& file, content_coding coding);
+std::string coding_suffix(content_coding coding);
+std::string trim(const std::string& str);
+bool create_variant(const std::string& dir, const std::string& base, const std::string& variantpath,
+					const cached_file_ptr& file, content_coding coding);
+bool compress_to(int srcfd, size_t size, int dstfd, content_coding coding, size_t& outsize);
+void remove_variants(const std::string& dir, const std::string& base, const std::string& keeptag);
+bool is_variant_name(const std::string& name, const std::string& base);
+
+content_coding negotiate_coding(const std::string& acceptencoding)
+{
+	double gzipq = -1, deflateq = -1, anyq = -1; // -1 if not listed
+	std::vector<std::string> codings = split_string(acceptencoding, ',');
+	std::vector<std::string>::const_iterator it;
+	for (it = codings.begin(); it != codings.end(); it++)
+	{
+		std::vector<std::string> params = split_string(*it, ';');
+		if (params.empty())
+			continue;
+		std::string name = to_upper(trim(params[0]));
+		double q = 1;
+		std::vector<std::string>::const_iterator pit;
+		for (pit = params.begin() + 1; pit != params.end(); pit++)
+		{
+			std::string param = trim(*pit);
+			if (param.compare(0, 2, "q=") == 0 || param.compare(0, 2, "Q=") == 0)
+				q = std::strtod(param.c_str() + 2, NULL);
+		}
+		if (name == "GZIP" || name == "X-GZIP")
+			gzipq = q;
+		else if (name == "DEFLATE")
+			deflateq = q;
+		else if (name == "*")
+			anyq = q;
+	}
+	if (gzipq < 0)
+		gzipq = anyq;
+	if (deflateq < 0)
+		deflateq = anyq;
+
+	if (gzipq > 0 && gzipq >= deflateq)
+		return content_coding::CODING_GZIP;
+	if (deflateq > 0)
+		return content_coding::CODING_DEFLATE;
+	return content_coding::CODING_IDENTITY;
+}
+
+std::string coding_name(content_coding coding)
+{
+	switch (coding)
+	{
+	case content_coding::CODING_GZIP:
+		return "gzip";
+	case content_coding::CODING_DEFLATE:
+		return "deflate";
+	default:
+		return "";
+	}
+}
+
+content_coding to_coding(const std::string& name)
+{
+	std::string upper = to_upper(name);
+	if (upper == "GZIP" || upper == "X-GZIP")
+		return content_coding::CODING_GZIP;
+	if (upper == "DEFLATE")
+		return content_coding::CODING_DEFLATE;
+	return content_coding::CODING_IDENTITY;
+}
+
+bool open_encoded_variant(const std::string& variantdir, const std::string& uri, const cached_file_ptr& file,
+						  const std::string& tag, content_coding coding, cached_file_ptr& variant, cached_content_ptr& content)
+{
+	if (coding == content_coding::CODING_IDENTITY || file->st.st_size < COMPRESSMIN || file->st.st_size > COMPRESSMAX)
+		return false;
+
+	size_t slash = uri.rfind('/');
+	std::string dir = variantdir + uri.substr(0, slash);
+	std::string base = uri.substr(slash + 1);
+	std::string variantpath = dir + "/" + base + "." + tag + coding_suffix(coding);
+
+	/* compressed in the background on first use, file is sent as is until variant is ready */
+	file_status status = filecache_open(variantpath, variant, content);
+	if (status == file_status::DOES_NOT_EXIST)
+	{
+		queue_variant(dir, base, variantpath, file, coding);
+		stat_add(COMPRESS_DEFERRED, 1);
+		return false;
+	}
+	if (status != file_status::OK)
+		return false;
+	return variant->st.st_size < file->st.st_size; // incompressible file is kept but not used
+}
+
+void remove_encoded_variants(const std::string& variantdir, const std::string& uri)
+{
+	size_t slash = uri.rfind('/');
+	remove_variants(variantdir + uri.substr(0, slash), uri.substr(slash + 1), "");
+}
+
+void* variant_builder(void* arg)
+{
+	while (1)
+	{
+		if ((errno = pthread_mutex_lock(&buildmutex)) != 0)
+		{
+			perror("pthread_mutex_lock");
+			return arg;
+		}
+		while (buildqueue.empty())
+		{
+			if ((errno = pthread_cond_wait(&buildcondv, &buildmutex)) != 0)
+			{
+				perror("pthread_cond_wait");
+				return arg;
+			}
+		}
+		variant_job job = buildqueue.front();
+		buildqueue.pop_front();
+		if ((errno = pthread_mutex_unlock(&buildmutex)) != 0)
+			perror("pthread_mutex_unlock");
+
+		/* no lock of the path is held, a file replaced meanwhile keeps the variant of its old tag unused */
+		create_variant(job.dir, job.base, job.variantpath, job.file, job.coding);
+
+		/* variant is in place before it is forgotten, so that it is never built twice */
+		if ((errno = pthread_mutex_lock(&buildmutex)) != 0)
+		{
+			perror("pthread_mutex_lock");
+			return arg;
+		}
+		building.erase(job.variantpath);
+		if ((errno = pthread_mutex_unlock(&buildmutex)) != 0)
+			perror("pthread_mutex_unlock");
+	}
+	return arg;
+}
+
+/*
+ * Queue variant for the builder thread unless it is queued or being built already, or the queue is full
+ */
+void queue_variant(const std::string& dir, const std::string& base, const std::string& variantpath,
+				   const cached_file_ptr& file, content_coding coding)
+{
+	if ((errno = pthread_mutex_lock(&buildmutex)) != 0)
+	{
+		perror("pthread_mutex_lock");
+		return;
+	}
+	if (buildqueue.size() < BUILDQUEUEMAX && building.insert(variantpath).second)
+	{
+		variant_job job;
+		job.dir = dir;
+		job.base = base;
+		job.variantpath = variantpath;
+		job.file = file;
+		job.coding = coding;
+		buildqueue.push_back(job);
+		if ((errno = pthread_cond_signal(&buildcondv)) != 0)
+			perror("pthread_cond_signal");
+	}
+	if ((errno = pthread_mutex_unlock(&buildmutex)) != 0)
+		perror("pthread_mutex_unlock");
+}
+
+/*
+ * Suffix of variant files of a coding
+ */
+std::string coding_suffix(content_coding coding)
+{
+	return coding == content_coding::CODING_GZIP ? ".gz" : ".zz";
+}
+
+/*
+ * Strip surrounding whitespace
+ */
+std::string trim(const std::string& str)
+{
+	size_t first = str.find_first_not_of(" \t");
+	if (first == std::string::npos)
+		return "";
+	return str.substr(first, str.find_last_not_of(" \t") - first + 1);
+}
+
+/*
+ * Compress file into a new variant, replacing variants of older versions of file
+ */
+bool create_variant(const std::string& dir, const std::string& base, const std::string& variantpath,
+					const cached_file_ptr& file, content_coding coding)
+{
+	if (!make_dirs(dir))
+		return false;
+
+	/* write under temporary name, so that concurrent requests never see a partial variant */
+	std::string tmppath = variantpath + ".XXXXXX";
+	std::vector<char> tmpname(tmppath.begin(), tmppath.end());
+	tmpname.push_back('\0');
+	int dstfd;
+	if ((dstfd = mkstemp(&tmpname[0])) < 0)
+	{
+		perror("mkstemp");
+		return false;
+	}
+
+	struct timespec cpustart, cpuend;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpustart);
+	size_t outsize;
+	bool compressed = compress_to(file->fd, file->st.st_size, dstfd, coding, outsize);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuend);
+	if (close(dstfd) < 0)
+	{
+		perror("close");
+		compressed = false;
+	}
+	if (compressed && rename(&tmpname[0], variantpath.c_str()) < 0)
+	{
+		perror("rename");
+		compressed = false;
+	}
+	if (!compressed)
+	{
+		unlink(&tmpname[0]);
+		return false;
+	}
+
+	unsigned long cpuus = (cpuend.tv_sec - cpustart.tv_sec) * 1000000 + (cpuend.tv_nsec - cpustart.tv_nsec) / 1000;
+	stat_add(COMPRESS_FILES, 1);
+	stat_add(COMPRESS_IN_BYTES, file->st.st_size);
+	stat_add(COMPRESS_OUT_BYTES, outsize);
+	stat_add(COMPRESS_CPU_US, cpuus);
+	std::cout << "compressed " << base << " (" << coding_name(coding) << "): " << file->st.st_size << " -> " << outsize
+			  << " bytes, ratio " << (outsize > 0 ? (double)file->st.st_size / outsize : 0) << ", " << cpuus << " us CPU"
+			  << std::endl;
+
+	std::string name = variantpath.substr(dir.length() + base.length() + 2);
+	remove_variants(dir, base, name.substr(0, name.length() - coding_suffix(coding).length())); // other codings of this version stay
+	return true;
+}
+
+/*
+ * Compress size bytes of file into another file
+ */
+bool compress_to(int srcfd, size_t size, int dstfd, content_coding coding, size_t& outsize)
+{
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, coding == content_coding::CODING_GZIP ? GZIPWINDOW : MAX_WBITS,
+					 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		std::cerr << "deflateInit2 failed" << std::endl;
+		return false;
+	}
+
+	std::vector<char> in(ZBUFSIZE), out(ZBUFSIZE);
+	size_t readsofar = 0;
+	bool ok = true;
+	int flush;
+	outsize = 0;
+	do
+	{
+		ssize_t readnow = 0;
+		if (readsofar < size &&
+			(readnow = pread(srcfd, &in[0], std::min((size_t)ZBUFSIZE, size - readsofar), readsofar)) <= 0)
+		{
+			if (readnow < 0)
+				perror("pread");
+			else
+				std::cerr << "file shrank while compressing" << std::endl;
+			ok = false;
+			break;
+		}
+		readsofar += readnow;
+		flush = readsofar == size ? Z_FINISH : Z_NO_FLUSH;
+		zs.next_in = (Bytef*)&in[0];
+		zs.avail_in = readnow;
+		do
+		{
+			zs.next_out = (Bytef*)&out[0];
+			zs.avail_out = ZBUFSIZE;
+			deflate(&zs, flush);
+			size_t have = ZBUFSIZE - zs.avail_out;
+			if (!fd_sink(&dstfd, &out[0], have))
+			{
+				ok = false;
+				break;
+			}
+			outsize += have;
+		} while (zs.avail_out == 0);
+	} while (ok && flush != Z_FINISH);
+
+	deflateEnd(&zs);
+	return ok;
+}
+
+/*
+ * Remove variants of file in variant directory, except those of the version with tag keeptag (empty to remove all)
+ */
+void remove_variants(const std::string& dir, const std::string& base, const std::string& keeptag)
+{
+	DIR* dirp;
+	if ((dirp = opendir(dir.c_str())) == NULL)
+		return; // no variants
+	struct dirent* entry;
+	while ((entry = readdir(dirp)) != NULL)
+	{
+		std::string name(entry->d_name);
+		std::string keep = base + "." + keeptag + ".";
+		if ((keeptag.empty() || name.compare(0, keep.length(), keep) != 0) && is_variant_name(name, base) && unlink((dir + "/" + name).c_str()) < 0)
+			perror("unlink");
+	}
+	closedir(dirp);
+}
+
+/*
+ * Check if name is <base>.<tag><suffix>, tags being hex digits and dashes
+ */
+bool is_variant_name(const std::string& name, const std::string& base)
+{
+	if (name.length() <= base.length() + 1 || name.compare(0, base.length() + 1, base + ".") != 0)
+		return false;
+	std::string rest = name.substr(base.length() + 1);
+	size_t dot = rest.rfind('.');
+	if (dot == std::string::npos || dot == 0)
+		return false;
+	std::string suffix = rest.substr(dot);
+	return (suffix == coding_suffix(content_coding::CODING_GZIP) || suffix == coding_suffix(content_coding::CODING_DEFLATE)) &&
+		   rest.find_first_not_of("0123456789abcdef-") == dot;
+}
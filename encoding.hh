@@ -0,0 +1,82 @@
+/* Content codings (compression) of payloads */
+
+#ifndef NETPROG_ENCODING_HH
+#define NETPROG_ENCODING_HH
+
+#include <string>
+
+#include "filecache.hh"
+
+/* supported content codings */
+typedef enum
+{
+	CODING_IDENTITY,
+	CODING_GZIP,
+	CODING_DEFLATE // zlib format, as the HTTP deflate coding is defined
+} content_coding;
+
+/*
+ * Choose coding from Accept-Encoding value, gzip preferred over deflate on equal weights
+ *
+ * acceptencoding: header value, e.g. "gzip, deflate;q=0.5"
+ * return: coding to use, identity if no supported coding is acceptable
+ */
+content_coding negotiate_coding(const std::string& acceptencoding);
+
+/*
+ * Coding to name used in headers
+ *
+ * coding: coding
+ * return: name, empty for identity
+ */
+std::string coding_name(content_coding coding);
+
+/*
+ * Name used in headers to coding
+ *
+ * name: name (case-insensitive)
+ * return: coding, identity if not supported
+ */
+content_coding to_coding(const std::string& name);
+
+/*
+ * Open encoded variant of a file, queueing the file for compression by the builder thread on first use
+ * Variants are stored under the variant directory at the path of the file, with the file's validator
+ * in their names, so that a changed file never matches an old variant
+ *
+ * variantdir: directory of variants, mirroring the serving directory
+ * uri: URI of file
+ * file: open file
+ * tag: validator of file contents (without quotes)
+ * coding: coding of variant
+ * variant: open variant on success
+ * content: contents of variant if held in memory
+ * return: true if variant is available and smaller than file, false to send file as is (also while it is being built)
+ */
+bool open_encoded_variant(const std::string& variantdir, const std::string& uri, const cached_file_ptr& file,
+						  const std::string& tag, content_coding coding, cached_file_ptr& variant, cached_content_ptr& content);
+
+/*
+ * Remove encoded variants of a file, e.g. after it was rewritten
+ *
+ * variantdir: directory of variants
+ * uri: URI of file
+ */
+void remove_encoded_variants(const std::string& variantdir, const std::string& uri);
+
+/*
+ * Thread routine compressing queued variants one at a time, outside of any request
+ *
+ * arg: unused
+ */
+void* variant_builder(void* arg);
+
+/*
+ * Decode gzip or deflate coded file in place
+ *
+ * path: path to file
+ * return: true on success, false on failure (file left as is)
+ */
+bool decode_file(const std::string& path);
+
+#endif
@@ -0,0 +1,323 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <iostream>
+#include <list>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <unordered_map>
+
+#include "filecache.hh"
+#include "stats.hh"
+
+#define FILECACHEMAX 256 // maximum number of files kept open
+#define MEMFILEMAX 65536 // largest file whose contents are held in memory
+#define ADMITHITS 1 // descriptor cache hits of a file before its contents are read into memory
+#define EVENTBUFSIZE 4096 // buffer for reading inotify events
+#define WATCHMASK (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+				   IN_DELETE_SELF | IN_MOVE_SELF)
+
+/* cached file with the watch of its directory */
+struct file_cache_entry
+{
+	std::string path;
+	int wd; // inotify watch of the directory, -1 if entry is validated with stat instead
+	std::string name; // filename within the directory
+	cached_file_ptr file;
+	unsigned long hits; // lookups served from this entry
+	cached_content_ptr content; // contents if held in memory
+};
+
+/* entries in least recently used order and indexed by path, access protected by filecachemutex */
+std::list<file_cache_entry> filelru; // most recently used first
+std::unordered_map<std::string, std::list<file_cache_entry>::iterator> filecache;
+unsigned long invalidations = 0; // changes seen, a file is not cached if one happened while it was being opened
+int inotifyfd = -1; // -1 if not watching
+size_t membudget = 0; // bytes of contents that may be held in memory
+size_t memused = 0; // bytes of contents held in memory
+pthread_mutex_t filecachemutex = PTHREAD_MUTEX_INITIALIZER;
+
+bool unchanged(const std::string& path, const struct stat& st);
+void load_content(const std::string& path, const cached_file_ptr& file, cached_content_ptr& content);
+void drop_entries(const struct inotify_event* event);
+std::list<file_cache_entry>::iterator erase_entry(std::list<file_cache_entry>::iterator it);
+
+cached_file::~cached_file()
+{
+	if (close(fd) < 0)
+		perror("close");
+}
+
+int filecache_init()
+{
+	int fd;
+	if ((fd = inotify_init1(IN_CLOEXEC)) < 0)
+	{
+		perror("inotify_init1");
+		return -1;
+	}
+	if ((errno = pthread_mutex_lock(&filecachemutex)) != 0)
+	{
+		perror("pthread_mutex_lock");
+		close(fd);
+		return -1;
+	}
+	inotifyfd = fd;
+	if ((errno = pthread_mutex_unlock(&filecachemutex)) != 0)
+		perror("pthread_mutex_unlock");
+	return 0;
+}
+
+void filecache_set_memory(size_t budget)
+{
+	if ((errno = pthread_mutex_lock(&filecachemutex)) != 0)
+	{
+		perror("pthread_mutex_lock");
+		return;
+	}
+	membudget = budget;
+	if ((errno = pthread_mutex_unlock(&filecachemutex)) != 0)
+		perror("pthread_mutex_unlock");
+}
+
+void* filecache_watcher(void* arg)
+{
+	alignas(struct inotify_event) char buffer[EVENTBUFSIZE];
+	ssize_t len;
+	while ((len = read(inotifyfd, buffer, EVENTBUFSIZE)) != 0)
+	{
+		if (len < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("read");
+			break;
+		}
+		if ((errno = pthread_mutex_lock(&filecachemutex)) != 0)
+		{
+			perror("pthread_mutex_lock");
+			break;
+		}
+		const char* p;
+		const struct inotify_event* event;
+		for (p = buffer; p < buffer + len; p += sizeof(struct inotify_event) + event->len)
+		{
+			event = (const struct inotify_event*)p;
+			drop_entries(event);
+		}
+		if ((errno = pthread_mutex_unlock(&filecachemutex)) != 0)
+			perror("pthread_mutex_unlock");
+	}
+	return arg;
+}
+
+file_status filecache_open(const std::string& path, cached_file_ptr& file, cached_content_ptr& content)
+{
+	std::cout << "opening file: " << path << std::endl;
+
+	/* look up cache */
+	bool watched = false;
+	bool watching;
+	bool memory;
+	bool admit = false; // read contents into memory
+	unsigned long seen;
+	file.reset();
+	content.reset();
+	if ((errno = pthread_mutex_lock(&filecachemutex)) != 0)
+	{
+		perror("pthread_mutex_lock");
+		return file_status::ACCESS_FAILURE;
+	}
+	std::unordered_map<std::string, std::list<file_cache_entry>::iterator>::iterator it = filecache.find(path);
+	if (it != filecache.end())
+	{
+		file_cache_entry& entry = *it->second;
+		file = entry.file;
+		content = entry.content;
+		watched = entry.wd >= 0;
+		admit = !content && ++entry.hits >= ADMITHITS && (size_t)file->st.st_size <= std::min((size_t)MEMFILEMAX, membudget);
+		filelru.splice(filelru.begin(), filelru, it->second);
+	}
+	watching = inotifyfd >= 0;
+	memory = membudget > 0;
+	seen = invalidations;
+	if ((errno = pthread_mutex_unlock(&filecachemutex)) != 0)
+		perror("pthread_mutex_unlock");
+
+	if (file)
+	{
+		if (watched || unchanged(path, file->st))
+		{
+			stat_add(FILECACHE_HIT, 1);
+			if (memory)
+				stat_add(content ? MEMCACHE_HIT : MEMCACHE_MISS, 1);
+			if (admit)
+				load_content(path, file, content); // served from memory from now on
+			return file_status::OK;
+		}
+		filecache_invalidate(path);
+		file.reset();
+		content.reset();
+	}
+	stat_add(FILECACHE_MISS, 1);
+
+	/* watch directory before opening, so that any change after opening is seen */
+	size_t slash = path.rfind('/');
+	std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+	std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+	int wd = -1;
+	if (watching && (wd = inotify_add_watch(inotifyfd, dir.c_str(), WATCHMASK)) < 0)
+		perror("inotify_add_watch"); // served without caching
+
+	int fd;
+	if ((fd = open(path.c_str(), O_RDONLY | O_CLOEXEC)) < 0)
+	{
+		int openerrno = errno;
+		perror("open");
+		return openerrno == ENOENT || openerrno == ENOTDIR ? file_status::DOES_NOT_EXIST : file_status::ACCESS_FAILURE;
+	}
+	std::shared_ptr<cached_file> opened(new cached_file);
+	opened->fd = fd;
+	if (fstat(fd, &opened->st) < 0)
+	{
+		perror("fstat");
+		return file_status::ACCESS_FAILURE;
+	}
+	if (!S_ISREG(opened->st.st_mode))
+	{
+		std::cerr << "not a regular file: " << path << std::endl;
+		return file_status::ACCESS_FAILURE;
+	}
+	file = opened;
+	if (memory)
+		stat_add(MEMCACHE_MISS, 1);
+	if (watching && wd < 0)
+		return file_status::OK;
+
+	/* insert, evicting least recently used files */
+	if ((errno = pthread_mutex_lock(&filecachemutex)) != 0)
+	{
+		perror("pthread_mutex_lock");
+		return file_status::OK;
+	}
+	if (invalidations == seen && filecache.find(path) == filecache.end())
+	{
+		while (filecache.size() >= FILECACHEMAX)
+			erase_entry(--filelru.end());
+		file_cache_entry entry;
+		entry.path = path;
+		entry.wd = wd;
+		entry.name = name;
+		entry.file = file;
+		entry.hits = 0;
+		filelru.push_front(entry);
+		filecache[path] = filelru.begin();
+	}
+	if ((errno = pthread_mutex_unlock(&filecachemutex)) != 0)
+		perror("pthread_mutex_unlock");
+	return file_status::OK;
+}
+
+void filecache_invalidate(const std::string& path)
+{
+	if ((errno = pthread_mutex_lock(&filecachemutex)) != 0)
+	{
+		perror("pthread_mutex_lock");
+		return;
+	}
+	std::unordered_map<std::string, std::list<file_cache_entry>::iterator>::iterator it = filecache.find(path);
+	if (it != filecache.end())
+		erase_entry(it->second);
+	invalidations++;
+	if ((errno = pthread_mutex_unlock(&filecachemutex)) != 0)
+		perror("pthread_mutex_unlock");
+}
+
+/*
+ * Compare metadata of file at path with metadata of cached file
+ */
+bool unchanged(const std::string& path, const struct stat& st)
+{
+	struct stat now;
+	if (stat(path.c_str(), &now) < 0)
+		return false;
+	return now.st_dev == st.st_dev && now.st_ino == st.st_ino && now.st_size == st.st_size &&
+		   now.st_mtim.tv_sec == st.st_mtim.tv_sec && now.st_mtim.tv_nsec == st.st_mtim.tv_nsec &&
+		   now.st_ctim.tv_sec == st.st_ctim.tv_sec && now.st_ctim.tv_nsec == st.st_ctim.tv_nsec;
+}
+
+/*
+ * Read contents of a cached file and hold them in its entry, evicting contents of least
+ * recently used files to stay within budget
+ */
+void load_content(const std::string& path, const cached_file_ptr& file, cached_content_ptr& content)
+{
+	size_t size = file->st.st_size;
+	std::shared_ptr<std::string> data(new std::string(size, '\0'));
+	size_t readsofar = 0;
+	ssize_t readnow;
+	while (readsofar < size && (readnow = pread(file->fd, &(*data)[readsofar], size - readsofar, readsofar)) > 0)
+		readsofar += readnow;
+	if (readsofar < size)
+		return; // file shrank, entry is about to be dropped
+
+	if ((errno = pthread_mutex_lock(&filecachemutex)) != 0)
+	{
+		perror("pthread_mutex_lock");
+		return;
+	}
+	std::unordered_map<std::string, std::list<file_cache_entry>::iterator>::iterator it = filecache.find(path);
+	if (it != filecache.end() && it->second->file == file && !it->second->content)
+	{
+		std::list<file_cache_entry>::iterator victim = filelru.end();
+		while (memused + size > membudget && victim != filelru.begin())
+		{
+			victim--;
+			if (victim->content)
+			{
+				memused -= victim->content->size();
+				victim->content.reset();
+				stat_add(MEMCACHE_EVICT, 1);
+			}
+		}
+		if (memused + size <= membudget)
+		{
+			it->second->content = data;
+			memused += size;
+			content = data;
+		}
+	}
+	if ((errno = pthread_mutex_unlock(&filecachemutex)) != 0)
+		perror("pthread_mutex_unlock");
+}
+
+/*
+ * Drop entries affected by an inotify event, called with filecachemutex held
+ */
+void drop_entries(const struct inotify_event* event)
+{
+	invalidations++;
+	bool all = (event->mask & IN_Q_OVERFLOW) != 0; // events were lost
+	std::list<file_cache_entry>::iterator it = filelru.begin();
+	while (it != filelru.end())
+	{
+		/* events without a name concern the directory itself */
+		if (all || (it->wd == event->wd && (event->len == 0 || it->name == event->name)))
+			it = erase_entry(it);
+		else
+			it++;
+	}
+}
+
+/*
+ * Remove entry from cache, called with filecachemutex held
+ */
+std::list<file_cache_entry>::iterator erase_entry(std::list<file_cache_entry>::iterator it)
+{
+	if (it->content)
+		memused -= it->content->size();
+	filecache.erase(it->path);
+	return filelru.erase(it);
+}
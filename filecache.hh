@@ -0,0 +1,65 @@
+/* Cache of open file descriptors and metadata of served files */
+
+#ifndef NETPROG_FILECACHE_HH
+#define NETPROG_FILECACHE_HH
+
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+
+#include "general.hh"
+
+/* file opened for serving, descriptor closed when the last handle to it is dropped */
+struct cached_file
+{
+	int fd; // opened read-only, read with positional reads so that it can be shared between threads
+	struct stat st; // metadata at the time of opening
+	~cached_file();
+};
+
+typedef std::shared_ptr<const cached_file> cached_file_ptr;
+
+/* contents of a small, frequently read file held in memory */
+typedef std::shared_ptr<const std::string> cached_content_ptr;
+
+/*
+ * Start watching changes of cached files with inotify
+ * Without it (or before it) cached entries are validated with stat on every lookup
+ *
+ * return: 0 on success, -1 on error
+ */
+int filecache_init();
+
+/*
+ * Enable holding contents of small files in memory, admitted when a file is read again while its
+ * descriptor is cached and evicted least recently used first
+ *
+ * budget: total bytes of contents held, 0 to disable (default)
+ */
+void filecache_set_memory(size_t budget);
+
+/*
+ * Thread routine dropping cache entries of files that changed, run after successful filecache_init
+ *
+ * arg: unused
+ */
+void* filecache_watcher(void* arg);
+
+/*
+ * Open a regular file for reading, served from cache if it has not changed since last opened
+ *
+ * path: path to file
+ * file: handle to open file and its metadata on success
+ * content: contents of file if held in memory, empty otherwise
+ * return: OK, DOES_NOT_EXIST, or ACCESS_FAILURE if file can't be read or is not a regular file
+ */
+file_status filecache_open(const std::string& path, cached_file_ptr& file, cached_content_ptr& content);
+
+/*
+ * Drop cache entry of a file, e.g. after the server itself has written it
+ *
+ * path: path to file
+ */
+void filecache_invalidate(const std::string& path);
+
+#endif
@@ -1,8 +1,10 @@
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <climits>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <fstream>
 #include <iostream>
 #include <string>
 #include <sstream>
@@ -13,9 +15,12 @@
 
 #define MAXPORT 65535
 
+std::ostream discardtrace(NULL); // stream without a buffer, messages written to it are dropped
+std::atomic<std::ostream*> tracestream(&std::cout);
+
 file_status check_file_status(std::string path, file_permissions perm)
 {
-	std::cout << "checking status of file: " << path << std::endl;
+	trace() << "checking status of file: " << path << std::endl;
 
 	/* check file existence */
 	if (access(path.c_str(), F_OK) < 0)
@@ -48,21 +53,17 @@ file_status check_file_status(std::string path, file_permissions perm)
 	return file_status::OK;
 }
 
-int check_file_size(std::string path)
+off_t check_file_size(std::string path)
 {
-	std::cout << "checking size of file: " << path << std::endl;
+	trace() << "checking size of file: " << path << std::endl;
 
-	std::ifstream fs(path);
-	if (!fs.good()) // check stream state
+	struct stat st;
+	if (stat(path.c_str(), &st) < 0)
 	{
-		std::cerr << "file stream error" << std::endl;
+		perror("stat");
 		return -1;
 	}
-	fs.seekg(0, fs.end);
-	int filesize = fs.tellg();
-	fs.close();
-
-	return filesize;
+	return st.st_size;
 }
 
 int create_dir(std::string path)
@@ -70,7 +71,7 @@ int create_dir(std::string path)
 	struct stat st;
 	if (stat(path.c_str(), &st) == 0) // path exists
 	{
-		std::cout << "directory '" << path << "' exists" << std::endl;
+		trace() << "directory '" << path << "' exists" << std::endl;
 		return 0;
 	}
 	if (mkdir(path.c_str(), 0777) < 0)
@@ -78,12 +79,29 @@ int create_dir(std::string path)
 		perror("mkdir");
 		return -1;
 	}
-	std::cout << "created directory '" << path << "'" << std::endl;
+	trace() << "created directory '" << path << "'" << std::endl;
 	return 0;
 }
 
+bool make_dirs(const std::string& path)
+{
+	size_t slash = 0;
+	while (slash != std::string::npos)
+	{
+		slash = path.find('/', slash + 1);
+		std::string prefix = path.substr(0, slash);
+		if (mkdir(prefix.c_str(), 0777) < 0 && errno != EEXIST)
+		{
+			perror("mkdir");
+			return false;
+		}
+	}
+	return true;
+}
+
 int get_client_opts(int argc, char** argv, std::string& hostname, std::string& port, std::string& method,
-					std::string& filename, std::string& username, std::string& dirpath, std::string& queryname)
+					std::string& filename, std::string& username, std::string& dirpath, std::string& queryname,
+					std::string& querytype, load_opts& load, batch_opts& batch)
 {
 	bool hostnamegiven = false;
 	bool portgiven = false;
@@ -93,7 +111,7 @@ int get_client_opts(int argc, char** argv, std::string& hostname, std::string& p
 	bool dirpathgiven = false;
 	bool querynamegiven = false;
 	char opt;
-	while ((opt = getopt(argc, argv, "h:p:m:f:u:d:q:")) != -1)
+	while ((opt = getopt(argc, argv, "h:p:m:f:u:d:q:t:Lc:n:T:x:o:r:a:l:w:k:OCzb")) != -1)
 	{
 		switch (opt)
 		{
@@ -130,6 +148,62 @@ int get_client_opts(int argc, char** argv, std::string& hostname, std::string& p
 			queryname = std::string(optarg);
 			querynamegiven = true;
 			break;
+		case 't':
+			querytype = to_upper(std::string(optarg));
+			break;
+		case 'L':
+			load.enabled = true;
+			break;
+		case 'c':
+			load.connections = (unsigned int)std::strtoul(optarg, NULL, 0);
+			batch.connections = load.connections;
+			break;
+		case 'n':
+			load.requests = std::strtoul(optarg, NULL, 0);
+			break;
+		case 'T':
+			load.durationms = std::strtoul(optarg, NULL, 0);
+			break;
+		case 'x':
+			load.mix = parse_method_mix(optarg);
+			if (load.mix.empty())
+				std::cerr << "invalid mix, expected e.g. get=8,put=1,post=1" << std::endl;
+			break;
+		case 'o':
+			load.summarypath = std::string(optarg);
+			break;
+		case 'r':
+			load.rate = std::strtod(optarg, NULL);
+			break;
+		case 'a':
+			if (to_upper(std::string(optarg)) == "POISSON")
+				load.poisson = true;
+			else if (to_upper(std::string(optarg)) == "UNIFORM")
+				load.poisson = false;
+			else
+				std::cerr << "arrivals must be uniform or poisson" << std::endl;
+			break;
+		case 'l':
+			batch.listpath = std::string(optarg);
+			break;
+		case 'w':
+			batch.depth = (unsigned int)std::strtoul(optarg, NULL, 0);
+			break;
+		case 'k':
+			batch.parts = (unsigned int)std::strtoul(optarg, NULL, 0);
+			break;
+		case 'O':
+			batch.tostdout = true;
+			break;
+		case 'C':
+			batch.conditional = true;
+			break;
+		case 'z':
+			batch.compressed = true;
+			break;
+		case 'b':
+			batch.bundled = true;
+			break;
 		case '?':
 			break;
 		default:
@@ -138,33 +212,126 @@ int get_client_opts(int argc, char** argv, std::string& hostname, std::string& p
 	}
 
 	std::transform(method.begin(), method.end(), method.begin(), ::toupper); // method to upper case
-	if (method == "GET" || method == "PUT")
+
+	/* in batch mode filenames or query names come from the list */
+	if (!batch.listpath.empty())
 	{
-		if (!hostnamegiven || !portgiven || !methodgiven || !filenamegiven || !usernamegiven || !dirpathgiven)
+		if (load.enabled || batch.connections == 0 || batch.depth == 0)
 		{
-			std::cerr << "usage for GET and PUT: ./httpclient -h hostname -p port -m method -f filename -u username -d dirpath" << std::endl;
+			std::cerr << "usage for batch mode: ./httpclient -l listfile [-c connections] [-w pipelinedepth] "
+					  << "<method options without -f or -q>" << std::endl;
 			return -1;
 		}
+		filenamegiven = true;
+		querynamegiven = true;
 	}
-	else if (method == "POST")
+	if (batch.parts > 0 && (method != "GET" || load.enabled || !batch.listpath.empty()))
 	{
-		if (!hostnamegiven || !portgiven || !methodgiven || !querynamegiven || !usernamegiven)
+		std::cerr << "usage for ranged download: ./httpclient -m GET -k parts <GET options>" << std::endl;
+		return -1;
+	}
+	if (batch.tostdout)
+	{
+		if (method == "PUT" || load.enabled || !batch.listpath.empty() || batch.parts > 0)
 		{
-			std::cerr << "usage for POST: ./httpclient -h hostname -p port -m method -q queryname -u username" << std::endl;
+			std::cerr << "usage for streaming to stdout: ./httpclient -O -m GET|POST <options without -d>" << std::endl;
 			return -1;
 		}
+		dirpathgiven = true; // payload is not stored
+	}
+	if (batch.conditional && (method != "GET" || load.enabled || !batch.listpath.empty() || batch.parts > 0 || batch.tostdout))
+	{
+		std::cerr << "usage for conditional GET: ./httpclient -C -m GET <GET options>" << std::endl;
+		return -1;
+	}
+	if (batch.compressed && (method != "GET" || load.enabled || !batch.listpath.empty() || batch.parts > 0 || batch.tostdout))
+	{
+		std::cerr << "usage for compressed GET: ./httpclient -z -m GET <GET options>" << std::endl;
+		return -1;
+	}
+	if (batch.bundled && (method != "GET" || load.enabled || batch.listpath.empty() || batch.parts > 0 || batch.tostdout ||
+						  batch.conditional || batch.compressed))
+	{
+		std::cerr << "usage for bundled GET: ./httpclient -b -l listfile -m GET <GET options without -f>" << std::endl;
+		return -1;
+	}
+
+	/* in load mode without a mix, the single method is used for every request */
+	std::vector<std::string> methods;
+	if (load.enabled && !load.mix.empty())
+	{
+		std::vector<std::pair<std::string, unsigned int> >::const_iterator it;
+		for (it = load.mix.begin(); it != load.mix.end(); it++)
+			methods.push_back(it->first);
+		methodgiven = true;
 	}
 	else
+		methods.push_back(method);
+
+	std::vector<std::string>::const_iterator it;
+	for (it = methods.begin(); it != methods.end(); it++)
+	{
+		if (*it == "GET" || *it == "PUT")
+		{
+			if (!hostnamegiven || !portgiven || !methodgiven || !filenamegiven || !usernamegiven || !dirpathgiven)
+			{
+				std::cerr << "usage for GET and PUT: ./httpclient -h hostname -p port -m method -f filename -u username -d dirpath" << std::endl;
+				return -1;
+			}
+		}
+		else if (*it == "HEAD")
+		{
+			if (!hostnamegiven || !portgiven || !methodgiven || !filenamegiven || !usernamegiven)
+			{
+				std::cerr << "usage for HEAD: ./httpclient -h hostname -p port -m method -f filename -u username" << std::endl;
+				return -1;
+			}
+		}
+		else if (*it == "POST")
+		{
+			if (!hostnamegiven || !portgiven || !methodgiven || !querynamegiven || !usernamegiven)
+			{
+				std::cerr << "usage for POST: ./httpclient -h hostname -p port -m method -q queryname [-t querytype] -u username" << std::endl;
+				return -1;
+			}
+		}
+		else
+		{
+			std::cerr << "supported methods: GET, PUT, POST, HEAD" << std::endl;
+			return -1;
+		}
+	}
+	if (load.enabled && (load.connections == 0 || (load.requests == 0 && load.durationms == 0) || load.rate < 0))
 	{
-		std::cerr << "supported methods: GET, PUT, POST" << std::endl;
+		std::cerr << "usage for load mode: ./httpclient -L [-c connections] [-n requests | -T durationms] "
+				  << "[-r rate [-a uniform|poisson]] [-m method | -x get=w,put=w,post=w] [-o summaryfile] "
+				  << "<method options>" << std::endl;
 		return -1;
 	}
 
 	return 0;
 }
 
-int get_server_opts(int argc, char** argv, unsigned short& port, bool& debug,
-					std::string& servpath, std::string& dnsservip, std::string& username)
+std::vector<std::pair<std::string, unsigned int> > parse_method_mix(const std::string& mix)
+{
+	std::vector<std::pair<std::string, unsigned int> > weights;
+	std::vector<std::string> entries = split_string(mix, ',');
+	std::vector<std::string>::const_iterator it;
+	for (it = entries.begin(); it != entries.end(); it++)
+	{
+		std::vector<std::string> tokens = split_string(*it, '=');
+		unsigned long weight = tokens.size() == 2 ? std::strtoul(tokens[1].c_str(), NULL, 0) : 0;
+		if (weight == 0)
+			return std::vector<std::pair<std::string, unsigned int> >();
+		weights.push_back(std::make_pair(to_upper(tokens[0]), (unsigned int)weight));
+	}
+	return weights;
+}
+
+int get_server_opts(int argc, char** argv, unsigned short& port, bool& debug, std::string& servpath,
+					std::string& dnsservip, std::string& dnsport, std::string& username, unsigned long& timeoutms,
+					size_t& cachebytes, sync_policy& syncpolicy, bool& dedup,
+					std::vector<std::string>& proxyroutes)
 {
 	bool portgiven = false;
 	bool servpathgiven = false;
@@ -172,7 +339,7 @@ int get_server_opts(int argc, char** argv, unsigned short& port, bool& debug,
 	bool usernamegiven = false;
 	unsigned long candidate;
 	char opt;
-	while ((opt = getopt(argc, argv, "p:ds:q:u:")) != -1)
+	while ((opt = getopt(argc, argv, "p:ds:q:u:t:c:y:ar:")) != -1)
 	{
 		switch (opt)
 		{
@@ -200,12 +367,52 @@ int get_server_opts(int argc, char** argv, unsigned short& port, bool& debug,
 			break;
 		case 'q':
 			dnsservip = std::string(optarg);
+			if (dnsservip.length() > 0 && dnsservip.at(0) == '[') // [ip6] or [ip6]:port
+			{
+				size_t closing = dnsservip.find(']');
+				if (closing != std::string::npos && dnsservip.compare(closing + 1, 1, ":") == 0)
+					dnsport = dnsservip.substr(closing + 2);
+				dnsservip = dnsservip.substr(1, closing - 1);
+			}
+			else if (std::count(dnsservip.begin(), dnsservip.end(), ':') == 1) // ip4:port
+			{
+				dnsport = dnsservip.substr(dnsservip.find(':') + 1);
+				dnsservip = dnsservip.substr(0, dnsservip.find(':'));
+			}
 			dnsservipgiven = true;
 			break;
 		case 'u':
 			username = std::string(optarg);
 			usernamegiven = true;
 			break;
+		case 't':
+			candidate = std::strtoul(optarg, NULL, 0);
+			if (candidate == 0)
+			{
+				std::cerr << "strtoul: conversion failed" << std::endl;
+				break;
+			}
+			timeoutms = candidate;
+			break;
+		case 'c':
+			cachebytes = std::strtoull(optarg, NULL, 0);
+			break;
+		case 'y':
+			if (to_upper(std::string(optarg)) == "NONE")
+				syncpolicy = sync_policy::SYNC_NONE;
+			else if (to_upper(std::string(optarg)) == "FSYNC")
+				syncpolicy = sync_policy::SYNC_FSYNC;
+			else if (to_upper(std::string(optarg)) == "GROUP")
+				syncpolicy = sync_policy::SYNC_GROUP;
+			else
+				std::cerr << "sync policy must be none, fsync or group" << std::endl;
+			break;
+		case 'a':
+			dedup = true;
+			break;
+		case 'r':
+			proxyroutes.push_back(std::string(optarg));
+			break;
 		case '?':
 			break;
 		default:
@@ -214,7 +421,8 @@ int get_server_opts(int argc, char** argv, unsigned short& port, bool& debug,
 	}
 	if (!portgiven || !servpathgiven || !dnsservipgiven || !usernamegiven)
 	{
-		std::cerr << "usage: ./httpserver -p port [-d] -s servpath -q dnsservip -u username" << std::endl;
+		std::cerr << "usage: ./httpserver -p port [-d] -s servpath -q dnsservip[:dnsport] -u username [-t timeoutms] [-c cachebytes] "
+				  << "[-y none|fsync|group] [-a] [-r /prefix=host:port ...]" << std::endl;
 		return -1;
 	}
 	return 0;
@@ -238,5 +446,21 @@ std::string to_upper(const std::string& str)
 	return uppstr;
 }
 
+void set_trace(std::ostream* os)
+{
+	tracestream = os ? os : &discardtrace;
+}
+
+std::ostream& trace()
+{
+	return *tracestream;
+}
+
 general_exception::general_exception(const std::string message) : std::runtime_error(message)
 { }
+
+deadline_exception::deadline_exception(const std::string message) : general_exception(message)
+{ }
+
+cancel_exception::cancel_exception(const std::string message) : general_exception(message)
+{ }
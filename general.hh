@@ -3,10 +3,15 @@
 #ifndef NETPROG_HELPERS_HH
 #define NETPROG_HELPERS_HH
 
+#include <iosfwd>
 #include <stdexcept>
 #include <string>
+#include <sys/types.h>
+#include <utility>
 #include <vector>
 
+#include "loadgen.hh"
+
 /* file statuses */
 typedef enum
 {
@@ -22,6 +27,27 @@ typedef enum
 	WRITE
 } file_permissions;
 
+/* how files written by PUT are made durable */
+typedef enum
+{
+	SYNC_NONE, // left to the kernel
+	SYNC_FSYNC, // file and directory synced by each PUT
+	SYNC_GROUP // each PUT flushes its own data, directories of PUTs committing at the same time synced once per batch
+} sync_policy;
+
+/* batch, parallel and streaming transfer options of the client */
+struct batch_opts
+{
+	std::string listpath; // file listing filenames (GET, PUT) or query names (POST), empty for single request
+	unsigned int connections; // persistent connections to spread requests over
+	unsigned int depth; // requests in flight per connection (pipelining)
+	unsigned int parts; // ranges fetched concurrently for a single GET, 0 for one plain request
+	bool tostdout; // stream payload of a single request to stdout instead of a file
+	bool conditional; // GET only if the local copy is older than the file on the server
+	bool compressed; // accept a compressed payload for a single GET, decoded after receiving
+	bool bundled; // GET files of the list in one bundle response instead of a request each
+};
+
 /*
  * Check file status
  *
@@ -35,9 +61,9 @@ file_status check_file_status(std::string path, file_permissions perm);
  * Check file size
  *
  * path: path to file
- * return: filesize or -1 on error
+ * return: filesize (64-bit) or -1 on error
  */
-int check_file_size(std::string path);
+off_t check_file_size(std::string path);
 
 /*
  * Create directory if it does not exist
@@ -47,6 +73,14 @@ int check_file_size(std::string path);
  */
 int create_dir(std::string path);
 
+/*
+ * Create directory and its missing parents
+ *
+ * path: directory path
+ * return: true on success (also if it exists), false on error
+ */
+bool make_dirs(const std::string& path);
+
 /*
  * Get client command line options
  *
@@ -59,10 +93,22 @@ int create_dir(std::string path);
  * username: iam header field
  * dirpath: directory for files
  * queryname: name to be queried from DNS
+ * querytype: DNS query type (A if not given)
+ * load: load generation options
+ * batch: batch mode options
  * return: 0 on success, -1 on error
  */
 int get_client_opts(int argc, char** argv, std::string& hostname, std::string& port, std::string& method,
-					std::string& filename, std::string& username, std::string& dirpath, std::string& queryname);
+					std::string& filename, std::string& username, std::string& dirpath, std::string& queryname,
+					std::string& querytype, load_opts& load, batch_opts& batch);
+
+/*
+ * Parse method mix of the form "get=8,put=1,post=1"
+ *
+ * mix: mix string
+ * return: methods (upper case) with weights, empty on error
+ */
+std::vector<std::pair<std::string, unsigned int> > parse_method_mix(const std::string& mix);
 
 /*
  * Get server command line options
@@ -73,11 +119,19 @@ int get_client_opts(int argc, char** argv, std::string& hostname, std::string& p
  * debug: daemonize or not
  * servpath: path to serving directory
  * dnsservip: IP of DNS server to use
+ * dnsport: port of DNS server (given as ip:port or [ip6]:port)
  * username: iam header field
+ * timeoutms: request deadline in milliseconds
+ * cachebytes: memory for contents of small, frequently read files, 0 to not hold contents
+ * syncpolicy: durability of files written by PUT
+ * dedup: store files written by PUT by content, once per distinct content
+ * proxyroutes: URI prefixes forwarded to upstream servers, each "/prefix=host:port"
  * return: 0 on success, -1 on error
  */
-int get_server_opts(int argc, char** argv, unsigned short& port, bool& debug,
-					std::string& servpath, std::string& dnsservip, std::string& username);
+int get_server_opts(int argc, char** argv, unsigned short& port, bool& debug, std::string& servpath,
+					std::string& dnsservip, std::string& dnsport, std::string& username, unsigned long& timeoutms,
+					size_t& cachebytes, sync_policy& syncpolicy, bool& dedup,
+					std::vector<std::string>& proxyroutes);
 
 /*
  * Split a string into tokens
@@ -96,6 +150,20 @@ std::vector<std::string> split_string(const std::string& str, char delimiter);
  */
 std::string to_upper(const std::string& str);
 
+/*
+ * Direct progress messages of requests (headers, payload transfers) to a stream
+ *
+ * os: stream for messages, NULL to discard them
+ */
+void set_trace(std::ostream* os);
+
+/*
+ * Stream for progress messages of requests, std::cout unless directed elsewhere
+ *
+ * return: stream to write messages to
+ */
+std::ostream& trace();
+
 /* general exception to be used */
 class general_exception : public std::runtime_error
 {
@@ -104,4 +172,20 @@ public:
 	general_exception(const std::string message);
 };
 
+/* exception for request deadline exceeded */
+class deadline_exception : public general_exception
+{
+public:
+
+	deadline_exception(const std::string message);
+};
+
+/* exception for request cancelled because client disconnected */
+class cancel_exception : public general_exception
+{
+public:
+
+	cancel_exception(const std::string message);
+};
+
 #endif
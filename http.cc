@@ -1,25 +1,37 @@
 #include <algorithm>
+#include <cerrno>
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <iostream>
 #include <iterator>
+#include <poll.h>
 #include <sstream>
+#include <sys/socket.h>
 #include <unistd.h>
 #include <vector>
 
-#include "dns.hh"
 #include "general.hh"
 #include "http.hh"
 #include "networking.hh"
 
+#define EXPECTMINSIZE 1048576 // smallest PUT payload worth a round trip for 100 Continue
+#define CONTINUEWAITMS 1000 // time to wait for 100 Continue before sending payload anyway
+
+std::string field_value(const std::string& line);
+int await_continue(const http_conf& conf, int sockfd, const deadline& dl);
+
 http_request::http_request(const http_conf& conf) : header(), method(http_method::NOT_SET_MET), uri(),
 													protocol(http_protocol::NOT_SET_PROT), hostname(), username(),
-													content_type(), content_length(0), queryname(), querytype(), conf(conf)
+													content_type(), content_length(0), queryname(), querytype(), keepalive(true), range(),
+													if_match(), if_none_match(), if_modified_since(), if_range(), accept_encoding(), chunked(false), expect_continue(false),
+													body(), conf(conf)
 { }
 
 http_request http_request::form_header(const http_conf& conf, std::string method, std::string dirpath, std::string filename,
-									   std::string hostname, std::string username, std::string queryname)
+									   std::string hostname, std::string username, std::string queryname, std::string querytype)
 {
 	http_request req(conf);
 	req.method = req.conf.to_method(method);
@@ -28,10 +40,11 @@ http_request http_request::form_header(const http_conf& conf, std::string method
 	switch (req.method)
 	{
 	case http_method::GET:
+	case http_method::HEAD:
 		req.uri = filename;
 		break;
 	case http_method::PUT:
-		int filesize;
+		off_t filesize;
 		if (check_file_status(dirpath + filename, file_permissions::READ) != file_status::OK)
 			throw general_exception("failed to check file existence and access permissions");
 		if ((filesize = check_file_size(dirpath + filename)) < 0)
@@ -39,12 +52,13 @@ http_request http_request::form_header(const http_conf& conf, std::string method
 		req.uri = filename;
 		req.content_type = req.conf.ctypegetput;
 		req.content_length = filesize;
+		req.expect_continue = filesize >= EXPECTMINSIZE; // rejected upload is then not sent at all
 		break;
 	case http_method::POST:
 		req.uri = req.conf.uripost;
 		req.content_type = req.conf.ctypepost;
 		req.queryname = queryname;
-		req.querytype = SQUERYTYPE;
+		req.querytype = querytype;
 		req.content_length = strlen(req.get_query_body().c_str()) + 1; // includes terminating null character
 		break;
 	default:
@@ -59,26 +73,68 @@ http_request http_request::form_header(const http_conf& conf, std::string method
 	return req;
 }
 
-http_request http_request::receive_header(const http_conf& conf, int sockfd)
+http_request http_request::form_range_header(const http_conf& conf, std::string filename, std::string hostname, std::string username,
+											 size_t offset, size_t length, std::string ifrange)
 {
 	http_request req(conf);
-	std::string header;
+	req.method = http_method::GET;
+	req.protocol = req.conf.protocol;
+	req.uri = filename;
+	req.hostname = hostname;
+	req.username = username;
+
+	std::stringstream rangess;
+	rangess << req.conf.rangeunit << "=" << offset << "-" << offset + length - 1;
+	req.range = rangess.str();
+	req.if_range = ifrange;
 
-	if (!read_header(sockfd, req.conf.delimiter, header))
-		throw general_exception("failed to read request header from socket");
+	req.create_header();
 
-	req.header = header;
+	return req;
+}
 
-	/* parse header fields from the header */
-	if (!req.parse_header())
-		throw general_exception("failed to parse request header");
+http_request http_request::form_get_header(const http_conf& conf, std::string filename, std::string hostname, std::string username,
+										   std::string etag, std::string modifiedsince, std::string acceptencoding)
+{
+	http_request req(conf);
+	req.method = http_method::GET;
+	req.protocol = req.conf.protocol;
+	req.uri = filename;
+	req.hostname = hostname;
+	req.username = username;
+	req.if_none_match = etag;
+	req.if_modified_since = modifiedsince;
+	req.accept_encoding = acceptencoding;
+
+	req.create_header();
+
+	return req;
+}
+
+http_request http_request::form_bundle_header(const http_conf& conf, const std::vector<std::string>& uris, std::string hostname,
+											  std::string username)
+{
+	http_request req(conf);
+	req.method = http_method::POST;
+	req.protocol = req.conf.protocol;
+	req.uri = req.conf.uribundle;
+	req.hostname = hostname;
+	req.username = username;
+	req.content_type = req.conf.ctypegetput;
+
+	std::vector<std::string>::const_iterator it;
+	for (it = uris.begin(); it != uris.end(); it++)
+		req.body += *it + "\n";
+	req.content_length = req.body.length();
+
+	req.create_header();
 
 	return req;
 }
 
 void http_request::print_header() const
 {
-	std::cout << std::endl << "*** Request header ***" << std::endl
+	trace() << std::endl << "*** Request header ***" << std::endl
 			  << header << std::endl
 			  << "**********************" << std::endl << std::endl
 			  << "*** Request header values ***" << std::endl
@@ -92,26 +148,39 @@ void http_request::print_header() const
 			  << "*****************************" << std::endl << std::endl;
 }
 
-bool http_request::send(int sockfd, std::string dirpath) const
+bool http_request::send(int sockfd, std::string dirpath, const deadline& dl) const
 {
 	/* determine if message will continue after header */
 	bool payloadfollows = method == http_method::PUT || method == http_method::POST;
 
 	/* send header */
-	if (!send_message(sockfd, header, false, 0, payloadfollows))
+	if (!send_message(sockfd, header, false, 0, payloadfollows, dl))
 		return false;
 
+	/* final response instead of 100 Continue means payload is not wanted, it is read with receive */
+	if (payloadfollows && expect_continue)
+	{
+		int answer = await_continue(conf, sockfd, dl);
+		if (answer < 0)
+			return false;
+		if (answer == 0)
+		{
+			trace() << "server answered before payload, not sending it" << std::endl;
+			return true;
+		}
+	}
+
 	/* send payload if needed */
 	if (payloadfollows)
 	{
 		if (method == http_method::PUT)
 		{
-			if (!send_text_file(sockfd, dirpath, uri, content_length))
+			if (!send_text_file(sockfd, dirpath, uri, content_length, dl))
 				return false;
 		}
 		else if (method == http_method::POST)
 		{
-			if (!send_message(sockfd, get_query_body(), true, content_length, false))
+			if (!send_message(sockfd, body.empty() ? get_query_body() : body, true, content_length, false, dl))
 				return false;
 		}
 	}
@@ -129,6 +198,22 @@ void http_request::create_header()
 		headerss << conf.to_str(http_hfield::CONTENT_TYPE) << " " << content_type << "\r\n";
 		headerss << conf.to_str(http_hfield::CONTENT_LEN) << " " << content_length << "\r\n";
 	}
+	if (!range.empty())
+		headerss << conf.to_str(http_hfield::RANGE) << " " << range << "\r\n";
+	if (!if_match.empty())
+		headerss << conf.to_str(http_hfield::IF_MATCH) << " " << if_match << "\r\n";
+	if (!if_none_match.empty())
+		headerss << conf.to_str(http_hfield::IF_NONE_MATCH) << " " << if_none_match << "\r\n";
+	if (!if_modified_since.empty())
+		headerss << conf.to_str(http_hfield::IF_MODIFIED_SINCE) << " " << if_modified_since << "\r\n";
+	if (!if_range.empty())
+		headerss << conf.to_str(http_hfield::IF_RANGE) << " " << if_range << "\r\n";
+	if (!accept_encoding.empty())
+		headerss << conf.to_str(http_hfield::ACCEPT_ENCODING) << " " << accept_encoding << "\r\n";
+	if (expect_continue)
+		headerss << conf.to_str(http_hfield::EXPECT) << " " << conf.expectcontinue << "\r\n";
+	if (!keepalive)
+		headerss << conf.to_str(http_hfield::CONNECTION) << " " << conf.connclose << "\r\n";
 	headerss << "\r\n";
 	header = headerss.str();
 }
@@ -199,6 +284,33 @@ bool http_request::parse_header()
 			case http_hfield::CONTENT_LEN:
 				valueiss >> content_length;
 				break;
+			case http_hfield::CONNECTION:
+				keepalive = to_upper(*itvalue) != to_upper(conf.connclose);
+				break;
+			case http_hfield::RANGE:
+				valueiss >> range;
+				break;
+			case http_hfield::IF_MATCH:
+				if_match = field_value(line); // list of tags
+				break;
+			case http_hfield::IF_NONE_MATCH:
+				if_none_match = field_value(line); // list of tags
+				break;
+			case http_hfield::IF_MODIFIED_SINCE:
+				if_modified_since = field_value(line); // date contains spaces
+				break;
+			case http_hfield::IF_RANGE:
+				if_range = field_value(line);
+				break;
+			case http_hfield::ACCEPT_ENCODING:
+				accept_encoding = field_value(line);
+				break;
+			case http_hfield::TRANSFER_ENCODING:
+				chunked = to_upper(tokens.back()) == to_upper(conf.chunkedcoding); // chunked is always the final coding
+				break;
+			case http_hfield::EXPECT:
+				expect_continue = to_upper(*itvalue) == to_upper(conf.expectcontinue);
+				break;
 			case http_hfield::UNSUPP_HF:
 				break; // ignore unsupported field
 			default:
@@ -212,145 +324,93 @@ bool http_request::parse_header()
 
 http_response::http_response(const http_conf& conf) : header(), protocol(http_protocol::NOT_SET_PROT), status(http_status::NOT_SET_ST), username(),
 													  content_type(), content_length(0), request_method(http_method::NOT_SET_MET),
-													  request_uri(), request_qname(), request_qtype(), dns_query_resp(), conf(conf)
+													  request_uri(), request_qname(), request_qtype(), body(), membody(false), keepalive(false),
+													  range_offset(0), file_size(0), file(), content(), etag(), last_modified(), content_encoding(), negotiated(false),
+													  chunked(false), source(NULL), sourcectx(), conf(conf)
 { }
 
-http_response http_response::proc_req_form_header(const http_conf& conf, int sockfd, http_request req, std::string servpath, std::string username)
+http_response http_response::receive(const http_conf& conf, int sockfd, http_method reqmethod, std::string dirpath, std::string filename,
+									 const deadline& dl)
 {
 	http_response resp(conf);
-	resp.protocol = resp.conf.protocol;
-	resp.request_method = req.method;
-	resp.request_uri = req.uri;
-	std::string filepath = servpath + req.uri;
+	resp.request_method = reqmethod;
+	resp.membody = reqmethod == http_method::POST;
+	resp.keepalive = true; // persistent unless server says otherwise
 
-	file_status getfilestatus, putfilestatus;
-	std::string qbody;
-	dns_query_response dnsqresp;
+	std::string header;
+	if (!read_header(sockfd, resp.conf.delimiter, header, dl))
+		throw general_exception("failed to read response header from socket");
 
-	switch (req.method)
-	{
-	case http_method::GET:
-		getfilestatus = check_file_status(filepath, file_permissions::READ);
+	resp.header = header;
 
-		switch (getfilestatus)
-		{
-		case file_status::OK:
-			int filesize;
-			if ((filesize = check_file_size(servpath + req.uri)) < 0)
-				resp.status = http_status::INTERNAL_ERROR_500;
-			else
-			{
-				resp.status = http_status::OK_200;
-				resp.content_type = resp.conf.ctypegetput;
-				resp.content_length = filesize;
-			}
-			break;
-		case file_status::DOES_NOT_EXIST:
-			resp.status = http_status::NOT_FOUND_404;
-			break;
-		case file_status::ACCESS_FAILURE:
-			resp.status = http_status::FORBIDDEN_403;
-			break;
-		default:
-			resp.status = http_status::INTERNAL_ERROR_500;
-			break;
-		}
+	/* parse header fields from the header */
+	if (!resp.parse_header())
+		throw general_exception("failed to parse response header");
 
-		break;
-	case http_method::PUT:
-		if (req.content_type != resp.conf.ctypegetput)
+	if (resp.has_payload() && resp.chunked)
+	{
+		size_t received;
+		if (resp.membody ? !recv_chunked(sockfd, string_sink, &resp.body, SIZE_MAX, received, dl) :
+			!recv_chunked_file(sockfd, dirpath, filename, received, dl))
+			throw general_exception("failed to read chunked payload from socket");
+		resp.content_length = received;
+	}
+	else if (resp.has_payload())
+	{
+		trace() << "receiving payload...";
+		if (resp.membody)
 		{
-			resp.status = http_status::UNSUPPORTED_MEDIA_TYPE_415;
-			break;
+			if (!recv_body(sockfd, resp.content_length, resp.body, dl))
+				throw general_exception("failed to read body from socket");
 		}
-		putfilestatus = check_file_status(servpath + req.uri, file_permissions::WRITE);
-
-		switch (putfilestatus)
+		else
 		{
-		case file_status::DOES_NOT_EXIST:
-			if (recv_text_file(sockfd, servpath, req.uri, req.content_length))
-				resp.status = http_status::CREATED_201;
-			else
-				resp.status = http_status::INTERNAL_ERROR_500;
-			break;
-		case file_status::OK:
-			if (recv_text_file(sockfd, servpath, req.uri, req.content_length))
-				resp.status = http_status::OK_200;
-			else
-				resp.status = http_status::INTERNAL_ERROR_500;
-			break;
-		case file_status::ACCESS_FAILURE:
-			resp.status = http_status::FORBIDDEN_403;
-			break;
-		default:
-			resp.status = http_status::INTERNAL_ERROR_500;
-			break;
+			if (!recv_text_file(sockfd, dirpath, filename, resp.content_length, dl))
+				throw general_exception("failed to read payload as a file from socket");
 		}
+	}
 
-		break;
-	case http_method::POST:
-		if (req.uri != resp.conf.uripost)
-		{
-			resp.status = http_status::NOT_FOUND_404;
-			break;
-		}
-		if (req.content_type != resp.conf.ctypepost)
-		{
-			resp.status = http_status::UNSUPPORTED_MEDIA_TYPE_415;
-			break;
-		}
+	return resp;
+}
 
-		/* read query body from socket */
-		if (!recv_body(sockfd, req.content_length, qbody))
-		{
-			resp.status = http_status::INTERNAL_ERROR_500;
-			break;
-		}
+http_response http_response::receive_stream(const http_conf& conf, int sockfd, http_method reqmethod, recv_sink_fn sink, void* ctx,
+											const deadline& dl)
+{
+	http_response resp(conf);
+	resp.request_method = reqmethod;
+	resp.keepalive = true; // persistent unless server says otherwise
 
-		/* parse required parameters from body */
-		if (!resp.parse_req_query_params(qbody))
-		{
-			resp.status = http_status::BAD_REQUEST_400;
-			break;
-		}
+	std::string header;
+	if (!read_header(sockfd, resp.conf.delimiter, header, dl))
+		throw general_exception("failed to read response header from socket");
 
-		std::cout << "doing DNS query with parameters: name: " << resp.request_qname << ", type: " << resp.request_qtype << std::endl;
-		dnsqresp = do_dns_query(resp.conf.dnsservip, resp.request_qname, resp.request_qtype);
-		switch (dnsqresp.status)
-		{
-		case dns_query_status::SUCCESS:
-			resp.dns_query_resp = dnsqresp.response;
-			resp.status = http_status::OK_200;
-			resp.content_type = resp.conf.ctypegetput;
-			resp.content_length = dnsqresp.resp_len;
-			break;
-		case dns_query_status::FAIL:
-			resp.status = http_status::NOT_FOUND_404; // 404 as a general error
-			break;
-		default:
-			resp.status = http_status::INTERNAL_ERROR_500;
-			break;
-		}
+	resp.header = header;
 
-		break;
-	default:
-		resp.status = http_status::NOT_IMPLEMENTED_501;
-		break;
-	}
+	/* parse header fields from the header */
+	if (!resp.parse_header())
+		throw general_exception("failed to parse response header");
 
-	resp.username = username;
-	resp.create_header();
+	size_t received;
+	if (resp.has_payload() && resp.chunked)
+	{
+		if (!recv_chunked(sockfd, sink, ctx, SIZE_MAX, received, dl))
+			throw general_exception("failed to stream chunked payload from socket");
+		resp.content_length = received;
+	}
+	else if (resp.has_payload() && !recv_to_sink(sockfd, resp.content_length, sink, ctx, dl))
+		throw general_exception("failed to stream payload from socket");
 
 	return resp;
 }
 
-http_response http_response::receive(const http_conf& conf, int sockfd, http_method reqmethod, std::string dirpath, std::string filename)
+http_response http_response::receive_range(const http_conf& conf, int sockfd, int fd, const deadline& dl)
 {
 	http_response resp(conf);
-	resp.request_method = reqmethod;
+	resp.request_method = http_method::GET;
+	resp.keepalive = true; // persistent unless server says otherwise
 
 	std::string header;
-	if (!read_header(sockfd, resp.conf.delimiter, header))
+	if (!read_header(sockfd, resp.conf.delimiter, header, dl))
 		throw general_exception("failed to read response header from socket");
 
 	resp.header = header;
@@ -359,33 +419,49 @@ http_response http_response::receive(const http_conf& conf, int sockfd, http_met
 	if (!resp.parse_header())
 		throw general_exception("failed to parse response header");
 
-	/* determine if message will continue after header */
-	bool payloadfollows = (resp.request_method == http_method::GET || resp.request_method == http_method::POST) &&
-						   resp.status == http_status::OK_200;
-
-	if (payloadfollows)
+	if (resp.has_payload() && resp.chunked)
+		throw general_exception("chunked response to ranged request"); // length of part must be known
+	if (resp.status == http_status::OK_200)
 	{
-		std::cout << "receiving payload...";
-		if (reqmethod == http_method::POST)
-		{
-			if (!recv_body(sockfd, resp.content_length, resp.dns_query_resp))
-				throw general_exception("failed to read body from socket");
-		}
-		else
-		{
-			if (!recv_text_file(sockfd, dirpath, filename, resp.content_length))
-				throw general_exception("failed to read payload as a file from socket");
-		}
+		/* whole file instead of range */
+		resp.range_offset = 0;
+		resp.file_size = resp.content_length;
 	}
+	if (resp.has_payload() && !recv_file_range(sockfd, fd, resp.range_offset, resp.content_length, dl))
+		throw general_exception("failed to read payload range from socket");
+
+	return resp;
+}
+
+http_response http_response::receive_header(const http_conf& conf, int sockfd, http_method reqmethod, const deadline& dl)
+{
+	http_response resp(conf);
+	resp.request_method = reqmethod;
+	resp.keepalive = true; // persistent unless server says otherwise
+
+	std::string header;
+	if (!read_header(sockfd, resp.conf.delimiter, header, dl))
+		throw general_exception("failed to read response header from socket");
+
+	resp.header = header;
+
+	/* parse header fields from the header */
+	if (!resp.parse_header())
+		throw general_exception("failed to parse response header");
 
 	return resp;
 }
 
 http_response http_response::form_404_header(const http_conf& conf, std::string username)
+{
+	return form_error_header(conf, http_status::NOT_FOUND_404, username);
+}
+
+http_response http_response::form_error_header(const http_conf& conf, http_status status, std::string username)
 {
 	http_response resp(conf);
 	resp.protocol = resp.conf.protocol;
-	resp.status = http_status::NOT_FOUND_404;
+	resp.status = status;
 	resp.username = username;
 	resp.create_header();
 	return resp;
@@ -393,7 +469,7 @@ http_response http_response::form_404_header(const http_conf& conf, std::string
 
 void http_response::print_header() const
 {
-	std::cout << std::endl << "*** Response header ***" << std::endl
+	trace() << std::endl << "*** Response header ***" << std::endl
 			  << header << std::endl
 			  << "***********************" << std::endl << std::endl
 			  << "*** Response header values ***" << std::endl
@@ -407,48 +483,40 @@ void http_response::print_header() const
 
 void http_response::print_payload() const
 {
-	if (request_method == http_method::POST && status == http_status::OK_200)
-		std::cout << "*** Response payload ***" << std::endl
-				  << dns_query_resp << std::endl
+	if (membody && has_payload())
+		trace() << "*** Response payload ***" << std::endl
+				  << body << std::endl
 				  << "************************" << std::endl;
 }
 
-bool http_response::send(int sockfd, std::string servpath) const
-{
-	/* determine if message will continue after header */
-	bool payloadfollows = (request_method == http_method::GET || request_method == http_method::POST) &&
-						   status == http_status::OK_200;
-
-	/* send header */
-	if (!send_message(sockfd, header, false, 0, payloadfollows))
-		return false;
-
-	/* send payload if needed */
-	if (payloadfollows)
-	{
-		std::cout << "sending payload...";
-		if (request_method == http_method::POST)
-		{
-			if (!send_message(sockfd, dns_query_resp, true, content_length, false))
-				return false;
-		}
-		else if (!send_text_file(sockfd, servpath, request_uri, content_length))
-			return false;
-	}
-	return true;
-}
-
 void http_response::create_header()
 {
 	std::stringstream headerss;
 	headerss << conf.to_str(protocol) << " " << conf.to_str(status) << "\r\n";
 	headerss << conf.to_str(http_hfield::IAM) << " " << username << "\r\n";
-	if ((request_method == http_method::GET || request_method == http_method::POST) &&
-		 status == http_status::OK_200)
+	if (has_content())
 	{
 		headerss << conf.to_str(http_hfield::CONTENT_TYPE) << " " << content_type << "\r\n";
-		headerss << conf.to_str(http_hfield::CONTENT_LEN) << " " << content_length << "\r\n";
+		if (chunked)
+			headerss << conf.to_str(http_hfield::TRANSFER_ENCODING) << " " << conf.chunkedcoding << "\r\n";
+		else
+			headerss << conf.to_str(http_hfield::CONTENT_LEN) << " " << content_length << "\r\n";
 	}
+	if (status == http_status::PARTIAL_CONTENT_206)
+		headerss << conf.to_str(http_hfield::CONTENT_RANGE) << " " << conf.rangeunit << " " << range_offset << "-"
+				 << range_offset + content_length - 1 << "/" << file_size << "\r\n";
+	else if (status == http_status::RANGE_NOT_SATISFIABLE_416)
+		headerss << conf.to_str(http_hfield::CONTENT_RANGE) << " " << conf.rangeunit << " */" << file_size << "\r\n";
+	if (!content_encoding.empty())
+		headerss << conf.to_str(http_hfield::CONTENT_ENCODING) << " " << content_encoding << "\r\n";
+	if (negotiated)
+		headerss << conf.to_str(http_hfield::VARY) << " Accept-Encoding\r\n";
+	if (!etag.empty())
+		headerss << conf.to_str(http_hfield::ETAG) << " " << etag << "\r\n";
+	if (!last_modified.empty())
+		headerss << conf.to_str(http_hfield::LAST_MODIFIED) << " " << last_modified << "\r\n";
+	if (!keepalive)
+		headerss << conf.to_str(http_hfield::CONNECTION) << " " << conf.connclose << "\r\n";
 	headerss << "\r\n";
 	header = headerss.str();
 }
@@ -502,6 +570,25 @@ bool http_response::parse_header()
 			case http_hfield::CONTENT_LEN:
 				valueiss >> content_length;
 				break;
+			case http_hfield::CONNECTION:
+				keepalive = to_upper(*itvalue) != to_upper(conf.connclose);
+				break;
+			case http_hfield::CONTENT_RANGE:
+				if (itvalue + 1 == tokens.end() || !parse_content_range(*(itvalue + 1), range_offset, file_size))
+					return false;
+				break;
+			case http_hfield::ETAG:
+				valueiss >> etag;
+				break;
+			case http_hfield::LAST_MODIFIED:
+				last_modified = field_value(line);
+				break;
+			case http_hfield::CONTENT_ENCODING:
+				valueiss >> content_encoding;
+				break;
+			case http_hfield::TRANSFER_ENCODING:
+				chunked = to_upper(tokens.back()) == to_upper(conf.chunkedcoding); // chunked is always the final coding
+				break;
 			case http_hfield::UNSUPP_HF:
 				break; // ignore unsuppported field
 			default:
@@ -513,44 +600,138 @@ bool http_response::parse_header()
 	return true;
 }
 
-bool http_response::parse_req_query_params(const std::string& querybody)
+bool http_response::has_payload() const
 {
-	/* split parameters into a vector */
-	std::vector<std::string> params = split_string(querybody, '&');
-
-	/* read key and value from parameter */
-	std::vector<std::string>::const_iterator paramsit = params.begin();
-	bool qname = false;
-	bool qtype = false;
-	while (paramsit != params.end())
+	return has_content() && request_method != http_method::HEAD;
+}
+
+bool http_response::has_content() const
+{
+	return (request_method == http_method::GET || request_method == http_method::POST || request_method == http_method::HEAD) &&
+		   (status == http_status::OK_200 || status == http_status::PARTIAL_CONTENT_206);
+}
+
+bool parse_content_range(const std::string& value, size_t& offset, size_t& filesize)
+{
+	size_t slash = value.find('/');
+	if (slash == std::string::npos)
+		return false;
+	filesize = std::strtoull(value.c_str() + slash + 1, NULL, 10);
+	if (value.compare(0, 1, "*") == 0)
+		return true; // unsatisfied range
+	offset = std::strtoull(value.c_str(), NULL, 10);
+	return true;
+}
+
+std::string format_http_date(time_t t)
+{
+	struct tm tm;
+	char date[64];
+	gmtime_r(&t, &tm);
+	strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	return date;
+}
+
+bool parse_http_date(const std::string& date, time_t& t)
+{
+	struct tm tm;
+	memset(&tm, 0, sizeof(tm));
+	const char* end = strptime(date.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	if (end == NULL || *end != '\0')
+		return false;
+	t = timegm(&tm);
+	return true;
+}
+
+/*
+ * Value of a header field line as a whole, for values containing spaces
+ */
+std::string field_value(const std::string& line)
+{
+	size_t colon = line.find(':');
+	if (colon == std::string::npos)
+		return "";
+	size_t first = line.find_first_not_of(" \t", colon + 1);
+	size_t last = line.find_last_not_of(" \t\r");
+	if (first == std::string::npos || last < first)
+		return "";
+	return line.substr(first, last - first + 1);
+}
+
+/*
+ * Wait briefly for 100 Continue after request header: 1 if it came (and was consumed) or did not come in time,
+ * 0 if a final response came instead (left unread), -1 on error
+ */
+int await_continue(const http_conf& conf, int sockfd, const deadline& dl)
+{
+	int remaining = dl.remaining_ms();
+	const deadline wait = remaining >= 0 && remaining < CONTINUEWAITMS ? dl : deadline::after_ms(CONTINUEWAITMS);
+	std::string interim = to_upper(conf.to_str(conf.protocol) + " " + conf.to_str(http_status::CONTINUE_100).substr(0, 3));
+	char buffer[32];
+	ssize_t peeked = 0;
+	int lowat = 1;
+	int answer = 1;
+	while ((size_t)peeked < interim.length())
 	{
-		std::vector<std::string> paramtokens = split_string(*paramsit, '=');
-		std::vector<std::string>::const_iterator tokensit = paramtokens.begin();
-		if (tokensit != paramtokens.end())
+		/* once a part of the status line is there, poll again only when the rest of it has arrived */
+		int want = peeked > 0 ? (int)interim.length() : 1;
+		if (want != lowat && setsockopt(sockfd, SOL_SOCKET, SO_RCVLOWAT, &want, sizeof(want)) == 0)
+			lowat = want;
+		if (!wait_ready(sockfd, POLLIN, wait))
+		{
+			answer = errno == ETIMEDOUT && !dl.expired() ? 1 : -1; // server ignores expectation
+			break;
+		}
+		ssize_t recvd;
+		if ((recvd = recv(sockfd, buffer, sizeof(buffer), MSG_PEEK)) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("recv");
+			answer = -1;
+			break;
+		}
+		if (recvd == 0)
 		{
-			std::string key = to_upper(*tokensit);
-			tokensit++;
-			if (tokensit != paramtokens.end())
+			answer = 0; // closed, receive reports it
+			break;
+		}
+
+		/* drop terminating null characters of earlier header-only responses */
+		ssize_t nulls = 0;
+		while (nulls < recvd && buffer[nulls] == '\0')
+			nulls++;
+		if (nulls > 0)
+		{
+			if (read(sockfd, buffer, nulls) != nulls)
 			{
-				std::string value = *tokensit;
-				if (key == "NAME")
-				{
-					std::cout << "parsed value for 'Name': " << value << std::endl;
-					request_qname = value;
-					qname = true;
-				}
-				else if (key == "TYPE")
-				{
-					std::cout << "parsed value for 'Type': " << value << std::endl;
-					request_qtype = value;
-					qtype = true;
-				}
+				perror("read");
+				answer = -1;
+				break;
 			}
+			peeked = 0;
+			continue;
+		}
+
+		/* a final response is left unread as soon as it differs */
+		peeked = recvd;
+		size_t compared = std::min((size_t)peeked, interim.length());
+		if (to_upper(std::string(buffer, compared)) != interim.substr(0, compared))
+		{
+			answer = 0;
+			break;
 		}
-		paramsit++;
 	}
-	if (qname && qtype)
-		return true;
+	int normal = 1;
+	if (lowat != normal && setsockopt(sockfd, SOL_SOCKET, SO_RCVLOWAT, &normal, sizeof(normal)) < 0)
+		perror("setsockopt");
+	if (answer != 1 || (size_t)peeked < interim.length())
+		return answer;
 
-	return false;
+	std::string header;
+	if (!read_header(sockfd, conf.delimiter, header, dl))
+		return -1;
+	trace() << "server answered " << conf.to_str(http_status::CONTINUE_100) << ", sending payload" << std::endl;
+	return 1;
 }
+
@@ -3,10 +3,15 @@
 #ifndef NETPROG_HTTP_HH
 #define NETPROG_HTTP_HH
 
+#include <ctime>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
+#include "encoding.hh"
+#include "filecache.hh"
 #include "httpconf.hh"
+#include "networking.hh"
 
 /*
  * HTTP request
@@ -25,19 +30,64 @@ public:
 	 * hostname: host header field
 	 * username: iam header field
 	 * queryname: queryname for DNS request
+	 * querytype: query type for DNS request
 	 * return: HTTP request object
 	 */
 	static http_request form_header(const http_conf& conf, std::string method, std::string dirpath, std::string filename,
-									std::string hostname, std::string username, std::string queryname);
+									std::string hostname, std::string username, std::string queryname, std::string querytype);
 
 	/*
-	 * Read HTTP request header from socket
+	 * Create HTTP GET request header for a byte range of a file
+	 *
+	 * conf: HTTP configuration to use
+	 * filename: filename (URI)
+	 * hostname: host header field
+	 * username: iam header field
+	 * offset: first byte of range
+	 * length: number of bytes in range
+	 * ifrange: If-Range value (entity tag of the file the range is of), empty for none
+	 * return: HTTP request object
+	 */
+	static http_request form_range_header(const http_conf& conf, std::string filename, std::string hostname, std::string username,
+										  size_t offset, size_t length, std::string ifrange);
+
+	/*
+	 * Create HTTP GET request header that may be conditional (answered with 304 if file has not changed)
+	 * and may accept an encoded (compressed) payload
+	 *
+	 * conf: HTTP configuration to use
+	 * filename: filename (URI)
+	 * hostname: host header field
+	 * username: iam header field
+	 * etag: If-None-Match value (entity tag of copy), empty for none
+	 * modifiedsince: If-Modified-Since value (HTTP date of copy), empty for none
+	 * acceptencoding: Accept-Encoding value, empty for none
+	 * return: HTTP request object
+	 */
+	static http_request form_get_header(const http_conf& conf, std::string filename, std::string hostname, std::string username,
+										std::string etag, std::string modifiedsince, std::string acceptencoding);
+
+	/*
+	 * Create HTTP POST request header asking for many files in one bundle response
 	 *
 	 * conf: HTTP configuration to use
-	 * sockfd: socket descriptor with receive timeout set
+	 * uris: URIs of files, sent in this order
+	 * hostname: host header field
+	 * username: iam header field
 	 * return: HTTP request object
 	 */
-	static http_request receive_header(const http_conf& conf, int sockfd);
+	static http_request form_bundle_header(const http_conf& conf, const std::vector<std::string>& uris, std::string hostname,
+										   std::string username);
+
+	/*
+	 * Read HTTP request header from socket
+	 *
+	 * conf: HTTP configuration to use
+	 * sockfd: socket descriptor
+	 * dl: deadline of the request (deadline_exception thrown on expiry)
+	 * return: HTTP request object (cancel_exception thrown if client disconnects)
+	 */
+	static http_request receive_header(const http_conf& conf, int sockfd, const deadline& dl);
 
 	/*
 	 * Print whole header and individual values
@@ -49,9 +99,10 @@ public:
 	 *
 	 * sockfd: socket descriptor
 	 * dirpath: directory for files
+	 * dl: deadline for sending
 	 * return: true on success, false on failure
 	 */
-	bool send(int sockfd, std::string dirpath) const;
+	bool send(int sockfd, std::string dirpath, const deadline& dl) const;
 
 	std::string header;
 	http_method method;
@@ -63,6 +114,16 @@ public:
 	size_t content_length;
 	std::string queryname;
 	std::string querytype;
+	bool keepalive; // false if client asks to close connection after this request
+	std::string range; // Range header value, empty for whole file
+	std::string if_match; // entity tags the current file must have for the request to proceed, empty if not conditional
+	std::string if_none_match; // entity tags of client's copy, empty if not conditional
+	std::string if_modified_since; // HTTP date of client's copy, empty if not conditional
+	std::string if_range; // entity tag the range refers to, whole file is sent if the file has another one
+	std::string accept_encoding; // codings client accepts, empty for identity only
+	bool chunked; // payload comes with chunked transfer coding instead of a length
+	bool expect_continue; // payload is sent only after server answers 100 Continue (large PUT)
+	std::string body; // POST payload held in memory (bundle list), empty for DNS query formed from queryname and querytype
 
 private:
 
@@ -111,9 +172,11 @@ public:
 	 * req: HTTP request to process
 	 * sevpath: path to serving directory
 	 * username: iam header field
-	 * return: HTTP response object
+	 * dl: deadline of the request
+	 * return: HTTP response object (cancel_exception thrown if client disconnects)
 	 */
-	static http_response proc_req_form_header(const http_conf& conf, int sockfd, http_request req, std::string servpath, std::string username);
+	static http_response proc_req_form_header(const http_conf& conf, int sockfd, http_request req, std::string servpath, std::string username,
+											  const deadline& dl);
 
 	/*
 	 * Read HTTP response from socket
@@ -123,9 +186,47 @@ public:
 	 * reqmethod: original request method
 	 * dirpath: directory for files
 	 * filename: filename for payload
+	 * dl: deadline for receiving
 	 * return: HTTP response object
 	 */
-	static http_response receive(const http_conf& conf, int sockfd, http_method reqmethod, std::string dirpath, std::string filename);
+	static http_response receive(const http_conf& conf, int sockfd, http_method reqmethod, std::string dirpath, std::string filename,
+								 const deadline& dl);
+
+	/*
+	 * Read HTTP response from socket, payload handed to a sink as it arrives instead of stored
+	 *
+	 * conf: HTTP configuration to use
+	 * sockfd: socket descriptor
+	 * reqmethod: original request method
+	 * sink: consumer of payload
+	 * ctx: context passed to sink
+	 * dl: deadline for receiving
+	 * return: HTTP response object (body left empty)
+	 */
+	static http_response receive_stream(const http_conf& conf, int sockfd, http_method reqmethod, recv_sink_fn sink, void* ctx,
+										const deadline& dl);
+
+	/*
+	 * Read HTTP response to a ranged GET from socket, payload written at its offset in an open file
+	 *
+	 * conf: HTTP configuration to use
+	 * sockfd: socket descriptor
+	 * fd: file descriptor for payload
+	 * dl: deadline for receiving
+	 * return: HTTP response object (range_offset and file_size tell where payload went)
+	 */
+	static http_response receive_range(const http_conf& conf, int sockfd, int fd, const deadline& dl);
+
+	/*
+	 * Read HTTP response header from socket, payload (or final response after 100 Continue) left unread
+	 *
+	 * conf: HTTP configuration to use
+	 * sockfd: socket descriptor
+	 * reqmethod: original request method
+	 * dl: deadline for receiving
+	 * return: HTTP response object (general_exception thrown on failure)
+	 */
+	static http_response receive_header(const http_conf& conf, int sockfd, http_method reqmethod, const deadline& dl);
 
 	/*
 	 * Create general purpose error message (404 Not Found)
@@ -136,6 +237,16 @@ public:
 	 */
 	static http_response form_404_header(const http_conf& conf, std::string username);
 
+	/*
+	 * Create header-only error message with given status
+	 *
+	 * conf: HTTP configuration to use
+	 * status: status code
+	 * username: iam header field
+	 * return: HTTP response object
+	 */
+	static http_response form_error_header(const http_conf& conf, http_status status, std::string username);
+
 	/*
 	 * Print whole header and individual values
 	 */
@@ -151,9 +262,17 @@ public:
 	 *
 	 * sockfd: socket descriptor
 	 * servpath: path to serving directory
+	 * dl: deadline for sending
 	 * return: true on success, false on failure
 	 */
-	bool send(int sockfd, std::string servpath) const;
+	bool send(int sockfd, std::string servpath, const deadline& dl) const;
+
+	/*
+	 * Check if payload follows header
+	 *
+	 * return: true if payload follows
+	 */
+	bool has_payload() const;
 
 	std::string header;
 	http_protocol protocol;
@@ -165,7 +284,20 @@ public:
 	std::string request_uri;
 	std::string request_qname;
 	std::string request_qtype;
-	std::string dns_query_resp;
+	std::string body; // payload held in memory (DNS answers, statistics)
+	bool membody; // true if payload is in body instead of a file
+	bool keepalive; // true if connection stays open for next request
+	size_t range_offset; // file offset of payload (206)
+	size_t file_size; // full size of file (206, 416)
+	cached_file_ptr file; // open file of GET payload
+	cached_content_ptr content; // contents of GET payload file if held in memory
+	std::string etag; // strong validator of file (GET)
+	std::string last_modified; // modification time of file as HTTP date (GET)
+	std::string content_encoding; // coding of payload, empty for identity
+	bool negotiated; // payload was chosen by Accept-Encoding (file GET)
+	bool chunked; // payload is sent with chunked transfer coding instead of a length
+	send_source_fn source; // producer of chunked payload (server), NULL if payload is in body, content or file
+	std::shared_ptr<void> sourcectx; // context passed to source
 
 private:
 
@@ -189,6 +321,13 @@ private:
 	 */
 	bool parse_header();
 
+	/*
+	 * Check if header describes a payload, which follows unless the request was HEAD
+	 *
+	 * return: true if payload is described
+	 */
+	bool has_content() const;
+
 	/*
 	 * Parse DNS query parameters from query body
 	 *
@@ -199,4 +338,42 @@ private:
 	const http_conf& conf; // reference to HTTP configuration
 };
 
+/*
+ * Resolve single byte range of Range header against file size
+ *
+ * range: Range header value, e.g. bytes=0-1023
+ * filesize: size of file
+ * offset: first byte of resolved range
+ * length: length of resolved range
+ * return: 1 if satisfiable, 0 if not satisfiable, -1 if not a single byte range (header ignored)
+ */
+int resolve_range(const std::string& range, size_t filesize, size_t& offset, size_t& length);
+
+/*
+ * Parse Content-Range value (without unit), e.g. 0-1023/4096, or * and size for unsatisfied range
+ *
+ * value: value to parse
+ * offset: first byte of range (unchanged for unsatisfied range)
+ * filesize: full size of file
+ * return: true on success, false on failure
+ */
+bool parse_content_range(const std::string& value, size_t& offset, size_t& filesize);
+
+/*
+ * Format time as HTTP date, e.g. Sun, 06 Nov 1994 08:49:37 GMT
+ *
+ * t: time to format
+ * return: HTTP date
+ */
+std::string format_http_date(time_t t);
+
+/*
+ * Parse HTTP date
+ *
+ * date: HTTP date
+ * t: parsed time
+ * return: true on success, false on failure
+ */
+bool parse_http_date(const std::string& date, time_t& t);
+
 #endif
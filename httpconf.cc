@@ -1,8 +1,8 @@
 #include "httpconf.hh"
 
-http_conf::http_conf(const std::string dnsservip) : protocol(http_protocol::HTTP_1_1), ctypegetput("text/plain"),
-						 	 	 	 	 	  	  	ctypepost("application/x-www-form-urlencoded"), uripost("/dns-query"),
-						 	 	 	 	 	  	  	delimiter("\r\n\r\n"), dnsservip(dnsservip)
+http_conf::http_conf(const std::string dnsservip, const std::string dnsport) : protocol(http_protocol::HTTP_1_1), ctypegetput("text/plain"),
+						 	 	 	 	 	  	  	ctypepost("application/x-www-form-urlencoded"), uripost("/dns-query"), uristats("/server-stats"), uribundle("/bundle"), ctypebundle("application/x-file-bundle"),
+						 	 	 	 	 	  	  	delimiter("\r\n\r\n"), connclose("close"), chunkedcoding("chunked"), expectcontinue("100-continue"), rangeunit("bytes"), encdir("/.encoded"), casdir("/.cas"), dnsservip(dnsservip), dnsport(dnsport)
 {
 	init_maps();
 }
@@ -85,45 +85,91 @@ void http_conf::init_maps()
 					  {http_method::GET, "GET"},
 					  {http_method::PUT, "PUT"},
 					  {http_method::POST, "POST"},
+					  {http_method::HEAD, "HEAD"},
 					  {http_method::UNSUPP_MET, "UNSUPPORTED"} };
 
 	str_to_method = { {"NOT SET", http_method::NOT_SET_MET},
 					  {"GET", http_method::GET},
 					  {"PUT", http_method::PUT},
 					  {"POST", http_method::POST},
+					  {"HEAD", http_method::HEAD},
 					  {"UNSUPPORTED", http_method::UNSUPP_MET} };
 
 	status_to_str = { {http_status::NOT_SET_ST, "NOT SET"},
+					  {http_status::CONTINUE_100, "100 Continue"},
 					  {http_status::OK_200, "200 OK"},
 					  {http_status::CREATED_201, "201 Created"},
+					  {http_status::PARTIAL_CONTENT_206, "206 Partial Content"},
+					  {http_status::NOT_MODIFIED_304, "304 Not Modified"},
 					  {http_status::BAD_REQUEST_400, "400 Bad Request"},
 					  {http_status::FORBIDDEN_403, "403 Forbidden"},
 					  {http_status::NOT_FOUND_404, "404 Not Found"},
+					  {http_status::REQUEST_TIMEOUT_408, "408 Request Timeout"},
+					  {http_status::PRECONDITION_FAILED_412, "412 Precondition Failed"},
 					  {http_status::UNSUPPORTED_MEDIA_TYPE_415, "415 Unsupported Media Type"},
+					  {http_status::RANGE_NOT_SATISFIABLE_416, "416 Range Not Satisfiable"},
 					  {http_status::INTERNAL_ERROR_500, "500 Internal Error"},
 					  {http_status::NOT_IMPLEMENTED_501, "501 Not Implemented"},
+					  {http_status::BAD_GATEWAY_502, "502 Bad Gateway"},
+					  {http_status::GATEWAY_TIMEOUT_504, "504 Gateway Timeout"},
 					  {http_status::UNSUPP_ST, "UNSUPPORTED"} };
 
 	str_to_status = { {"NOT SET", http_status::NOT_SET_ST},
+					  {"100 CONTINUE", http_status::CONTINUE_100},
 					  {"200 OK", http_status::OK_200},
 					  {"201 CREATED", http_status::CREATED_201},
+					  {"206 PARTIAL CONTENT", http_status::PARTIAL_CONTENT_206},
+					  {"304 NOT MODIFIED", http_status::NOT_MODIFIED_304},
 					  {"400 BAD REQUEST", http_status::BAD_REQUEST_400},
 					  {"403 FORBIDDEN", http_status::FORBIDDEN_403},
 					  {"404 NOT FOUND", http_status::NOT_FOUND_404},
+					  {"408 REQUEST TIMEOUT", http_status::REQUEST_TIMEOUT_408},
+					  {"412 PRECONDITION FAILED", http_status::PRECONDITION_FAILED_412},
 					  {"415 UNSUPPORTED MEDIA TYPE", http_status::UNSUPPORTED_MEDIA_TYPE_415},
+					  {"416 RANGE NOT SATISFIABLE", http_status::RANGE_NOT_SATISFIABLE_416},
 					  {"500 INTERNAL ERROR", http_status::INTERNAL_ERROR_500},
 					  {"501 NOT IMPLEMENTED", http_status::NOT_IMPLEMENTED_501},
+					  {"502 BAD GATEWAY", http_status::BAD_GATEWAY_502},
+					  {"504 GATEWAY TIMEOUT", http_status::GATEWAY_TIMEOUT_504},
 					  {"UNSUPPORTED", http_status::UNSUPP_ST} };
 
 	hfield_to_str = { {http_hfield::HOST, "Host:"},
 					  {http_hfield::IAM, "Iam:"},
 					  {http_hfield::CONTENT_TYPE, "Content-Type:"},
 					  {http_hfield::CONTENT_LEN, "Content-Length:"},
+					  {http_hfield::CONNECTION, "Connection:"},
+					  {http_hfield::RANGE, "Range:"},
+					  {http_hfield::CONTENT_RANGE, "Content-Range:"},
+					  {http_hfield::ETAG, "ETag:"},
+					  {http_hfield::LAST_MODIFIED, "Last-Modified:"},
+					  {http_hfield::IF_MATCH, "If-Match:"},
+					  {http_hfield::IF_NONE_MATCH, "If-None-Match:"},
+					  {http_hfield::IF_MODIFIED_SINCE, "If-Modified-Since:"},
+					  {http_hfield::IF_RANGE, "If-Range:"},
+					  {http_hfield::ACCEPT_ENCODING, "Accept-Encoding:"},
+					  {http_hfield::CONTENT_ENCODING, "Content-Encoding:"},
+					  {http_hfield::VARY, "Vary:"},
+					  {http_hfield::TRANSFER_ENCODING, "Transfer-Encoding:"},
+					  {http_hfield::EXPECT, "Expect:"},
 					  {http_hfield::UNSUPP_HF, "UNSUPPORTED:"} };
 
 	str_to_hfield = { {"HOST:", http_hfield::HOST},
 					  {"IAM:", http_hfield::IAM},
 					  {"CONTENT-TYPE:", http_hfield::CONTENT_TYPE},
 					  {"CONTENT-LENGTH:", http_hfield::CONTENT_LEN},
+					  {"CONNECTION:", http_hfield::CONNECTION},
+					  {"RANGE:", http_hfield::RANGE},
+					  {"CONTENT-RANGE:", http_hfield::CONTENT_RANGE},
+					  {"ETAG:", http_hfield::ETAG},
+					  {"LAST-MODIFIED:", http_hfield::LAST_MODIFIED},
+					  {"IF-MATCH:", http_hfield::IF_MATCH},
+					  {"IF-NONE-MATCH:", http_hfield::IF_NONE_MATCH},
+					  {"IF-MODIFIED-SINCE:", http_hfield::IF_MODIFIED_SINCE},
+					  {"IF-RANGE:", http_hfield::IF_RANGE},
+					  {"ACCEPT-ENCODING:", http_hfield::ACCEPT_ENCODING},
+					  {"CONTENT-ENCODING:", http_hfield::CONTENT_ENCODING},
+					  {"VARY:", http_hfield::VARY},
+					  {"TRANSFER-ENCODING:", http_hfield::TRANSFER_ENCODING},
+					  {"EXPECT:", http_hfield::EXPECT},
 					  {"UNSUPPORTED", http_hfield::UNSUPP_HF} };
 }
@@ -21,6 +21,7 @@ typedef enum
 	GET,
 	PUT,
 	POST,
+	HEAD, // GET without payload
 	UNSUPP_MET
 } http_method;
 
@@ -28,14 +29,22 @@ typedef enum
 typedef enum
 {
 	NOT_SET_ST, // default value
+	CONTINUE_100, // interim, payload of request may follow
 	OK_200,
 	CREATED_201,
+	PARTIAL_CONTENT_206,
+	NOT_MODIFIED_304,
 	BAD_REQUEST_400,
 	FORBIDDEN_403,
 	NOT_FOUND_404,
+	REQUEST_TIMEOUT_408,
+	PRECONDITION_FAILED_412,
 	UNSUPPORTED_MEDIA_TYPE_415,
+	RANGE_NOT_SATISFIABLE_416,
 	INTERNAL_ERROR_500,
 	NOT_IMPLEMENTED_501,
+	BAD_GATEWAY_502,
+	GATEWAY_TIMEOUT_504,
 	UNSUPP_ST
 } http_status;
 
@@ -46,6 +55,20 @@ typedef enum
 	IAM,
 	CONTENT_TYPE,
 	CONTENT_LEN,
+	CONNECTION,
+	RANGE,
+	CONTENT_RANGE,
+	ETAG,
+	LAST_MODIFIED,
+	IF_MATCH,
+	IF_NONE_MATCH,
+	IF_MODIFIED_SINCE,
+	IF_RANGE,
+	ACCEPT_ENCODING,
+	CONTENT_ENCODING,
+	VARY,
+	TRANSFER_ENCODING,
+	EXPECT,
 	UNSUPP_HF
 } http_hfield;
 
@@ -58,8 +81,9 @@ public:
 	 * Constructor
 	 *
 	 * dnsservip: IP address of DNS server to use
+	 * dnsport: port of DNS server
 	 */
-	http_conf(const std::string dnsservip);
+	http_conf(const std::string dnsservip, const std::string dnsport);
 
 	/*
 	 * String to HTTP protocol
@@ -121,8 +145,18 @@ public:
 	const std::string ctypegetput; // supported content type for GET and PUT
 	const std::string ctypepost; // supported content type for POST
 	const std::string uripost; // supported URI for POST
+	const std::string uristats; // URI for GETting server statistics
+	const std::string uribundle; // URI for POSTing a list of files to get in one bundle
+	const std::string ctypebundle; // content type of bundles
 	const std::string delimiter; // delimiter between header and payload
+	const std::string connclose; // Connection header value ending a persistent connection
+	const std::string chunkedcoding; // Transfer-Encoding value of payloads sent in chunks
+	const std::string expectcontinue; // Expect value of requests waiting for 100 Continue before their payload
+	const std::string rangeunit; // unit of Range and Content-Range headers
+	const std::string encdir; // directory of encoded variants within serving directory, not served
+	const std::string casdir; // directory of content stored by digest within serving directory, not served
 	const std::string dnsservip; // DNS server to use (IPv4 address)
+	const std::string dnsport; // DNS server port
 
 private:
 
@@ -0,0 +1,615 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include "bundle.hh"
+#include "cas.hh"
+#include "dns.hh"
+#include "durable.hh"
+#include "general.hh"
+#include "http.hh"
+#include "networking.hh"
+#include "pathlock.hh"
+#include "stats.hh"
+
+#define POSTBODYMAX 65536 // longest chunked query body accepted
+
+bool is_reserved_uri(const http_conf& conf, const std::string& uri);
+std::string make_etag(const struct stat& st);
+std::string file_etag(int fd, const struct stat& st);
+std::string path_etag(const std::string& path);
+bool precondition_failed(const http_request& req, const std::string& etag);
+bool not_modified(const http_request& req, const std::string& etag, time_t mtime);
+void send_continue(const http_conf& conf, int sockfd, const deadline& dl);
+bool recv_put_file(int sockfd, const http_request& req, const std::string& filepath, int& fd, std::string& temppath,
+				   std::string& digest, const deadline& dl);
+
+http_request http_request::receive_header(const http_conf& conf, int sockfd, const deadline& dl)
+{
+	http_request req(conf);
+	std::string header;
+
+	if (!read_header(sockfd, req.conf.delimiter, header, dl))
+	{
+		if (dl.expired())
+		{
+			stat_deadline_overrun(req_stage::STAGE_HEADER);
+			throw deadline_exception("deadline exceeded while reading request header");
+		}
+		if (peer_hung_up(sockfd))
+		{
+			stat_cancel(req_stage::STAGE_HEADER);
+			throw cancel_exception("client disconnected while sending request header");
+		}
+		throw general_exception("failed to read request header from socket");
+	}
+
+	req.header = header;
+
+	/* parse header fields from the header */
+	if (!req.parse_header())
+		throw general_exception("failed to parse request header");
+
+	return req;
+}
+
+http_response http_response::proc_req_form_header(const http_conf& conf, int sockfd, http_request req, std::string servpath, std::string username,
+												   const deadline& dl)
+{
+	http_response resp(conf);
+	resp.protocol = resp.conf.protocol;
+	resp.request_method = req.method;
+	resp.request_uri = req.uri;
+	std::string filepath = servpath + req.uri;
+
+	file_status getfilestatus, putfilestatus;
+	bool filerecvd;
+	bool outdated;
+	int putfd;
+	std::string temppath;
+	std::string digest;
+	size_t received;
+	content_coding coding;
+	cached_file_ptr variant;
+	cached_content_ptr variantcontent;
+	std::string qbody;
+	bool bundled;
+	std::vector<std::string> bundleuris;
+	dns_query_response dnsqresp;
+	bool bodyread = req.content_length == 0 && !req.chunked; // connection can only be reused if request payload was consumed
+	int rangeres;
+
+	switch (req.method)
+	{
+	case http_method::GET:
+	case http_method::HEAD: // same status and header as GET, payload is left out when sending
+		if (req.uri == resp.conf.uristats)
+		{
+			/* report is formed while it is sent */
+			resp.source = stats_report_source;
+			resp.sourcectx = std::make_shared<int>(0);
+			resp.chunked = true;
+			resp.status = http_status::OK_200;
+			resp.content_type = resp.conf.ctypegetput;
+			break;
+		}
+
+		if (is_reserved_uri(resp.conf, req.uri))
+		{
+			resp.status = http_status::FORBIDDEN_403;
+			break;
+		}
+
+		pathlock_shared(filepath); // file and its variant are of the same version
+		getfilestatus = filecache_open(filepath, resp.file, resp.content);
+
+		switch (getfilestatus)
+		{
+		case file_status::OK:
+			size_t filesize;
+			filesize = resp.file->st.st_size;
+			resp.etag = file_etag(resp.file->fd, resp.file->st);
+			resp.last_modified = format_http_date(resp.file->st.st_mtime);
+
+			/* send precompressed variant if client accepts one (ranges refer to the file as is) */
+			resp.negotiated = true;
+			coding = req.range.empty() ? negotiate_coding(req.accept_encoding) : content_coding::CODING_IDENTITY;
+			if (open_encoded_variant(servpath + resp.conf.encdir, req.uri, resp.file, resp.etag.substr(1, resp.etag.length() - 2),
+									 coding, variant, variantcontent))
+			{
+				if (req.method == http_method::GET)
+				{
+					stat_add(ENCODED_RESPONSES, 1);
+					stat_add(ENCODED_BYTES_SAVED, filesize - variant->st.st_size);
+				}
+				resp.file = variant;
+				resp.content = variantcontent;
+				filesize = variant->st.st_size;
+				resp.content_encoding = coding_name(coding);
+				resp.etag.insert(resp.etag.length() - 1, "-" + resp.content_encoding); // distinct tag per representation
+			}
+
+			if (precondition_failed(req, resp.etag))
+				resp.status = http_status::PRECONDITION_FAILED_412;
+			else if (not_modified(req, resp.etag, resp.file->st.st_mtime))
+				resp.status = http_status::NOT_MODIFIED_304; // client's copy is current, header only
+			else if (!req.range.empty() && (req.if_range.empty() || req.if_range == resp.etag) &&
+					 (rangeres = resolve_range(req.range, filesize, resp.range_offset, resp.content_length)) >= 0)
+			{
+				resp.status = rangeres > 0 ? http_status::PARTIAL_CONTENT_206 : http_status::RANGE_NOT_SATISFIABLE_416;
+				resp.content_type = resp.conf.ctypegetput;
+				resp.file_size = filesize;
+			}
+			else
+			{
+				resp.status = http_status::OK_200;
+				resp.content_type = resp.conf.ctypegetput;
+				resp.content_length = filesize;
+			}
+			break;
+		case file_status::DOES_NOT_EXIST:
+			resp.status = req.if_match.empty() ? http_status::NOT_FOUND_404 : http_status::PRECONDITION_FAILED_412;
+			break;
+		case file_status::ACCESS_FAILURE:
+			resp.status = http_status::FORBIDDEN_403;
+			break;
+		default:
+			resp.status = http_status::INTERNAL_ERROR_500;
+			break;
+		}
+		pathlock_release(filepath); // open descriptors stay valid if the file is replaced while sending
+
+		break;
+	case http_method::PUT:
+		if (req.content_type != resp.conf.ctypegetput)
+		{
+			resp.status = http_status::UNSUPPORTED_MEDIA_TYPE_415;
+			break;
+		}
+		if (is_reserved_uri(resp.conf, req.uri))
+		{
+			resp.status = http_status::FORBIDDEN_403;
+			break;
+		}
+		putfilestatus = check_file_status(filepath, file_permissions::WRITE);
+
+		switch (putfilestatus)
+		{
+		case file_status::DOES_NOT_EXIST:
+		case file_status::OK:
+			if (precondition_failed(req, path_etag(filepath)))
+			{
+				resp.status = http_status::PRECONDITION_FAILED_412; // client's copy is outdated, payload is not read
+				break;
+			}
+			if (req.expect_continue)
+				send_continue(resp.conf, sockfd, dl); // request is acceptable, client may send payload
+			outdated = false;
+			if ((filerecvd = recv_put_file(sockfd, req, filepath, putfd, temppath, digest, dl)))
+			{
+				/* readers and other writers of the path wait until the file is renamed and nothing of the old one is cached,
+				 * flushing data before and syncing the directory after is done without the lock */
+				pathlock_exclusive(filepath);
+				if ((outdated = precondition_failed(req, path_etag(filepath)))) // another upload came first
+					durable_abort(putfd, temppath);
+				else
+				{
+					filerecvd = digest.empty() ? durable_commit(putfd, temppath, filepath) :
+						cas_commit(servpath + resp.conf.casdir, putfd, temppath, filepath, digest);
+					filecache_invalidate(filepath); // may have been replaced even if making it durable failed
+					remove_encoded_variants(servpath + resp.conf.encdir, req.uri);
+					resp.etag = path_etag(filepath);
+				}
+				pathlock_release(filepath);
+				if (filerecvd && !outdated)
+					filerecvd = durable_sync_name(filepath);
+			}
+			if (outdated)
+			{
+				resp.status = http_status::PRECONDITION_FAILED_412;
+				bodyread = true;
+			}
+			else if (filerecvd)
+			{
+				resp.status = putfilestatus == file_status::OK ? http_status::OK_200 : http_status::CREATED_201;
+				bodyread = true;
+			}
+			else if (dl.expired())
+			{
+				stat_deadline_overrun(req_stage::STAGE_FILE);
+				resp.status = http_status::REQUEST_TIMEOUT_408;
+			}
+			else if (peer_hung_up(sockfd))
+			{
+				stat_cancel(req_stage::STAGE_FILE);
+				throw cancel_exception("client disconnected while uploading file");
+			}
+			else
+				resp.status = http_status::INTERNAL_ERROR_500;
+			break;
+		case file_status::ACCESS_FAILURE:
+			resp.status = http_status::FORBIDDEN_403;
+			break;
+		default:
+			resp.status = http_status::INTERNAL_ERROR_500;
+			break;
+		}
+
+		break;
+	case http_method::POST:
+		bundled = req.uri == resp.conf.uribundle;
+		if (!bundled && req.uri != resp.conf.uripost)
+		{
+			resp.status = http_status::NOT_FOUND_404;
+			break;
+		}
+		if (req.content_type != (bundled ? resp.conf.ctypegetput : resp.conf.ctypepost))
+		{
+			resp.status = http_status::UNSUPPORTED_MEDIA_TYPE_415;
+			break;
+		}
+
+		/* read query body or bundle list from socket */
+		if (req.expect_continue)
+			send_continue(resp.conf, sockfd, dl);
+		if (req.chunked ? !recv_chunked(sockfd, string_sink, &qbody, POSTBODYMAX, received, dl) :
+			!recv_body(sockfd, req.content_length, qbody, dl))
+		{
+			if (dl.expired())
+			{
+				stat_deadline_overrun(req_stage::STAGE_BODY);
+				resp.status = http_status::REQUEST_TIMEOUT_408;
+			}
+			else if (peer_hung_up(sockfd))
+			{
+				stat_cancel(req_stage::STAGE_BODY);
+				throw cancel_exception("client disconnected while sending query body");
+			}
+			else
+				resp.status = http_status::INTERNAL_ERROR_500;
+			break;
+		}
+		bodyread = true;
+
+		if (bundled)
+		{
+			if (!parse_bundle_list(qbody, bundleuris))
+			{
+				resp.status = http_status::BAD_REQUEST_400;
+				break;
+			}
+
+			/* files are opened one at a time while the bundle is sent */
+			std::shared_ptr<bundle_ctx> bundle = std::make_shared<bundle_ctx>();
+			bundle->conf = &resp.conf;
+			bundle->servpath = servpath;
+			bundle->next = 0;
+			bundle->offset = 0;
+			bundle->remaining = 0;
+			for (size_t i = 0; i < bundleuris.size(); i++)
+			{
+				bundle_entry entry;
+				entry.uri = bundleuris[i];
+				entry.status = entry.uri.at(0) != '/' ? http_status::BAD_REQUEST_400 :
+					is_reserved_uri(resp.conf, entry.uri) ? http_status::FORBIDDEN_403 : http_status::NOT_SET_ST;
+				bundle->entries.push_back(entry);
+			}
+			stat_add(BUNDLE_REQUESTS, 1);
+			resp.source = bundle_source;
+			resp.sourcectx = bundle;
+			resp.chunked = true;
+			resp.status = http_status::OK_200;
+			resp.content_type = resp.conf.ctypebundle;
+			break;
+		}
+
+		/* parse required parameters from body */
+		if (!resp.parse_req_query_params(qbody))
+		{
+			resp.status = http_status::BAD_REQUEST_400;
+			break;
+		}
+
+		std::cout << "doing DNS query with parameters: name: " << resp.request_qname << ", type: " << resp.request_qtype << std::endl;
+		dnsqresp = do_dns_query(resp.conf.dnsservip, resp.conf.dnsport, resp.request_qname, resp.request_qtype, dl, sockfd);
+		switch (dnsqresp.status)
+		{
+		case dns_query_status::SUCCESS:
+			resp.body = dnsqresp.response;
+			resp.membody = true;
+			resp.status = http_status::OK_200;
+			resp.content_type = resp.conf.ctypegetput;
+			resp.content_length = dnsqresp.resp_len;
+			break;
+		case dns_query_status::FAIL:
+			resp.status = http_status::NOT_FOUND_404; // 404 as a general error
+			break;
+		case dns_query_status::TIMEOUT:
+			stat_deadline_overrun(req_stage::STAGE_DNS);
+			resp.status = http_status::GATEWAY_TIMEOUT_504;
+			break;
+		case dns_query_status::CANCELLED:
+			stat_cancel(req_stage::STAGE_DNS);
+			throw cancel_exception("client disconnected while waiting for DNS server");
+		default:
+			resp.status = http_status::INTERNAL_ERROR_500;
+			break;
+		}
+
+		break;
+	default:
+		resp.status = http_status::NOT_IMPLEMENTED_501;
+		break;
+	}
+
+	resp.username = username;
+	resp.keepalive = req.keepalive && bodyread;
+	resp.create_header();
+
+	return resp;
+}
+
+bool http_response::send(int sockfd, std::string servpath, const deadline& dl) const
+{
+	/* determine if message will continue after header */
+	bool payloadfollows = has_payload();
+
+	/* payload held in memory is sent together with header */
+	if (payloadfollows && (membody || content))
+	{
+		const char* payload = membody ? body.data() : content->data() + range_offset;
+		return send_with_payload(sockfd, header, payload, content_length, dl);
+	}
+
+	/* send header */
+	if (!send_message(sockfd, header, false, 0, payloadfollows, dl))
+		return false;
+
+	/* send payload if needed */
+	if (payloadfollows && chunked)
+		return send_chunked(sockfd, source, sourcectx.get(), dl);
+	if (payloadfollows)
+	{
+		std::cout << "sending payload...";
+		if (file)
+		{
+			if (!send_fd_range(sockfd, file->fd, range_offset, content_length, dl))
+				return false;
+		}
+		else if (!send_file_range(sockfd, servpath, request_uri, range_offset, content_length, dl))
+			return false;
+	}
+	return true;
+}
+
+bool http_response::parse_req_query_params(const std::string& querybody)
+{
+	/* split parameters into a vector (body may end with terminating null character) */
+	std::vector<std::string> params = split_string(std::string(querybody.c_str()), '&');
+
+	/* read key and value from parameter */
+	std::vector<std::string>::const_iterator paramsit = params.begin();
+	bool qname = false;
+	bool qtype = false;
+	while (paramsit != params.end())
+	{
+		std::vector<std::string> paramtokens = split_string(*paramsit, '=');
+		std::vector<std::string>::const_iterator tokensit = paramtokens.begin();
+		if (tokensit != paramtokens.end())
+		{
+			std::string key = to_upper(*tokensit);
+			tokensit++;
+			if (tokensit != paramtokens.end())
+			{
+				std::string value = *tokensit;
+				if (key == "NAME")
+				{
+					std::cout << "parsed value for 'Name': " << value << std::endl;
+					request_qname = value;
+					qname = true;
+				}
+				else if (key == "TYPE")
+				{
+					std::cout << "parsed value for 'Type': " << value << std::endl;
+					request_qtype = value;
+					qtype = true;
+				}
+			}
+		}
+		paramsit++;
+	}
+	if (qname && qtype)
+		return true;
+
+	return false;
+}
+
+int resolve_range(const std::string& range, size_t filesize, size_t& offset, size_t& length)
+{
+	/* single range only: bytes=first-last, bytes=first- or bytes=-suffixlength */
+	size_t eq = range.find('=');
+	if (eq == std::string::npos || range.find(',') != std::string::npos)
+		return -1;
+	std::string spec = range.substr(eq + 1);
+	size_t dash = spec.find('-');
+	if (to_upper(range.substr(0, eq)) != "BYTES" || dash == std::string::npos)
+		return -1;
+	std::string firststr = spec.substr(0, dash);
+	std::string laststr = spec.substr(dash + 1);
+	if (firststr.find_first_not_of("0123456789") != std::string::npos ||
+		laststr.find_first_not_of("0123456789") != std::string::npos || (firststr.empty() && laststr.empty()))
+		return -1;
+
+	size_t first, last;
+	if (firststr.empty())
+	{
+		size_t suffix = std::strtoull(laststr.c_str(), NULL, 10);
+		if (suffix == 0 || filesize == 0)
+			return 0;
+		first = suffix < filesize ? filesize - suffix : 0;
+		last = filesize - 1;
+	}
+	else
+	{
+		first = std::strtoull(firststr.c_str(), NULL, 10);
+		last = laststr.empty() ? filesize - 1 : std::strtoull(laststr.c_str(), NULL, 10);
+		if (!laststr.empty() && last < first)
+			return -1;
+		if (first >= filesize)
+			return 0;
+		if (last >= filesize)
+			last = filesize - 1;
+	}
+	offset = first;
+	length = last - first + 1;
+	return 1;
+}
+
+/*
+ * Strong validator of a file: changes whenever the file is replaced (inode), written (mtime) or resized
+ */
+std::string make_etag(const struct stat& st)
+{
+	std::stringstream etagss;
+	etagss << std::hex << "\"" << st.st_ino << "-" << (long long)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec
+		   << "-" << st.st_size << "\"";
+	return etagss.str();
+}
+
+/*
+ * Validator of an open file: digest of its content if stored by content, otherwise from metadata
+ */
+std::string file_etag(int fd, const struct stat& st)
+{
+	std::string digest;
+	return cas_digest(fd, st, digest) ? "\"" + digest + "\"" : make_etag(st);
+}
+
+/*
+ * Validator of file at path without opening it, empty if it does not exist
+ */
+std::string path_etag(const std::string& path)
+{
+	struct stat st;
+	if (stat(path.c_str(), &st) < 0)
+		return "";
+	std::string digest;
+	return cas_path_digest(path, st, digest) ? "\"" + digest + "\"" : make_etag(st);
+}
+
+/*
+ * Evaluate If-Match against the current validator (empty if there is no file), strong comparison is used
+ */
+bool precondition_failed(const http_request& req, const std::string& etag)
+{
+	if (req.if_match.empty())
+		return false;
+	if (etag.empty())
+		return true;
+	if (req.if_match == "*")
+		return false;
+	std::vector<std::string> tags = split_string(req.if_match, ',');
+	std::vector<std::string>::const_iterator it;
+	for (it = tags.begin(); it != tags.end(); it++)
+	{
+		size_t first = it->find_first_not_of(" \t");
+		if (first != std::string::npos && it->compare(first, etag.length(), etag) == 0 &&
+			it->find_first_not_of(" \t", first + etag.length()) == std::string::npos)
+			return false; // weak tags (W/) never match
+	}
+	return true;
+}
+
+/*
+ * Evaluate conditional GET: If-None-Match takes precedence, If-Modified-Since is then ignored
+ */
+bool not_modified(const http_request& req, const std::string& etag, time_t mtime)
+{
+	if (!req.if_none_match.empty())
+	{
+		if (req.if_none_match == "*")
+			return true;
+		std::vector<std::string> tags = split_string(req.if_none_match, ',');
+		std::vector<std::string>::const_iterator it;
+		for (it = tags.begin(); it != tags.end(); it++)
+		{
+			size_t first = it->find('"'); // skips whitespace and weak prefix W/, weak comparison is used
+			size_t last = it->rfind('"');
+			if (first != std::string::npos && last > first && it->compare(first, last - first + 1, etag) == 0)
+				return true;
+		}
+		return false;
+	}
+	time_t since;
+	return !req.if_modified_since.empty() && parse_http_date(req.if_modified_since, since) && mtime <= since;
+}
+
+/*
+ * Check if URI is within a directory the server keeps for itself, URIs with empty or dot segments are
+ * treated as such since they may reach one by another spelling
+ */
+bool is_reserved_uri(const http_conf& conf, const std::string& uri)
+{
+	std::string path = uri.substr(0, uri.find('?'));
+	if (path.find("//") != std::string::npos || (path + "/").find("/./") != std::string::npos ||
+		(path + "/").find("/../") != std::string::npos)
+		return true;
+	const std::string* dirs[] = {&conf.encdir, &conf.casdir};
+	for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++)
+	{
+		if (uri.compare(0, dirs[i]->length(), *dirs[i]) == 0 && (uri.length() == dirs[i]->length() || uri.at(dirs[i]->length()) == '/'))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Send interim 100 Continue, letting client send payload of request (header only, no terminating null character)
+ */
+void send_continue(const http_conf& conf, int sockfd, const deadline& dl)
+{
+	if (!send_message(sockfd, conf.to_str(conf.protocol) + " " + conf.to_str(http_status::CONTINUE_100) + "\r\n\r\n", false, 0, true, dl))
+		std::cerr << "failed to send " << conf.to_str(http_status::CONTINUE_100) << std::endl; // receiving payload then fails
+}
+
+/*
+ * Receive PUT payload into a temporary file that is flushed and left open for replacing the file with it,
+ * computing its digest on the way if uploads are stored by content (digest left empty otherwise)
+ */
+bool recv_put_file(int sockfd, const http_request& req, const std::string& filepath, int& fd, std::string& temppath,
+				   std::string& digest, const deadline& dl)
+{
+	digest.clear();
+	if ((fd = durable_create(filepath, temppath)) < 0)
+		return false;
+	size_t received;
+	bool recvd;
+	if (cas_enabled())
+	{
+		hashed_upload upload;
+		upload.fd = fd;
+		sha256_init(upload.hash);
+		recvd = req.chunked ? recv_chunked(sockfd, hashed_upload_sink, &upload, SIZE_MAX, received, dl) :
+			recv_to_sink(sockfd, req.content_length, hashed_upload_sink, &upload, dl);
+		if (recvd)
+			digest = sha256_final(upload.hash);
+	}
+	else
+		recvd = req.chunked ? recv_chunked(sockfd, fd_sink, &fd, SIZE_MAX, received, dl) :
+			recv_file_range(sockfd, fd, 0, req.content_length, dl);
+	if (!recvd || !durable_flush(fd))
+	{
+		durable_abort(fd, temppath);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,354 @@
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <pthread.h>
+#include <random>
+#include <unistd.h>
+
+#include "loadgen.hh"
+
+#define SUBBUCKETBITS 7 // 128 linear sub-buckets per power of two
+#define SUBBUCKETS (1 << SUBBUCKETBITS)
+#define NUMBUCKETS ((64 - SUBBUCKETBITS + 1) * SUBBUCKETS)
+
+/* state shared by load generator threads */
+struct load_state
+{
+	load_request_fn fn;
+	void* ctx;
+	unsigned long requests; // 0 if run is limited by time
+	struct timespec start; // start of run
+	struct timespec end; // end of timed run
+	std::atomic<unsigned long> next; // next sequence number to take
+
+	/* open-loop schedule, guarded by schedmutex */
+	double rate; // 0 for closed loop
+	bool poisson;
+	pthread_mutex_t schedmutex;
+	double nextdue; // due time of next request, microseconds from start
+	std::mt19937_64 rng;
+};
+
+/* per-thread part of a run */
+struct load_worker
+{
+	load_state* state;
+	pthread_t tid;
+	int sockfd; // connection kept by the request routine, -1 if none
+	unsigned long succeeded;
+	unsigned long failed;
+	latency_histogram latencies;
+	latency_histogram lags;
+};
+
+load_result run_workers(load_state& state, unsigned int concurrency, unsigned long durationms);
+void* load_worker_routine(void* arg);
+bool take_due(load_state* state, unsigned long& seq, struct timespec& due);
+uint64_t elapsed_us(const struct timespec& start, const struct timespec& end);
+void add_us(struct timespec& ts, uint64_t us);
+
+latency_histogram::latency_histogram() : counts(NUMBUCKETS, 0), total(0), maxvalue(0), sum(0)
+{ }
+
+void latency_histogram::record(uint64_t us)
+{
+	counts[index_of(us)]++;
+	total++;
+	sum += us;
+	if (us > maxvalue)
+		maxvalue = us;
+}
+
+void latency_histogram::merge(const latency_histogram& other)
+{
+	size_t i;
+	for (i = 0; i < NUMBUCKETS; i++)
+		counts[i] += other.counts[i];
+	total += other.total;
+	sum += other.sum;
+	if (other.maxvalue > maxvalue)
+		maxvalue = other.maxvalue;
+}
+
+uint64_t latency_histogram::percentile(double percentile) const
+{
+	if (total == 0)
+		return 0;
+	uint64_t target = (uint64_t)(percentile / 100.0 * total + 0.5);
+	if (target < 1)
+		target = 1;
+	uint64_t seen = 0;
+	size_t i;
+	for (i = 0; i < NUMBUCKETS; i++)
+	{
+		seen += counts[i];
+		if (seen >= target)
+			return highest_of(i) < maxvalue ? highest_of(i) : maxvalue;
+	}
+	return maxvalue;
+}
+
+uint64_t latency_histogram::count() const
+{
+	return total;
+}
+
+uint64_t latency_histogram::max() const
+{
+	return maxvalue;
+}
+
+double latency_histogram::mean() const
+{
+	return total > 0 ? sum / total : 0;
+}
+
+size_t latency_histogram::index_of(uint64_t us)
+{
+	if (us < SUBBUCKETS)
+		return us; // exact below first power of two
+	int msb = 63 - __builtin_clzll(us);
+	int shift = msb - SUBBUCKETBITS;
+	return ((shift + 1) << SUBBUCKETBITS) + ((us >> shift) - SUBBUCKETS);
+}
+
+uint64_t latency_histogram::highest_of(size_t idx)
+{
+	if (idx < SUBBUCKETS)
+		return idx;
+	int shift = (idx >> SUBBUCKETBITS) - 1;
+	uint64_t lowest = ((uint64_t)(idx & (SUBBUCKETS - 1)) + SUBBUCKETS) << shift;
+	return lowest + ((uint64_t)1 << shift) - 1;
+}
+
+load_result run_load(unsigned int concurrency, unsigned long requests, unsigned long durationms,
+					 load_request_fn fn, void* ctx)
+{
+	load_state state;
+	state.fn = fn;
+	state.ctx = ctx;
+	state.requests = requests;
+	state.next = 0;
+	state.rate = 0;
+	state.poisson = false;
+	return run_workers(state, concurrency, durationms);
+}
+
+load_result run_load_rate(unsigned int concurrency, unsigned long requests, unsigned long durationms, double rate,
+						  bool poisson, load_request_fn fn, void* ctx)
+{
+	load_state state;
+	state.fn = fn;
+	state.ctx = ctx;
+	state.requests = requests;
+	state.next = 0;
+	state.rate = rate;
+	state.poisson = poisson;
+	state.nextdue = 0;
+	state.rng.seed(std::random_device()());
+	if ((errno = pthread_mutex_init(&state.schedmutex, NULL)) != 0)
+		perror("pthread_mutex_init");
+	load_result result = run_workers(state, concurrency, durationms);
+	pthread_mutex_destroy(&state.schedmutex);
+	return result;
+}
+
+/*
+ * Start worker threads on prepared state, wait for them and merge their results
+ */
+load_result run_workers(load_state& state, unsigned int concurrency, unsigned long durationms)
+{
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &state.start);
+	state.end = state.start;
+	add_us(state.end, (uint64_t)durationms * 1000);
+
+	std::vector<load_worker> workers(concurrency);
+	unsigned int i, started = 0;
+	for (i = 0; i < concurrency; i++)
+	{
+		workers[i].state = &state;
+		workers[i].sockfd = -1;
+		workers[i].succeeded = 0;
+		workers[i].failed = 0;
+		if ((errno = pthread_create(&workers[i].tid, NULL, load_worker_routine, &workers[i])) != 0)
+		{
+			perror("pthread_create");
+			break;
+		}
+		started++;
+	}
+
+	load_result result;
+	result.succeeded = 0;
+	result.failed = 0;
+	result.rate = state.rate;
+	for (i = 0; i < started; i++)
+	{
+		if ((errno = pthread_join(workers[i].tid, NULL)) != 0)
+			perror("pthread_join");
+		result.succeeded += workers[i].succeeded;
+		result.failed += workers[i].failed;
+		result.latencies.merge(workers[i].latencies);
+		result.lags.merge(workers[i].lags);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	result.seconds = elapsed_us(state.start, end) / 1e6;
+
+	return result;
+}
+
+void print_load_result(const load_result& result)
+{
+	const latency_histogram& lat = result.latencies;
+	printf("requests: %lu succeeded, %lu failed in %.3f s\n", result.succeeded, result.failed, result.seconds);
+	printf("throughput: %.1f requests/s", result.seconds > 0 ? (result.succeeded + result.failed) / result.seconds : 0);
+	if (result.rate > 0)
+		printf(" (target %.1f requests/s)", result.rate);
+	printf("\n");
+	printf("latency (us): mean %.0f, p50 %llu, p90 %llu, p99 %llu, p99.9 %llu, max %llu\n", lat.mean(),
+		   (unsigned long long)lat.percentile(50), (unsigned long long)lat.percentile(90),
+		   (unsigned long long)lat.percentile(99), (unsigned long long)lat.percentile(99.9),
+		   (unsigned long long)lat.max());
+	if (result.rate > 0)
+	{
+		const latency_histogram& lag = result.lags;
+		printf("behind schedule (us): mean %.0f, p50 %llu, p99 %llu, max %llu\n", lag.mean(),
+			   (unsigned long long)lag.percentile(50), (unsigned long long)lag.percentile(99),
+			   (unsigned long long)lag.max());
+	}
+}
+
+bool write_load_summary(const std::string& path, const load_result& result)
+{
+	std::ofstream fs(path.c_str());
+	if (!fs.good())
+	{
+		std::cerr << "file stream error" << std::endl;
+		return false;
+	}
+	const latency_histogram& lat = result.latencies;
+	fs << "{\"succeeded\": " << result.succeeded
+	   << ", \"failed\": " << result.failed
+	   << ", \"seconds\": " << result.seconds
+	   << ", \"throughput\": " << (result.seconds > 0 ? (result.succeeded + result.failed) / result.seconds : 0)
+	   << ", \"latency_us\": {\"mean\": " << lat.mean()
+	   << ", \"p50\": " << lat.percentile(50)
+	   << ", \"p90\": " << lat.percentile(90)
+	   << ", \"p99\": " << lat.percentile(99)
+	   << ", \"p99.9\": " << lat.percentile(99.9)
+	   << ", \"max\": " << lat.max() << "}";
+	if (result.rate > 0)
+	{
+		const latency_histogram& lag = result.lags;
+		fs << ", \"rate\": " << result.rate
+		   << ", \"lag_us\": {\"mean\": " << lag.mean()
+		   << ", \"p50\": " << lag.percentile(50)
+		   << ", \"p99\": " << lag.percentile(99)
+		   << ", \"max\": " << lag.max() << "}";
+	}
+	fs << "}" << std::endl;
+	fs.close();
+	return fs.good();
+}
+
+/*
+ * Thread routine: take sequence numbers and run requests until count or time runs out
+ */
+void* load_worker_routine(void* arg)
+{
+	load_worker* worker = (load_worker*)arg;
+	load_state* state = worker->state;
+	if (state->rate > 0)
+	{
+		unsigned long seq;
+		struct timespec due, sent, after;
+		while (take_due(state, seq, due))
+		{
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR)
+				;
+			clock_gettime(CLOCK_MONOTONIC, &sent);
+			worker->lags.record(elapsed_us(due, sent));
+
+			bool ok = state->fn(state->ctx, seq, worker->sockfd);
+			clock_gettime(CLOCK_MONOTONIC, &after);
+			worker->latencies.record(elapsed_us(due, after));
+			if (ok)
+				worker->succeeded++;
+			else
+				worker->failed++;
+		}
+	}
+
+	while (state->rate == 0)
+	{
+		struct timespec before, after;
+		clock_gettime(CLOCK_MONOTONIC, &before);
+		if (state->requests == 0 && elapsed_us(state->end, before) > 0)
+			break; // time is up
+		unsigned long seq = state->next.fetch_add(1);
+		if (state->requests > 0 && seq >= state->requests)
+			break; // all requests taken
+
+		bool ok = state->fn(state->ctx, seq, worker->sockfd);
+		clock_gettime(CLOCK_MONOTONIC, &after);
+		worker->latencies.record(elapsed_us(before, after));
+		if (ok)
+			worker->succeeded++;
+		else
+			worker->failed++;
+	}
+	if (worker->sockfd >= 0 && close(worker->sockfd) < 0)
+		perror("close");
+	return arg;
+}
+
+/*
+ * Take next request of the open-loop schedule, false when the schedule is complete
+ */
+bool take_due(load_state* state, unsigned long& seq, struct timespec& due)
+{
+	double dueus;
+	pthread_mutex_lock(&state->schedmutex);
+	seq = state->next.fetch_add(1);
+	dueus = state->nextdue;
+	if (state->poisson)
+		state->nextdue += std::exponential_distribution<double>(state->rate)(state->rng) * 1e6;
+	else
+		state->nextdue += 1e6 / state->rate;
+	pthread_mutex_unlock(&state->schedmutex);
+
+	if (state->requests > 0 && seq >= state->requests)
+		return false; // all requests taken
+	due = state->start;
+	add_us(due, (uint64_t)dueus);
+	if (state->requests == 0 && elapsed_us(state->end, due) > 0)
+		return false; // schedule ends with the duration
+	return true;
+}
+
+/*
+ * Microseconds from start to end, 0 if end is before start
+ */
+uint64_t elapsed_us(const struct timespec& start, const struct timespec& end)
+{
+	long long us = (long long)(end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+	return us > 0 ? (uint64_t)us : 0;
+}
+
+/*
+ * Advance time by microseconds
+ */
+void add_us(struct timespec& ts, uint64_t us)
+{
+	ts.tv_sec += us / 1000000;
+	ts.tv_nsec += (us % 1000000) * 1000;
+	if (ts.tv_nsec >= 1000000000)
+	{
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+}
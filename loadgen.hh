@@ -0,0 +1,149 @@
+/* Load generation and latency measurement */
+
+#ifndef NETPROG_LOADGEN_HH
+#define NETPROG_LOADGEN_HH
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* load mode options of the client */
+struct load_opts
+{
+	bool enabled;
+	unsigned int connections; // concurrent connections
+	unsigned long requests; // total requests, 0 to run for the duration
+	unsigned long durationms; // duration of the run
+	double rate; // open-loop arrival rate in requests/s, 0 for closed loop
+	bool poisson; // exponential inter-arrival times instead of uniform
+	std::vector<std::pair<std::string, unsigned int> > mix; // methods with weights
+	std::string summarypath; // file for machine-readable summary, empty for none
+};
+
+/*
+ * Latency histogram with logarithmic buckets of linear sub-buckets (HDR style),
+ * values in microseconds recorded with under 1% relative error
+ */
+class latency_histogram
+{
+public:
+
+	/*
+	 * Constructor, creates empty histogram
+	 */
+	latency_histogram();
+
+	/*
+	 * Record one value
+	 *
+	 * us: latency in microseconds
+	 */
+	void record(uint64_t us);
+
+	/*
+	 * Add values of another histogram to this one
+	 *
+	 * other: histogram to add
+	 */
+	void merge(const latency_histogram& other);
+
+	/*
+	 * Value at given percentile
+	 *
+	 * percentile: percentile between 0 and 100
+	 * return: highest value equivalent to the bucket of the percentile, 0 if empty
+	 */
+	uint64_t percentile(double percentile) const;
+
+	uint64_t count() const;
+	uint64_t max() const;
+	double mean() const;
+
+private:
+
+	/*
+	 * Bucket index of a value
+	 */
+	static size_t index_of(uint64_t us);
+
+	/*
+	 * Highest value that falls into bucket
+	 */
+	static uint64_t highest_of(size_t idx);
+
+	std::vector<uint64_t> counts;
+	uint64_t total;
+	uint64_t maxvalue;
+	double sum;
+};
+
+/*
+ * Request routine run by load generator threads
+ *
+ * ctx: context given to the load generator
+ * seq: sequence number of the request
+ * sockfd: connection of the calling thread, -1 until the routine opens one, kept for its next requests
+ *         (set back to -1 after closing it) and closed by the load generator when the thread ends
+ * return: true if request succeeded
+ */
+typedef bool (*load_request_fn)(void* ctx, unsigned long seq, int& sockfd);
+
+/* result of a load run */
+struct load_result
+{
+	unsigned long succeeded;
+	unsigned long failed;
+	double seconds; // wall-clock duration of the run
+	double rate; // target arrival rate of open-loop run, 0 for closed loop
+	latency_histogram latencies; // latencies of all requests, from intended send time in open loop
+	latency_histogram lags; // open loop: delay from intended to actual send time
+};
+
+/*
+ * Run closed-loop load: concurrent threads issue requests back to back
+ *
+ * concurrency: number of threads
+ * requests: total number of requests, 0 to run for the duration
+ * durationms: duration of the run if requests is 0
+ * fn: request routine
+ * ctx: context passed to request routine
+ * return: result of the run
+ */
+load_result run_load(unsigned int concurrency, unsigned long requests, unsigned long durationms,
+					 load_request_fn fn, void* ctx);
+
+/*
+ * Run open-loop load: requests are due on a fixed schedule regardless of how fast
+ * responses come back, latency is measured from the due time so that queueing
+ * behind a slow server is counted (no coordinated omission)
+ *
+ * concurrency: number of threads, i.e. maximum requests in flight
+ * requests: total number of requests, 0 to run for the duration
+ * durationms: duration of the schedule if requests is 0
+ * rate: arrival rate in requests/s
+ * poisson: exponential inter-arrival times if true, uniform otherwise
+ * fn: request routine
+ * ctx: context passed to request routine
+ * return: result of the run
+ */
+load_result run_load_rate(unsigned int concurrency, unsigned long requests, unsigned long durationms, double rate,
+						  bool poisson, load_request_fn fn, void* ctx);
+
+/*
+ * Print throughput and latency percentiles of a run
+ *
+ * result: result to print
+ */
+void print_load_result(const load_result& result);
+
+/*
+ * Write summary of a run as JSON
+ *
+ * path: file to write
+ * result: result to write
+ * return: true on success, false on failure
+ */
+bool write_load_summary(const std::string& path, const load_result& result);
+
+#endif
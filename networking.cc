@@ -1,17 +1,154 @@
+#include <algorithm>
 #include <arpa/inet.h>
+#include <cctype>
 #include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
-#include <fstream>
+#include <fcntl.h>
 #include <iostream>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <unordered_map>
+#include <vector>
 
+#include "general.hh"
 #include "networking.hh"
 
 #define LISTENQLEN 5
 #define READBUFSIZE 1024
 #define SENDBUFSIZE 512
+#define MAXHEADERLEN 16384 // longest header accepted
+#define RANGEBUFSIZE 65536 // read size when receiving into a file at an offset
+#define SINKBUFSIZE 16384 // buffer handed to a streaming sink
+#define RESERVEMAX 1048576 // body memory reserved up front at most
+#define SENDFILECHUNK 1048576 // bytes handed to sendfile at a time, deadline is checked in between
+#define CHUNKLINEMAX 256 // longest chunk size line (with extensions) or trailer field accepted
+#define CONNECTDELAYMS 250 // delay before next connection attempt starts (RFC 8305)
+#define ADDRCACHETTL 30 // seconds resolved addresses are reused
+#define ADDRCACHEMAX 1024 // maximum number of cached resolutions
+
+/* resolved address of a host */
+struct resolved_addr
+{
+	int family;
+	int socktype;
+	int protocol;
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+};
+
+/* cached resolution of hostname and port */
+struct addr_cache_entry
+{
+	time_t expires;
+	std::vector<resolved_addr> addrs;
+};
+
+/* resolved addresses shared by connecting threads, keyed by hostname and port, access protected by mutex */
+std::unordered_map<std::string, addr_cache_entry> addrcache;
+pthread_mutex_t addrcachemutex = PTHREAD_MUTEX_INITIALIZER;
+
+bool skip_terminators(int sockfd, char* peeked, ssize_t peekedlen);
+bool read_line(int sockfd, std::string& line, const deadline& dl);
+bool write_iov(int sockfd, struct iovec* iov, int count, const deadline& dl);
+
+deadline::deadline() : isset(false), at()
+{ }
+
+deadline deadline::after_ms(unsigned long ms)
+{
+	deadline dl;
+	clock_gettime(CLOCK_MONOTONIC, &dl.at);
+	dl.at.tv_sec += ms / 1000;
+	dl.at.tv_nsec += (ms % 1000) * 1000000;
+	if (dl.at.tv_nsec >= 1000000000)
+	{
+		dl.at.tv_sec++;
+		dl.at.tv_nsec -= 1000000000;
+	}
+	dl.isset = true;
+	return dl;
+}
+
+deadline deadline::none()
+{
+	return deadline();
+}
+
+bool deadline::expired() const
+{
+	return isset && remaining_ms() == 0;
+}
+
+int deadline::remaining_ms() const
+{
+	if (!isset)
+		return -1;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long long remaining = (long long)(at.tv_sec - now.tv_sec) * 1000 + (at.tv_nsec - now.tv_nsec) / 1000000;
+	if (remaining <= 0)
+		return 0;
+	if (remaining > 0x7fffffff)
+		return 0x7fffffff;
+	return (int)remaining;
+}
+
+bool wait_ready(int sockfd, short events, const deadline& dl)
+{
+	return wait_ready_watch(sockfd, events, -1, dl);
+}
+
+bool wait_ready_watch(int sockfd, short events, int watchfd, const deadline& dl)
+{
+	struct pollfd pfds[2];
+	pfds[0].fd = sockfd;
+	pfds[0].events = events;
+	pfds[1].fd = watchfd; // ignored by poll if negative
+	pfds[1].events = POLLRDHUP;
+	pfds[1].revents = 0;
+	int ready;
+	do
+	{
+		if (dl.expired())
+		{
+			std::cerr << "deadline exceeded" << std::endl;
+			errno = ETIMEDOUT;
+			return false;
+		}
+		ready = poll(pfds, 2, dl.remaining_ms());
+	}
+	while (ready == 0 || (ready < 0 && errno == EINTR));
+	if (ready < 0)
+	{
+		perror("poll");
+		return false;
+	}
+	if (pfds[1].revents != 0)
+	{
+		std::cerr << "peer of watched connection hung up" << std::endl;
+		errno = ECONNABORTED;
+		return false;
+	}
+	return true; // ready, or error condition for the following I/O call to report
+}
+
+bool peer_hung_up(int sockfd)
+{
+	struct pollfd pfd;
+	pfd.fd = sockfd;
+	pfd.events = POLLRDHUP;
+	pfd.revents = 0;
+	return poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLRDHUP | POLLHUP | POLLERR));
+}
 
 int accept_connection(int listenfd)
 {
@@ -24,18 +161,13 @@ int accept_connection(int listenfd)
 		return -1;
 	}
 
-	/* set 5 second receive timeout */
-	struct timeval tv;
-	tv.tv_sec = 5;
-	tv.tv_usec = 0;
-	if (setsockopt(connfd, SOL_SOCKET, SO_RCVTIMEO, (char*)&tv, sizeof(struct timeval)) < 0)
-	{
+	/* header and payload are written separately, don't let them wait for delayed ACKs */
+	int nodelay = 1;
+	if (setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay)) < 0)
 		perror("setsockopt");
-		return -1;
-	}
 
 	char buff[80];
-	std::cout << "connection from " << inet_ntop(AF_INET6, &addr.sin6_addr, buff, sizeof(buff))
+	trace() << "connection from " << inet_ntop(AF_INET6, &addr.sin6_addr, buff, sizeof(buff))
 			  << ", port " << ntohs(addr.sin6_port) << ", fd is " << connfd << std::endl;
 
 	return connfd;
@@ -74,9 +206,9 @@ int create_and_listen(unsigned short port)
 	return listenfd;
 }
 
-int init_udp(const char* destip, const char* destport, struct sockaddr** destaddr, socklen_t* addrlen)
+int init_udp(const char* destip, const char* destport, struct sockaddr_storage* destaddr, socklen_t* addrlen)
 {
-	int	sockfd, n;
+	int	sockfd = -1, n;
 	struct addrinfo hints, *res, *ressave;
 
 	memset(&hints, 0, sizeof(struct addrinfo));
@@ -93,78 +225,131 @@ int init_udp(const char* destip, const char* destport, struct sockaddr** destadd
 	do
 	{
 		sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-	    if (sockfd < 0)
-	    	continue; /* ignore this one */
-
-		break; // yes, this is pretty dumb loop :-)
+		if (sockfd >= 0)
+		{
+			/* copy address before address info is freed */
+			memcpy(destaddr, res->ai_addr, res->ai_addrlen);
+			*addrlen = res->ai_addrlen;
+			break;
+		}
 	} while ((res = res->ai_next) != NULL);
 
 	freeaddrinfo(ressave);
 
-	if (res == NULL)
+	if (sockfd < 0)
 	{
 		fprintf(stderr, "Could not open socket\n");
 		return -1;
 	}
 
-	/* set 5 second receive timeout */
-	struct timeval tv;
-	tv.tv_sec = 5;
-	tv.tv_usec = 0;
-	if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, (char*)&tv, sizeof(struct timeval)) < 0)
-	{
-		perror("setsockopt");
-		return -1;
-	}
-
-	*destaddr = res->ai_addr;
-	*addrlen = res->ai_addrlen;
-
 	return sockfd;
 }
 
-bool read_header(int sockfd, std::string delimiter, std::string& header)
+bool read_header(int sockfd, std::string delimiter, std::string& header, const deadline& dl)
 {
-	bool delimiterfound = false;
-	int recvd;
-	char byte; // 1 byte buffer
 	std::string readtotal;
-	size_t foundidx; // index of start of delimiter
-	while (!delimiterfound && (recvd = read(sockfd, &byte, 1)) == 1)
+	char buffer[READBUFSIZE];
+	while (readtotal.length() < MAXHEADERLEN)
 	{
-		readtotal += std::string(&byte, 1);
-		foundidx = readtotal.find(delimiter);
+		if (!wait_ready(sockfd, POLLIN, dl))
+			return false;
+
+		/* peek what is available, consume only bytes up to the end of delimiter */
+		ssize_t peeked;
+		if ((peeked = recv(sockfd, buffer, READBUFSIZE, MSG_PEEK)) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("recv");
+			return false;
+		}
+		if (peeked == 0)
+		{
+			std::cerr << "delimiter not found" << std::endl;
+			return false;
+		}
+		if (readtotal.empty() && buffer[0] == '\0')
+		{
+			if (!skip_terminators(sockfd, buffer, peeked))
+				return false;
+			continue;
+		}
+		size_t oldlen = readtotal.length();
+		size_t searchfrom = oldlen >= delimiter.length() ? oldlen - delimiter.length() + 1 : 0;
+		readtotal.append(buffer, peeked);
+		size_t foundidx = readtotal.find(delimiter, searchfrom); // index of start of delimiter
+		size_t toconsume = peeked;
 		if (foundidx != std::string::npos)
 		{
-			delimiterfound = true;
-			header = readtotal.substr(0, foundidx + delimiter.length()); // include delimiter to header
+			toconsume = foundidx + delimiter.length() - oldlen;
+			readtotal.resize(foundidx + delimiter.length()); // include delimiter to header
+		}
+		if (read(sockfd, buffer, toconsume) != (ssize_t)toconsume)
+		{
+			perror("read");
+			return false;
+		}
+		if (foundidx != std::string::npos)
+		{
+			header = readtotal;
+			return true;
 		}
 	}
-	if (recvd < 0)
+	std::cerr << "header too long" << std::endl;
+	return false;
+}
+
+bool await_message(int sockfd, const deadline& dl)
+{
+	char buffer[READBUFSIZE];
+	while (wait_ready(sockfd, POLLIN, dl))
 	{
-		perror("read");
-		return false;
+		ssize_t peeked;
+		if ((peeked = recv(sockfd, buffer, READBUFSIZE, MSG_PEEK)) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return false; // reset by peer
+		}
+		if (peeked == 0)
+			return false; // closed by peer
+		if (buffer[0] != '\0')
+			return true;
+		if (!skip_terminators(sockfd, buffer, peeked))
+			return false;
 	}
-	if (!delimiterfound)
+	return false;
+}
+
+/*
+ * Consume null characters at the start of peeked data
+ */
+bool skip_terminators(int sockfd, char* peeked, ssize_t peekedlen)
+{
+	ssize_t nulls = 0;
+	while (nulls < peekedlen && peeked[nulls] == '\0')
+		nulls++;
+	if (read(sockfd, peeked, nulls) != nulls)
 	{
-		std::cerr << "delimiter not found" << std::endl;
+		perror("read");
 		return false;
 	}
 	return true;
 }
 
-bool recv_body(int sockfd, size_t contentlen, std::string& body)
+bool recv_body(int sockfd, size_t contentlen, std::string& body, const deadline& dl)
 {
-	std::cout << "receiving body of " << contentlen << " bytes...";
+	trace() << "receiving body of " << contentlen << " bytes...";
 	size_t recvdsofar = 0;
-	int recvd;
+	int recvd = 1;
 	char buffer[READBUFSIZE];
 	std::string bodyrecvd;
-	while (recvdsofar < contentlen && (recvd = read(sockfd, buffer, READBUFSIZE)) > 0)
+	bodyrecvd.reserve(std::min(contentlen, (size_t)RESERVEMAX)); // length comes from peer
+	while (recvdsofar < contentlen && wait_ready(sockfd, POLLIN, dl) &&
+		   (recvd = read(sockfd, buffer, std::min((size_t)READBUFSIZE, contentlen - recvdsofar))) > 0)
 	{
-		std::string chunk(buffer, recvd);
 		recvdsofar += recvd;
-		bodyrecvd += chunk;
+		bodyrecvd.append(buffer, recvd);
 	}
 	if (recvd == 0)
 	{
@@ -177,51 +362,202 @@ bool recv_body(int sockfd, size_t contentlen, std::string& body)
 		perror("read");
 		return false;
 	}
-	body = bodyrecvd;
-	std::cout << recvdsofar << " bytes received" << std::endl;
+	if (recvdsofar < contentlen)
+		return false; // deadline exceeded
+	body.swap(bodyrecvd);
+	trace() << recvdsofar << " bytes received" << std::endl;
 	return true;
 }
 
-bool recv_text_file(int sockfd, std::string dirpath, std::string filename, size_t filesize)
+bool recv_text_file(int sockfd, std::string dirpath, std::string filename, size_t filesize, const deadline& dl)
 {
-	std::cout << "receiving file of " << filesize << " bytes...";
-	std::ofstream fs(dirpath + filename);
-	if (!fs.good()) // check stream state
+	trace() << "receiving file of " << filesize << " bytes...";
+	int fd;
+	if ((fd = open((dirpath + filename).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
 	{
-		std::cerr << "file stream error" << std::endl;
+		perror("open");
 		return false;
 	}
+	bool recvd = recv_file_range(sockfd, fd, 0, filesize, dl);
+	if (close(fd) < 0)
+	{
+		perror("close");
+		return false;
+	}
+	return recvd;
+}
 
+bool recv_to_sink(int sockfd, size_t length, recv_sink_fn sink, void* ctx, const deadline& dl)
+{
+	trace() << "streaming " << length << " bytes...";
 	size_t recvdsofar = 0;
-	int recvd;
-	char buffer[READBUFSIZE];
-	while (recvdsofar < filesize && (recvd = read(sockfd, buffer, READBUFSIZE)) > 0)
+	ssize_t recvd = 1;
+	std::vector<char> buffer(SINKBUFSIZE);
+	while (recvdsofar < length && wait_ready(sockfd, POLLIN, dl) &&
+		   (recvd = read(sockfd, &buffer[0], std::min((size_t)SINKBUFSIZE, length - recvdsofar))) > 0)
 	{
-		std::string chunk(buffer, recvd);
 		recvdsofar += recvd;
-		fs << chunk;
+		if (!sink(ctx, &buffer[0], recvd))
+		{
+			std::cerr << "sink aborted receiving" << std::endl;
+			return false;
+		}
 	}
 	if (recvd < 0)
 	{
 		perror("read");
-		fs.close();
 		return false;
 	}
 	if (recvd == 0)
 	{
 		std::cerr << "eof" << std::endl;
-		fs.close();
 		return false;
 	}
-	fs.close();
-	std::cout << recvdsofar << " bytes received" << std::endl;
+	if (recvdsofar < length)
+		return false; // deadline exceeded
+	trace() << recvdsofar << " bytes streamed" << std::endl;
+	return true;
+}
+
+bool recv_chunked(int sockfd, recv_sink_fn sink, void* ctx, size_t maxlen, size_t& received, const deadline& dl)
+{
+	trace() << "receiving chunked payload...";
+	received = 0;
+	std::string line;
+	while (true)
+	{
+		/* chunk size in hex, possibly followed by extensions */
+		if (!read_line(sockfd, line, dl))
+			return false;
+		char* end;
+		errno = 0;
+		unsigned long long size = std::strtoull(line.c_str(), &end, 16);
+		if (line.empty() || !isxdigit((unsigned char)line.at(0)) || errno == ERANGE ||
+			(*end != '\0' && *end != ';' && *end != ' ' && *end != '\t'))
+		{
+			std::cerr << "invalid chunk size line: " << line << std::endl;
+			return false;
+		}
+		if (size == 0)
+			break; // last chunk
+		if (size > maxlen - received)
+		{
+			std::cerr << "chunked payload longer than " << maxlen << " bytes" << std::endl;
+			return false;
+		}
+		if (!recv_to_sink(sockfd, size, sink, ctx, dl))
+			return false;
+		received += size;
+
+		/* chunk data ends with CRLF */
+		if (!read_line(sockfd, line, dl))
+			return false;
+		if (!line.empty())
+		{
+			std::cerr << "chunk longer than its size" << std::endl;
+			return false;
+		}
+	}
+
+	/* skip trailer fields up to the empty line */
+	do
+	{
+		if (!read_line(sockfd, line, dl))
+			return false;
+	} while (!line.empty());
+	trace() << received << " bytes received in chunks" << std::endl;
 	return true;
 }
 
-bool send_message(int sockfd, std::string message, bool uselength, size_t contentlen, bool continues)
+bool recv_chunked_file(int sockfd, std::string dirpath, std::string filename, size_t& received, const deadline& dl)
+{
+	int fd;
+	if ((fd = open((dirpath + filename).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+	{
+		perror("open");
+		return false;
+	}
+	bool recvd = recv_chunked(sockfd, fd_sink, &fd, SIZE_MAX, received, dl);
+	if (close(fd) < 0)
+	{
+		perror("close");
+		return false;
+	}
+	return recvd;
+}
+
+bool string_sink(void* ctx, const char* data, size_t len)
+{
+	((std::string*)ctx)->append(data, len);
+	return true;
+}
+
+bool fd_sink(void* ctx, const char* data, size_t len)
+{
+	int fd = *(int*)ctx;
+	size_t written = 0;
+	while (written < len)
+	{
+		ssize_t n;
+		if ((n = write(fd, data + written, len - written)) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("write");
+			return false;
+		}
+		written += n;
+	}
+	return true;
+}
+
+bool discard_sink(void*, const char*, size_t)
+{
+	return true;
+}
+
+bool recv_file_range(int sockfd, int fd, size_t offset, size_t length, const deadline& dl)
+{
+	trace() << "receiving " << length << " bytes of file to offset " << offset << "...";
+	size_t recvdsofar = 0;
+	ssize_t recvd = 1;
+	std::vector<char> buffer(RANGEBUFSIZE);
+	while (recvdsofar < length && wait_ready(sockfd, POLLIN, dl) &&
+		   (recvd = read(sockfd, &buffer[0], std::min((size_t)RANGEBUFSIZE, length - recvdsofar))) > 0)
+	{
+		ssize_t written = 0;
+		while (written < recvd)
+		{
+			ssize_t n;
+			if ((n = pwrite(fd, &buffer[written], recvd - written, offset + recvdsofar + written)) < 0)
+			{
+				perror("pwrite");
+				return false;
+			}
+			written += n;
+		}
+		recvdsofar += recvd;
+	}
+	if (recvd < 0)
+	{
+		perror("read");
+		return false;
+	}
+	if (recvd == 0)
+	{
+		std::cerr << "eof" << std::endl;
+		return false;
+	}
+	if (recvdsofar < length)
+		return false; // deadline exceeded
+	trace() << recvdsofar << " bytes received" << std::endl;
+	return true;
+}
+
+bool send_message(int sockfd, std::string message, bool uselength, size_t contentlen, bool continues, const deadline& dl)
 {
 	const char* msg = message.c_str();
-	std::cout << std::endl << "sending message:" << std::endl << msg << std::endl;
+	trace() << std::endl << "sending message:" << std::endl << msg << std::endl;
 	size_t remaining; // number of bytes remaining to send
 	if (uselength) // use the given content length
 		remaining = contentlen;
@@ -239,6 +575,8 @@ bool send_message(int sockfd, std::string message, bool uselength, size_t conten
 	{
 		if (remaining < chunktosend)
 			chunktosend = remaining;
+		if (!wait_ready(sockfd, POLLOUT, dl))
+			return false;
 		if ((sent = write(sockfd, &msg[byteidx], chunktosend)) < 0)
 		{
 			perror("write");
@@ -246,7 +584,7 @@ bool send_message(int sockfd, std::string message, bool uselength, size_t conten
 		}
 		byteidx += sent;
 		remaining -= sent;
-		std::cout << sent << " bytes sent, " << remaining << " bytes remaining" << std::endl;
+		trace() << sent << " bytes sent, " << remaining << " bytes remaining" << std::endl;
 	}
 	if (remaining == 0)
 		return true;
@@ -254,138 +592,500 @@ bool send_message(int sockfd, std::string message, bool uselength, size_t conten
 	return false;
 }
 
-bool send_text_file(int sockfd, std::string servpath, std::string filename, size_t filesize)
+bool send_with_payload(int sockfd, const std::string& header, const char* payload, size_t length, const deadline& dl)
 {
-	std::cout << "sending file of " << filesize << " bytes...";
-	std::ifstream fs(servpath + filename);
-	if (!fs.good()) // check stream state
+	trace() << std::endl << "sending message:" << std::endl << header << std::endl;
+	struct iovec iov[2];
+	iov[0].iov_base = (void*)header.data();
+	iov[0].iov_len = header.length();
+	iov[1].iov_base = (void*)payload;
+	iov[1].iov_len = length;
+	if (!write_iov(sockfd, iov, 2, dl))
+		return false;
+	trace() << header.length() + length << " bytes sent" << std::endl;
+	return true;
+}
+
+bool send_chunked(int sockfd, send_source_fn source, void* ctx, const deadline& dl)
+{
+	trace() << "sending chunked payload...";
+	size_t totalsent = 0;
+	std::string chunk;
+	do
+	{
+		chunk.clear();
+		if (!source(ctx, chunk))
+		{
+			std::cerr << "source aborted sending" << std::endl;
+			return false;
+		}
+		if (!send_chunk(sockfd, chunk.data(), chunk.length(), dl))
+			return false;
+		totalsent += chunk.length();
+	} while (!chunk.empty());
+	trace() << totalsent << " bytes sent in chunks" << std::endl;
+	return true;
+}
+
+bool send_chunk(int sockfd, const char* data, size_t len, const deadline& dl)
+{
+	/* size line, data and CRLF in one write, an empty chunk is the last one (without trailer fields) */
+	char sizeline[32];
+	struct iovec iov[3];
+	iov[0].iov_base = sizeline;
+	iov[0].iov_len = snprintf(sizeline, sizeof(sizeline), "%zx\r\n", len);
+	iov[1].iov_base = (void*)data;
+	iov[1].iov_len = len;
+	iov[2].iov_base = (void*)"\r\n";
+	iov[2].iov_len = 2;
+	return write_iov(sockfd, iov, 3, dl);
+}
+
+bool send_data(int sockfd, const char* data, size_t len, const deadline& dl)
+{
+	struct iovec iov;
+	iov.iov_base = (void*)data;
+	iov.iov_len = len;
+	return write_iov(sockfd, &iov, 1, dl);
+}
+
+bool send_text_file(int sockfd, std::string servpath, std::string filename, size_t filesize, const deadline& dl)
+{
+	return send_file_range(sockfd, servpath, filename, 0, filesize, dl);
+}
+
+bool send_file_range(int sockfd, std::string servpath, std::string filename, size_t offset, size_t length, const deadline& dl)
+{
+	int fd;
+	if ((fd = open((servpath + filename).c_str(), O_RDONLY)) < 0)
 	{
-		std::cerr << "file stream error" << std::endl;
+		perror("open");
 		return false;
 	}
+	bool sent = send_fd_range(sockfd, fd, offset, length, dl);
+	if (close(fd) < 0)
+		perror("close");
+	return sent;
+}
 
+bool send_fd_range(int sockfd, int fd, size_t offset, size_t length, const deadline& dl)
+{
+	trace() << "sending " << length << " bytes of file from offset " << offset << "...";
 	size_t totalsent = 0;
 
-	/* read file in chunks */
-	char readbuffer[READBUFSIZE];
-	int chunktoread = READBUFSIZE;
-	size_t readremaining = filesize;
-	while (readremaining > 0)
+	/* let kernel copy from page cache to socket */
+	while (totalsent < length)
 	{
-		if (readremaining < (size_t)chunktoread)
-			chunktoread = readremaining;
-		fs.read(readbuffer, chunktoread);
-		if (!fs.good() && !fs.eof())
+		ssize_t sent;
+		off_t fileoffset = offset + totalsent;
+		if (!wait_ready(sockfd, POLLOUT, dl))
+			return false;
+		if ((sent = sendfile(sockfd, fd, &fileoffset, std::min((size_t)SENDFILECHUNK, length - totalsent))) < 0)
 		{
-			std::cerr << "file stream error (not eof)" << std::endl;
-			fs.close();
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			if (totalsent == 0 && (errno == EINVAL || errno == ENOSYS))
+				break; // not supported for this file, copy through buffer instead
+			perror("sendfile");
 			return false;
 		}
-		readremaining -= chunktoread;
+		if (sent == 0)
+		{
+			std::cerr << "file ended before " << length << " bytes" << std::endl;
+			return false;
+		}
+		totalsent += sent;
+	}
+	if (totalsent == length)
+	{
+		trace() << totalsent << " bytes sent" << std::endl;
+		return true;
+	}
 
-		/* send read chunk to socket in chunks */
-		size_t sendremaining = chunktoread; // number of bytes remaining to send
-		ssize_t sent;
-		size_t byteidx = 0;
-		size_t chunktosend = SENDBUFSIZE;
-		while (sendremaining > 0)
+	std::vector<char> buffer(std::min((size_t)RANGEBUFSIZE, length)); // small files need no full-size buffer
+	while (totalsent < length)
+	{
+		ssize_t readnow;
+		if ((readnow = pread(fd, &buffer[0], std::min((size_t)RANGEBUFSIZE, length - totalsent), offset + totalsent)) < 0)
 		{
-			if (sendremaining < chunktosend)
-				chunktosend = sendremaining;
-			if ((sent = write(sockfd, &readbuffer[byteidx], chunktosend)) < 0)
+			if (errno == EINTR)
+				continue;
+			perror("pread");
+			return false;
+		}
+		if (readnow == 0)
+		{
+			std::cerr << "file ended before " << length << " bytes" << std::endl;
+			return false;
+		}
+
+		/* send read chunk to socket */
+		ssize_t byteidx = 0;
+		while (byteidx < readnow)
+		{
+			ssize_t sent;
+			if (!wait_ready(sockfd, POLLOUT, dl))
+				return false;
+			if ((sent = write(sockfd, &buffer[byteidx], readnow - byteidx)) < 0)
 			{
 				perror("write");
-				fs.close();
 				return false;
 			}
 			byteidx += sent;
-			sendremaining -= sent;
-			totalsent += sent;
-		}
-		if (sendremaining != 0)
-		{
-			std::cerr << "send remaining is not zero!" << std::endl;
-			fs.close();
-			return false;
 		}
+		totalsent += readnow;
 	}
-
-	fs.close();
-	std::cout << totalsent << " bytes sent" << std::endl;
+	trace() << totalsent << " bytes sent" << std::endl;
 	return true;
 }
 
 /*
  * Print address
  */
-void print_address(const char *prefix, const struct addrinfo *res)
+void print_address(const char *prefix, const struct sockaddr *addr)
 {
-	/* slightly modified from lecture example */
-
 	char outbuf[80];
-	struct sockaddr_in *sin = (struct sockaddr_in *)res->ai_addr;
-	struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)res->ai_addr;
-	void *address;
-
-	if (res->ai_family == AF_INET)
-		address = &(sin->sin_addr);
-	else if (res->ai_family == AF_INET6)
-		address = &(sin6->sin6_addr);
+	const void *address;
+
+	if (addr->sa_family == AF_INET)
+		address = &((const struct sockaddr_in *)addr)->sin_addr;
+	else if (addr->sa_family == AF_INET6)
+		address = &((const struct sockaddr_in6 *)addr)->sin6_addr;
 	else
 	{
 		std::cerr << "unknown address" << std::endl;
 		return;
 	}
 
-	const char *ret = inet_ntop(res->ai_family, address, outbuf, sizeof(outbuf));
-	std::cout << prefix << " " << ret << std::endl;
+	const char *ret = inet_ntop(addr->sa_family, address, outbuf, sizeof(outbuf));
+	trace() << prefix << " " << ret << std::endl;
 }
 
-int tcp_connect(std::string hostname, std::string port)
+/*
+ * Resolve hostname and port, from cache if resolved recently
+ * Addresses are ordered with families interleaved, address that connected last first
+ */
+bool resolve_cached(const std::string& key, const std::string& hostname, const std::string& port,
+					std::vector<resolved_addr>& addrs)
 {
-	/* slightly modified from lecture example */
+	time_t now = time(NULL);
+	bool found = false;
+	if ((errno = pthread_mutex_lock(&addrcachemutex)) != 0)
+		perror("pthread_mutex_lock");
+	else
+	{
+		std::unordered_map<std::string, addr_cache_entry>::iterator it = addrcache.find(key);
+		if (it != addrcache.end())
+		{
+			if (it->second.expires > now)
+			{
+				addrs = it->second.addrs;
+				found = true;
+			}
+			else
+				addrcache.erase(it); // expired
+		}
+		if ((errno = pthread_mutex_unlock(&addrcachemutex)) != 0)
+			perror("pthread_mutex_unlock");
+	}
+	if (found)
+		return true;
 
-	int	sockfd, addrret;
+	int addrret;
 	struct addrinfo	hints, *res, *ressave;
-
 	memset(&hints, 0, sizeof(struct addrinfo));
 	hints.ai_family = AF_UNSPEC;
 	hints.ai_socktype = SOCK_STREAM;
-
 	if ((addrret = getaddrinfo(hostname.c_str(), port.c_str(), &hints, &res)) != 0)
 	{
 		std::cerr << "failed to get address info for " << hostname << ", "
 				  << port << ": " << gai_strerror(addrret) << std::endl;
-		return -1;
+		return false;
 	}
 	ressave = res;
 
-	do
+	/* interleave families, starting with the preferred (first) one (RFC 8305 section 4) */
+	std::vector<resolved_addr> first, other;
+	for (; res != NULL; res = res->ai_next)
 	{
-		sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-		if (sockfd < 0)
+		resolved_addr addr;
+		addr.family = res->ai_family;
+		addr.socktype = res->ai_socktype;
+		addr.protocol = res->ai_protocol;
+		memcpy(&addr.addr, res->ai_addr, res->ai_addrlen);
+		addr.addrlen = res->ai_addrlen;
+		if (addr.family == ressave->ai_family)
+			first.push_back(addr);
+		else
+			other.push_back(addr);
+	}
+	freeaddrinfo(ressave);
+	addrs.clear();
+	size_t i;
+	for (i = 0; i < first.size() || i < other.size(); i++)
+	{
+		if (i < first.size())
+			addrs.push_back(first[i]);
+		if (i < other.size())
+			addrs.push_back(other[i]);
+	}
+
+	if ((errno = pthread_mutex_lock(&addrcachemutex)) != 0)
+	{
+		perror("pthread_mutex_lock");
+		return true;
+	}
+	if (addrcache.size() < ADDRCACHEMAX)
+	{
+		addr_cache_entry& entry = addrcache[key];
+		entry.expires = now + ADDRCACHETTL;
+		entry.addrs = addrs;
+	}
+	if ((errno = pthread_mutex_unlock(&addrcachemutex)) != 0)
+		perror("pthread_mutex_unlock");
+	return true;
+}
+
+/*
+ * Record outcome of connecting: winning address is tried first next time, failure forgets resolution
+ */
+void cache_outcome(const std::string& key, const resolved_addr* winner)
+{
+	if ((errno = pthread_mutex_lock(&addrcachemutex)) != 0)
+	{
+		perror("pthread_mutex_lock");
+		return;
+	}
+	std::unordered_map<std::string, addr_cache_entry>::iterator it = addrcache.find(key);
+	if (it != addrcache.end())
+	{
+		if (winner == NULL)
+			addrcache.erase(it);
+		else
 		{
-			perror("failed to create socket");
-			continue; // ignore this one
+			std::vector<resolved_addr>& addrs = it->second.addrs;
+			std::vector<resolved_addr>::iterator ait;
+			for (ait = addrs.begin(); ait != addrs.end(); ait++)
+			{
+				if (ait->addrlen == winner->addrlen && memcmp(&ait->addr, &winner->addr, winner->addrlen) == 0)
+				{
+					std::rotate(addrs.begin(), ait, ait + 1);
+					break;
+				}
+			}
 		}
+	}
+	if ((errno = pthread_mutex_unlock(&addrcachemutex)) != 0)
+		perror("pthread_mutex_unlock");
+}
 
-		print_address("trying to connect", res);
-		if (connect(sockfd, res->ai_addr, res->ai_addrlen) == 0)
-			break; // success
+/*
+ * Start non-blocking connect
+ * return: socket descriptor or -1 on failure, connected set if connect completed at once
+ */
+int start_connect(const resolved_addr& addr, bool& connected)
+{
+	int sockfd;
+	connected = false;
+	if ((sockfd = socket(addr.family, addr.socktype | SOCK_NONBLOCK, addr.protocol)) < 0)
+	{
+		perror("failed to create socket");
+		return -1;
+	}
+	print_address("trying to connect", (const struct sockaddr*)&addr.addr);
+	if (connect(sockfd, (const struct sockaddr*)&addr.addr, addr.addrlen) == 0)
+		connected = true;
+	else if (errno != EINPROGRESS)
+	{
 		perror("failed to connect");
-		close(sockfd);	// ignore this one
+		close(sockfd);
+		return -1;
 	}
-	while ((res = res->ai_next) != NULL);
+	return sockfd;
+}
 
-	if (res == NULL)
+int tcp_connect(std::string hostname, std::string port)
+{
+	std::string key = hostname + "/" + port;
+	std::vector<resolved_addr> addrs;
+	if (!resolve_cached(key, hostname, port, addrs))
+		return -1;
+
+	/* staggered parallel attempts: next address is tried when the previous fails or is slow (RFC 8305) */
+	std::vector<struct pollfd> attempts;
+	std::vector<size_t> attemptaddrs; // index of address of each attempt
+	size_t nextaddr = 0;
+	int sockfd = -1;
+	size_t winner = 0;
+	while (sockfd < 0 && (nextaddr < addrs.size() || !attempts.empty()))
 	{
-		std::cerr << "failed to connect " << hostname << ", " << port << std::endl,
-		sockfd = -1;
+		if (nextaddr < addrs.size())
+		{
+			bool connected;
+			int fd = start_connect(addrs[nextaddr], connected);
+			if (connected)
+			{
+				sockfd = fd;
+				winner = nextaddr;
+				break;
+			}
+			if (fd >= 0)
+			{
+				struct pollfd pfd;
+				pfd.fd = fd;
+				pfd.events = POLLOUT;
+				pfd.revents = 0;
+				attempts.push_back(pfd);
+				attemptaddrs.push_back(nextaddr);
+			}
+			nextaddr++;
+		}
+		if (attempts.empty())
+			continue;
+
+		int ready = poll(&attempts[0], attempts.size(), nextaddr < addrs.size() ? CONNECTDELAYMS : -1);
+		if (ready < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+		size_t i = 0;
+		while (ready > 0 && i < attempts.size())
+		{
+			if (attempts[i].revents == 0)
+			{
+				i++;
+				continue;
+			}
+			int err = 0;
+			socklen_t errlen = sizeof(err);
+			if (getsockopt(attempts[i].fd, SOL_SOCKET, SO_ERROR, &err, &errlen) < 0)
+				err = errno;
+			if (err == 0)
+			{
+				sockfd = attempts[i].fd;
+				winner = attemptaddrs[i];
+				attempts.erase(attempts.begin() + i);
+				attemptaddrs.erase(attemptaddrs.begin() + i);
+				break;
+			}
+			errno = err;
+			perror("failed to connect");
+			close(attempts[i].fd); // failed, next address is tried at once
+			attempts.erase(attempts.begin() + i);
+			attemptaddrs.erase(attemptaddrs.begin() + i);
+		}
 	}
-	else
-		print_address("using address", res);
 
-	freeaddrinfo(ressave);
+	/* abandon slower attempts */
+	std::vector<struct pollfd>::const_iterator it;
+	for (it = attempts.begin(); it != attempts.end(); it++)
+		close(it->fd);
+
+	if (sockfd < 0)
+	{
+		std::cerr << "failed to connect " << hostname << ", " << port << std::endl;
+		cache_outcome(key, NULL);
+		return -1;
+	}
+
+	/* rest of I/O waits with poll before blocking calls */
+	int flags;
+	if ((flags = fcntl(sockfd, F_GETFL)) < 0 || fcntl(sockfd, F_SETFL, flags & ~O_NONBLOCK) < 0)
+	{
+		perror("fcntl");
+		close(sockfd);
+		return -1;
+	}
+
+	/* header and payload are written separately, don't let them wait for delayed ACKs */
+	int nodelay = 1;
+	if (setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay)) < 0)
+		perror("setsockopt");
+	print_address("using address", (const struct sockaddr*)&addrs[winner].addr);
+	cache_outcome(key, &addrs[winner]);
 
 	return sockfd;
 }
+
+/*
+ * Read line ending with LF (CR before it removed) from socket, used for chunk framing
+ */
+bool read_line(int sockfd, std::string& line, const deadline& dl)
+{
+	line.clear();
+	char buffer[CHUNKLINEMAX + 2]; // longest line with its CRLF
+	while (line.length() < sizeof(buffer))
+	{
+		if (!wait_ready(sockfd, POLLIN, dl))
+			return false;
+
+		/* peek what is available, consume only bytes up to the LF so that chunk data after it stays unread */
+		ssize_t peeked;
+		if ((peeked = recv(sockfd, buffer, sizeof(buffer) - line.length(), MSG_PEEK)) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("recv");
+			return false;
+		}
+		if (peeked == 0)
+		{
+			std::cerr << "eof" << std::endl;
+			return false;
+		}
+		const char* lf = (const char*)memchr(buffer, '\n', peeked);
+		size_t toconsume = lf ? lf - buffer + 1 : peeked;
+		if (read(sockfd, buffer, toconsume) != (ssize_t)toconsume)
+		{
+			perror("read");
+			return false;
+		}
+		if (lf)
+		{
+			line.append(buffer, toconsume - 1);
+			if (!line.empty() && line.at(line.length() - 1) == '\r')
+				line.erase(line.length() - 1);
+			return true;
+		}
+		line.append(buffer, toconsume);
+	}
+	std::cerr << "too long line in chunked payload" << std::endl;
+	return false;
+}
+
+/*
+ * Write all buffers of an I/O vector to socket, advancing the vector past what was written
+ */
+bool write_iov(int sockfd, struct iovec* iov, int count, const deadline& dl)
+{
+	while (count > 0)
+	{
+		ssize_t sent;
+		if (!wait_ready(sockfd, POLLOUT, dl))
+			return false;
+		if ((sent = writev(sockfd, iov, count)) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("writev");
+			return false;
+		}
+
+		/* skip what was written */
+		while (count > 0 && (size_t)sent >= iov->iov_len)
+		{
+			sent -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count > 0)
+		{
+			iov->iov_base = (char*)iov->iov_base + sent;
+			iov->iov_len -= sent;
+		}
+	}
+	return true;
+}
@@ -3,14 +3,112 @@
 #ifndef NETPROG_NETWORKING_HH
 #define NETPROG_NETWORKING_HH
 
+#include <ctime>
 #include <string>
 #include <sys/socket.h>
 
 /*
- * Accept connection and set 5 second receive timeout for the connection
+ * Deadline of a request on monotonic clock
+ * Passed to every blocking operation done on behalf of the request
+ */
+class deadline
+{
+public:
+
+	/*
+	 * Create deadline given time from now
+	 *
+	 * ms: time budget in milliseconds
+	 * return: deadline object
+	 */
+	static deadline after_ms(unsigned long ms);
+
+	/*
+	 * Create deadline that never expires
+	 *
+	 * return: deadline object
+	 */
+	static deadline none();
+
+	/*
+	 * Check if deadline has passed
+	 *
+	 * return: true if expired
+	 */
+	bool expired() const;
+
+	/*
+	 * Time remaining until deadline
+	 *
+	 * return: milliseconds remaining (0 if expired), -1 if no deadline
+	 */
+	int remaining_ms() const;
+
+private:
+
+	/*
+	 * Private constructor
+	 * Class instances are created by static member functions
+	 */
+	deadline();
+
+	bool isset; // false if deadline never expires
+	struct timespec at; // point of expiry
+};
+
+/*
+ * Consumer of streamed payload
+ *
+ * ctx: context given with sink
+ * data: next bytes of payload
+ * len: number of bytes
+ * return: true to continue, false to abort receiving
+ */
+typedef bool (*recv_sink_fn)(void* ctx, const char* data, size_t len);
+
+/*
+ * Producer of payload generated piece by piece
+ *
+ * ctx: context given with source
+ * chunk: next piece of payload, left empty when payload is complete
+ * return: true on success, false to abort sending
+ */
+typedef bool (*send_source_fn)(void* ctx, std::string& chunk);
+
+/*
+ * Wait until socket is ready for I/O or deadline expires
+ *
+ * sockfd: socket descriptor
+ * events: poll events to wait for
+ * dl: deadline for waiting
+ * return: true if ready, false on error or expiry (errno set to ETIMEDOUT)
+ */
+bool wait_ready(int sockfd, short events, const deadline& dl);
+
+/*
+ * Wait until socket is ready for I/O, deadline expires or peer of watched connection hangs up
+ *
+ * sockfd: socket descriptor
+ * events: poll events to wait for
+ * watchfd: connection to watch for peer hangup, -1 for none
+ * dl: deadline for waiting
+ * return: true if ready, false on error, expiry (errno set to ETIMEDOUT) or hangup (errno set to ECONNABORTED)
+ */
+bool wait_ready_watch(int sockfd, short events, int watchfd, const deadline& dl);
+
+/*
+ * Check without blocking if peer has closed or reset connection
+ *
+ * sockfd: socket descriptor
+ * return: true if peer is gone
+ */
+bool peer_hung_up(int sockfd);
+
+/*
+ * Accept connection
  *
  * listenfd: socket descriptor set to listen mode
- * return: new socket descriptor with timeout set
+ * return: new socket descriptor
  */
 int accept_connection(int listenfd);
 
@@ -23,25 +121,37 @@ int accept_connection(int listenfd);
 int create_and_listen(unsigned short port);
 
 /*
- * Init UDP socket and set 5 second receive timeout for it
+ * Init UDP socket
  *
  * destip: destination address
  * destport: destination port
- * destaddr: pointer to save destination address pointer
+ * destaddr: pointer to save destination address
  * addrlen: pointer to save address length
  * return: socket descriptor or -1 on error
  */
-int init_udp(const char* destip, const char* destport, struct sockaddr** destaddr, socklen_t* addrlen);
+int init_udp(const char* destip, const char* destport, struct sockaddr_storage* destaddr, socklen_t* addrlen);
 
 /*
- * Read header from socket
+ * Read header from socket, leaving payload unread
+ * Null characters terminating a previous header-only message are skipped
  *
  * sockfd: socket descriptor
  * delimiter: delimiter to separate header and payload
  * header: result of read
+ * dl: deadline for reading
  * return: true on success, false on failure
  */
-bool read_header(int sockfd, std::string delimiter, std::string& header);
+bool read_header(int sockfd, std::string delimiter, std::string& header, const deadline& dl);
+
+/*
+ * Wait for next message on a persistent connection
+ * Null characters terminating a previous header-only message are consumed
+ *
+ * sockfd: socket descriptor
+ * dl: deadline for waiting (idle timeout)
+ * return: true if message data is available, false if peer closed, on error or expiry
+ */
+bool await_message(int sockfd, const deadline& dl);
 
 /*
  * Receive body from socket
@@ -49,9 +159,10 @@ bool read_header(int sockfd, std::string delimiter, std::string& header);
  * sockfd: socket descriptor
  * contentlen: body length
  * body: body received
+ * dl: deadline for receiving
  * return: true on success, false on failure
  */
-bool recv_body(int sockfd, size_t contentlen, std::string& body);
+bool recv_body(int sockfd, size_t contentlen, std::string& body, const deadline& dl);
 
 /*
  * Receive text file from socket
@@ -60,9 +171,90 @@ bool recv_body(int sockfd, size_t contentlen, std::string& body);
  * dirpath: path to serving directory
  * filename: file to receive
  * filesize: size of file in bytes
+ * dl: deadline for receiving
+ * return: true on success, false on failure
+ */
+bool recv_text_file(int sockfd, std::string dirpath, std::string filename, size_t filesize, const deadline& dl);
+
+/*
+ * Receive payload from socket in fixed-size buffers handed to a sink as they arrive
+ *
+ * sockfd: socket descriptor
+ * length: payload length
+ * sink: consumer of payload
+ * ctx: context passed to sink
+ * dl: deadline for receiving
+ * return: true on success, false on failure or if sink aborted
+ */
+bool recv_to_sink(int sockfd, size_t length, recv_sink_fn sink, void* ctx, const deadline& dl);
+
+/*
+ * Receive payload with chunked transfer coding, data of chunks handed to a sink as it arrives
+ * Chunk extensions and trailer fields are skipped
+ *
+ * sockfd: socket descriptor
+ * sink: consumer of payload
+ * ctx: context passed to sink
+ * maxlen: largest payload accepted
+ * received: payload length
+ * dl: deadline for receiving
+ * return: true on success, false on failure, malformed coding, too long payload or if sink aborted
+ */
+bool recv_chunked(int sockfd, recv_sink_fn sink, void* ctx, size_t maxlen, size_t& received, const deadline& dl);
+
+/*
+ * Receive text file with chunked transfer coding from socket
+ *
+ * sockfd: socket descriptor
+ * dirpath: path to serving directory
+ * filename: file to receive
+ * received: size of file in bytes
+ * dl: deadline for receiving
  * return: true on success, false on failure
  */
-bool recv_text_file(int sockfd, std::string dirpath, std::string filename, size_t filesize);
+bool recv_chunked_file(int sockfd, std::string dirpath, std::string filename, size_t& received, const deadline& dl);
+
+/*
+ * Sink appending payload to a string
+ *
+ * ctx: pointer to string (std::string)
+ * data: next bytes of payload
+ * len: number of bytes
+ * return: true
+ */
+bool string_sink(void* ctx, const char* data, size_t len);
+
+/*
+ * Sink writing payload to a file descriptor (stdout, pipe, file)
+ *
+ * ctx: pointer to file descriptor (int)
+ * data: next bytes of payload
+ * len: number of bytes
+ * return: true on success, false if writing failed
+ */
+bool fd_sink(void* ctx, const char* data, size_t len);
+
+/*
+ * Sink dropping payload, for measurements where only its arrival matters
+ *
+ * ctx: unused
+ * data: next bytes of payload
+ * len: number of bytes
+ * return: true
+ */
+bool discard_sink(void* ctx, const char* data, size_t len);
+
+/*
+ * Receive part of a file from socket, written at its offset in an open file
+ *
+ * sockfd: socket descriptor
+ * fd: file descriptor to write to
+ * offset: file offset of first byte
+ * length: number of bytes to receive
+ * dl: deadline for receiving
+ * return: true on success, false on failure
+ */
+bool recv_file_range(int sockfd, int fd, size_t offset, size_t length, const deadline& dl);
 
 /*
  * Send string message to socket
@@ -72,9 +264,56 @@ bool recv_text_file(int sockfd, std::string dirpath, std::string filename, size_
  * uselength: if true, contentlen will be used
  * contentlen: content length
  * continues: if true, message continues
+ * dl: deadline for sending
+ * return: true on success, false on failure
+ */
+bool send_message(int sockfd, std::string message, bool uselength, size_t contentlen, bool continues, const deadline& dl);
+
+/*
+ * Send header and a payload held in memory to socket, gathered into as few writes as possible
+ *
+ * sockfd: socket descriptor
+ * header: message header
+ * payload: payload following header
+ * length: payload length
+ * dl: deadline for sending
+ * return: true on success, false on failure
+ */
+bool send_with_payload(int sockfd, const std::string& header, const char* payload, size_t length, const deadline& dl);
+
+/*
+ * Send payload with chunked transfer coding, pieces taken from a source until it has no more
+ * Header is sent before with send_message (continues set)
+ *
+ * sockfd: socket descriptor
+ * source: producer of payload
+ * ctx: context passed to source
+ * dl: deadline for sending
+ * return: true on success, false on failure or if source aborted
+ */
+bool send_chunked(int sockfd, send_source_fn source, void* ctx, const deadline& dl);
+
+/*
+ * Send one chunk of a payload with chunked transfer coding, for payloads relayed as they arrive
+ *
+ * sockfd: socket descriptor
+ * data: chunk data
+ * len: chunk length, 0 for the last chunk
+ * dl: deadline for sending
  * return: true on success, false on failure
  */
-bool send_message(int sockfd, std::string message, bool uselength, size_t contentlen, bool continues);
+bool send_chunk(int sockfd, const char* data, size_t len, const deadline& dl);
+
+/*
+ * Send bytes as they are, e.g. a relayed header or payload
+ *
+ * sockfd: socket descriptor
+ * data: bytes to send
+ * len: number of bytes
+ * dl: deadline for sending
+ * return: true on success, false on failure
+ */
+bool send_data(int sockfd, const char* data, size_t len, const deadline& dl);
 
 /*
  * Send text file to socket
@@ -83,16 +322,44 @@ bool send_message(int sockfd, std::string message, bool uselength, size_t conten
  * servpath: path to serving directory
  * filename: file to send
  * filesize: size of file in bytes
+ * dl: deadline for sending
+ * return: true on success, false on failure
+ */
+bool send_text_file(int sockfd, std::string servpath, std::string filename, size_t filesize, const deadline& dl);
+
+/*
+ * Send part of text file to socket
+ *
+ * sockfd: socket descriptor
+ * servpath: path to serving directory
+ * filename: file to send
+ * offset: offset of first byte to send
+ * length: number of bytes to send
+ * dl: deadline for sending
  * return: true on success, false on failure
  */
-bool send_text_file(int sockfd, std::string servpath, std::string filename, size_t filesize);
+bool send_file_range(int sockfd, std::string servpath, std::string filename, size_t offset, size_t length, const deadline& dl);
+
+/*
+ * Send part of an open file to socket, using positional reads so that the descriptor can be shared
+ *
+ * sockfd: socket descriptor
+ * fd: file descriptor opened for reading
+ * offset: offset of first byte to send
+ * length: number of bytes to send
+ * dl: deadline for sending
+ * return: true on success, false on failure
+ */
+bool send_fd_range(int sockfd, int fd, size_t offset, size_t length, const deadline& dl);
 
 /*
  * Create and connect TCP socket
+ * Addresses are resolved at most once per cache period, and attempts to them are started
+ * in parallel with a short stagger so that an unreachable address does not stall connecting
  *
  * hostname: hostname to connect
  * port: port to connect
- * return: socket descriptor or -1 on error
+ * return: socket descriptor (blocking) or -1 on error
  */
 int tcp_connect(std::string hostname, std::string port);
 
@@ -0,0 +1,77 @@
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <functional>
+#include <iostream>
+#include <pthread.h>
+
+#include "pathlock.hh"
+#include "stats.hh"
+
+#define LOCKSTRIPES 64 // locks shared by all paths, a power of two
+
+/* lock of the paths hashing to it, on a cache line of its own */
+struct alignas(64) lock_stripe
+{
+	pthread_rwlock_t lock;
+	lock_stripe();
+};
+
+lock_stripe stripes[LOCKSTRIPES];
+
+pthread_rwlock_t* stripe_of(const std::string& path);
+void wait_contended(const std::string& path, pthread_rwlock_t* lock, bool exclusive);
+
+lock_stripe::lock_stripe()
+{
+	if ((errno = pthread_rwlock_init(&lock, NULL)) != 0)
+		perror("pthread_rwlock_init");
+}
+
+void pathlock_shared(const std::string& path)
+{
+	pthread_rwlock_t* lock = stripe_of(path);
+	if ((errno = pthread_rwlock_tryrdlock(lock)) == EBUSY)
+		wait_contended(path, lock, false);
+	else if (errno != 0)
+		perror("pthread_rwlock_tryrdlock");
+}
+
+void pathlock_exclusive(const std::string& path)
+{
+	pthread_rwlock_t* lock = stripe_of(path);
+	if ((errno = pthread_rwlock_trywrlock(lock)) == EBUSY)
+		wait_contended(path, lock, true);
+	else if (errno != 0)
+		perror("pthread_rwlock_trywrlock");
+}
+
+void pathlock_release(const std::string& path)
+{
+	if ((errno = pthread_rwlock_unlock(stripe_of(path))) != 0)
+		perror("pthread_rwlock_unlock");
+}
+
+/*
+ * Lock of stripe a path hashes to
+ */
+pthread_rwlock_t* stripe_of(const std::string& path)
+{
+	return &stripes[std::hash<std::string>()(path) & (LOCKSTRIPES - 1)].lock;
+}
+
+/*
+ * Block on a lock that was busy, counting the wait so that hot paths show up
+ */
+void wait_contended(const std::string& path, pthread_rwlock_t* lock, bool exclusive)
+{
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if ((errno = exclusive ? pthread_rwlock_wrlock(lock) : pthread_rwlock_rdlock(lock)) != 0)
+		perror(exclusive ? "pthread_rwlock_wrlock" : "pthread_rwlock_rdlock");
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	unsigned long waitus = (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+	stat_add(PATHLOCK_WAITS, 1);
+	stat_add(PATHLOCK_WAIT_US, waitus);
+	std::cout << "waited " << waitus << " us to " << (exclusive ? "write " : "read ") << path << std::endl;
+}
@@ -0,0 +1,31 @@
+/* Reader/writer coordination of requests to the same path */
+
+#ifndef NETPROG_PATHLOCK_HH
+#define NETPROG_PATHLOCK_HH
+
+#include <string>
+
+/*
+ * Lock path for reading, e.g. while opening a file to serve it
+ * Readers of a path don't block each other
+ * Paths share a fixed number of locks by hash, so at most one path may be held by a thread at a time
+ *
+ * path: path to lock
+ */
+void pathlock_shared(const std::string& path);
+
+/*
+ * Lock path for writing, excluding readers and other writers of it
+ *
+ * path: path to lock
+ */
+void pathlock_exclusive(const std::string& path);
+
+/*
+ * Release lock of path taken with pathlock_shared or pathlock_exclusive
+ *
+ * path: path to unlock
+ */
+void pathlock_release(const std::string& path);
+
+#endif
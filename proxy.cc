@@ -0,0 +1,333 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <pthread.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "general.hh"
+#include "proxy.hh"
+#include "stats.hh"
+
+#define POOLMAX 8 // idle connections kept per upstream server
+
+/* URI prefix forwarded to an upstream server */
+struct proxy_route
+{
+	std::string prefix;
+	std::string host;
+	std::string port;
+};
+
+/* outcome of forwarding a request over one upstream connection */
+typedef enum
+{
+	RELAY_OK,
+	RELAY_UPSTREAM_FAILED, // nothing relayed to client yet, an error can still be answered
+	RELAY_BROKEN // failed after relaying to client began, or client is gone
+} relay_result;
+
+/* destination of a relayed payload */
+struct relay_target
+{
+	int fd;
+	const deadline* dl;
+};
+
+std::vector<proxy_route> routes; // set before serving, read-only afterwards
+std::unordered_map<std::string, std::vector<int> > idleconns; // pooled connections by host:port, access protected by poolmutex
+pthread_mutex_t poolmutex = PTHREAD_MUTEX_INITIALIZER;
+
+const proxy_route* route_of(const std::string& uri);
+int upstream_acquire(const proxy_route& route, bool pooled, bool& reused);
+void upstream_release(const proxy_route& route, int fd);
+bool upstream_alive(int fd);
+relay_result relay_exchange(const http_conf& conf, int clientfd, int upfd, const http_request& req, const deadline& dl,
+							bool& replayable, bool& clientreusable, bool& upstreamreusable);
+relay_result relay_response(const http_conf& conf, int clientfd, int upfd, const http_response& resp, bool close,
+							const deadline& dl, bool& upstreamreusable);
+bool relay_payload(int fromfd, int tofd, bool chunked, size_t length, const deadline& dl);
+std::string hop_header(const http_conf& conf, const std::string& header, bool close);
+bool data_relay_sink(void* ctx, const char* data, size_t len);
+bool chunk_relay_sink(void* ctx, const char* data, size_t len);
+
+bool proxy_add_route(const std::string& route)
+{
+	size_t eq = route.find('=');
+	size_t colon = route.rfind(':');
+	if (route.empty() || route.at(0) != '/' || eq == std::string::npos || colon == std::string::npos || colon < eq + 2 ||
+		colon + 1 == route.length())
+	{
+		std::cerr << "route must be /prefix=host:port" << std::endl;
+		return false;
+	}
+	proxy_route r;
+	r.prefix = route.substr(0, eq);
+	r.host = route.substr(eq + 1, colon - eq - 1);
+	r.port = route.substr(colon + 1);
+	routes.push_back(r);
+	std::cout << "forwarding " << r.prefix << " to " << r.host << ":" << r.port << std::endl;
+	return true;
+}
+
+bool proxy_routed(const std::string& uri)
+{
+	return route_of(uri) != NULL;
+}
+
+bool proxy_forward(const http_conf& conf, int clientfd, const http_request& req, const deadline& dl, bool& keepalive,
+				   http_status& failure)
+{
+	failure = http_status::NOT_SET_ST;
+	keepalive = false;
+	const proxy_route* route = route_of(req.uri);
+	stat_add(PROXY_REQUESTS, 1);
+
+	/* payload streamed right after the header can't be sent again, so it is not risked on an idle connection */
+	bool pooled = req.expect_continue || (!req.chunked && req.content_length == 0);
+	while (route)
+	{
+		bool reused;
+		int upfd;
+		if ((upfd = upstream_acquire(*route, pooled, reused)) < 0)
+			break;
+		bool replayable = true;
+		bool clientreusable = false;
+		bool upstreamreusable = false;
+		relay_result result = relay_exchange(conf, clientfd, upfd, req, dl, replayable, clientreusable, upstreamreusable);
+		if (result == relay_result::RELAY_OK && upstreamreusable)
+			upstream_release(*route, upfd);
+		else if (close(upfd) < 0)
+			perror("close");
+
+		if (result == relay_result::RELAY_OK)
+		{
+			keepalive = clientreusable;
+			return true;
+		}
+		if (result == relay_result::RELAY_BROKEN)
+		{
+			if (peer_hung_up(clientfd))
+			{
+				stat_cancel(req_stage::STAGE_SEND);
+				throw cancel_exception("client disconnected while relaying");
+			}
+			return false;
+		}
+
+		/* server may have closed an idle connection meanwhile, request is sent again if none of its payload was taken */
+		if (!reused || !replayable || dl.expired())
+			break;
+	}
+	stat_add(PROXY_ERRORS, 1);
+	failure = dl.expired() ? http_status::GATEWAY_TIMEOUT_504 : http_status::BAD_GATEWAY_502;
+	return false;
+}
+
+/*
+ * Route with the longest prefix a URI is under, NULL if none
+ */
+const proxy_route* route_of(const std::string& uri)
+{
+	const proxy_route* found = NULL;
+	std::vector<proxy_route>::const_iterator it;
+	for (it = routes.begin(); it != routes.end(); it++)
+	{
+		const std::string& prefix = it->prefix;
+		if (uri.compare(0, prefix.length(), prefix) == 0 &&
+			(uri.length() == prefix.length() || prefix.at(prefix.length() - 1) == '/' || uri.at(prefix.length()) == '/') &&
+			(!found || prefix.length() > found->prefix.length()))
+			found = &*it;
+	}
+	return found;
+}
+
+/*
+ * Take idle connection to upstream server from pool, connecting a new one if there is none left alive or pool is not used
+ */
+int upstream_acquire(const proxy_route& route, bool pooled, bool& reused)
+{
+	std::string key = route.host + ":" + route.port;
+	reused = false;
+	while (pooled)
+	{
+		int fd = -1;
+		if ((errno = pthread_mutex_lock(&poolmutex)) != 0)
+		{
+			perror("pthread_mutex_lock");
+			break;
+		}
+		std::vector<int>& conns = idleconns[key];
+		if (!conns.empty())
+		{
+			fd = conns.back(); // most recently used, least likely to have timed out
+			conns.pop_back();
+		}
+		if ((errno = pthread_mutex_unlock(&poolmutex)) != 0)
+			perror("pthread_mutex_unlock");
+		if (fd < 0)
+			break;
+		if (upstream_alive(fd))
+		{
+			reused = true;
+			stat_add(PROXY_REUSES, 1);
+			return fd;
+		}
+		if (close(fd) < 0)
+			perror("close");
+	}
+
+	int fd;
+	if ((fd = tcp_connect(route.host, route.port)) >= 0)
+		stat_add(PROXY_CONNECTS, 1);
+	return fd;
+}
+
+/*
+ * Return connection to pool after a complete exchange, closed if pool of the server is full
+ */
+void upstream_release(const proxy_route& route, int fd)
+{
+	bool pooled = false;
+	if ((errno = pthread_mutex_lock(&poolmutex)) != 0)
+		perror("pthread_mutex_lock");
+	else
+	{
+		std::vector<int>& conns = idleconns[route.host + ":" + route.port];
+		if (conns.size() < POOLMAX)
+		{
+			conns.push_back(fd);
+			pooled = true;
+		}
+		if ((errno = pthread_mutex_unlock(&poolmutex)) != 0)
+			perror("pthread_mutex_unlock");
+	}
+	if (!pooled && close(fd) < 0)
+		perror("close");
+}
+
+/*
+ * Check that an idle connection was not closed by the server
+ */
+bool upstream_alive(int fd)
+{
+	char buffer[64];
+	ssize_t peeked;
+	while ((peeked = recv(fd, buffer, sizeof(buffer), MSG_PEEK | MSG_DONTWAIT)) > 0)
+	{
+		/* only terminators of header-only responses may be left unread, they are dropped to see what follows */
+		if (std::count(buffer, buffer + peeked, '\0') != peeked || recv(fd, buffer, peeked, MSG_DONTWAIT) != peeked)
+			return false;
+	}
+	return peeked < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+/*
+ * Send request to upstream server and relay its response to client, payloads passed on as they arrive
+ */
+relay_result relay_exchange(const http_conf& conf, int clientfd, int upfd, const http_request& req, const deadline& dl,
+							bool& replayable, bool& clientreusable, bool& upstreamreusable)
+{
+	/* connection options concern one hop, the upstream connection stays open for the pool */
+	std::string header = hop_header(conf, req.header, false);
+	if (!send_data(upfd, header.data(), header.length(), dl))
+		return relay_result::RELAY_UPSTREAM_FAILED;
+
+	bool bodyfollows = req.chunked || req.content_length > 0;
+	try
+	{
+		if (bodyfollows && req.expect_continue)
+		{
+			/* upstream server decides if it wants the payload */
+			http_response interim = http_response::receive_header(conf, upfd, req.method, dl);
+			if (interim.status != http_status::CONTINUE_100)
+				return relay_response(conf, clientfd, upfd, interim, true, dl, upstreamreusable); // payload is left unread
+			if (!send_data(clientfd, interim.header.data(), interim.header.length(), dl))
+				return relay_result::RELAY_BROKEN;
+		}
+		replayable = !bodyfollows;
+		if (bodyfollows && !relay_payload(clientfd, upfd, req.chunked, req.content_length, dl))
+			return peer_hung_up(clientfd) ? relay_result::RELAY_BROKEN : relay_result::RELAY_UPSTREAM_FAILED;
+
+		http_response resp = http_response::receive_header(conf, upfd, req.method, dl);
+		clientreusable = req.keepalive;
+		return relay_response(conf, clientfd, upfd, resp, !req.keepalive, dl, upstreamreusable);
+	}
+	catch (const general_exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return relay_result::RELAY_UPSTREAM_FAILED;
+	}
+}
+
+/*
+ * Relay final response whose header was read from upstream server to client
+ */
+relay_result relay_response(const http_conf& conf, int clientfd, int upfd, const http_response& resp, bool close,
+							const deadline& dl, bool& upstreamreusable)
+{
+	std::string header = hop_header(conf, resp.header, close);
+	if (!send_data(clientfd, header.data(), header.length(), dl))
+		return relay_result::RELAY_BROKEN;
+	if (resp.has_payload() && !relay_payload(upfd, clientfd, resp.chunked, resp.content_length, dl))
+		return relay_result::RELAY_BROKEN;
+	upstreamreusable = resp.keepalive;
+	return relay_result::RELAY_OK;
+}
+
+/*
+ * Pass payload from one socket to another in pieces, chunked coding decoded and coded again
+ */
+bool relay_payload(int fromfd, int tofd, bool chunked, size_t length, const deadline& dl)
+{
+	relay_target target;
+	target.fd = tofd;
+	target.dl = &dl;
+	if (!chunked)
+		return recv_to_sink(fromfd, length, data_relay_sink, &target, dl);
+	size_t received;
+	return recv_chunked(fromfd, chunk_relay_sink, &target, SIZE_MAX, received, dl) && send_chunk(tofd, NULL, 0, dl);
+}
+
+/*
+ * Header with Connection fields of the previous hop dropped, closing the next hop if asked
+ */
+std::string hop_header(const http_conf& conf, const std::string& header, bool close)
+{
+	std::string connfield = to_upper(conf.to_str(http_hfield::CONNECTION));
+	std::stringstream headerss;
+	std::istringstream lines(header);
+	std::string line;
+	while (std::getline(lines, line) && line != "\r" && !line.empty())
+	{
+		if (to_upper(line.substr(0, connfield.length())) != connfield)
+			headerss << line << "\n";
+	}
+	if (close)
+		headerss << conf.to_str(http_hfield::CONNECTION) << " " << conf.connclose << "\r\n";
+	headerss << "\r\n";
+	return headerss.str();
+}
+
+/*
+ * Sink sending payload as it is
+ */
+bool data_relay_sink(void* ctx, const char* data, size_t len)
+{
+	relay_target* target = (relay_target*)ctx;
+	return send_data(target->fd, data, len, *target->dl);
+}
+
+/*
+ * Sink sending each piece of payload as a chunk
+ */
+bool chunk_relay_sink(void* ctx, const char* data, size_t len)
+{
+	relay_target* target = (relay_target*)ctx;
+	return len == 0 || send_chunk(target->fd, data, len, *target->dl);
+}
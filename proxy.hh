@@ -0,0 +1,42 @@
+/* Reverse proxy forwarding requests under configured URI prefixes to upstream servers */
+
+#ifndef NETPROG_PROXY_HH
+#define NETPROG_PROXY_HH
+
+#include <string>
+
+#include "http.hh"
+#include "networking.hh"
+
+/*
+ * Add route forwarding requests under a URI prefix, called before serving
+ *
+ * route: "/prefix=host:port"
+ * return: true on success, false if route is malformed
+ */
+bool proxy_add_route(const std::string& route);
+
+/*
+ * Check if a request is forwarded
+ *
+ * uri: request URI
+ * return: true if URI is under a routed prefix
+ */
+bool proxy_routed(const std::string& uri);
+
+/*
+ * Forward request to its upstream server and relay the response back, payloads streamed through in both
+ * directions; upstream connections are kept in a pool per server and reused
+ *
+ * conf: HTTP configuration to use
+ * clientfd: socket of client connection
+ * req: request with header read
+ * dl: deadline of the request
+ * keepalive: true if client connection can be reused, on success
+ * failure: status to answer with if nothing was relayed to client yet (502 or 504), NOT_SET_ST otherwise
+ * return: true on success, false on failure (cancel_exception thrown if client disconnects)
+ */
+bool proxy_forward(const http_conf& conf, int clientfd, const http_request& req, const deadline& dl, bool& keepalive,
+				   http_status& failure);
+
+#endif
@@ -0,0 +1,26 @@
+#!/bin/sh
+
+port=$1 # HTTP server port
+dnsport=$2 # port for local DNS stand-in
+conns=$3 # concurrent benchmark connections
+duration=$4 # benchmark duration in milliseconds
+latency=${5:-0} # DNS stand-in reply latency in milliseconds
+ttl=${6:-300} # TTL of DNS answers
+answers=${7:-1} # number of answers per DNS reply
+failpct=${8:-0} # percentage of DNS queries answered with SERVFAIL
+names=${9:-1000} # number of distinct names queried
+
+mkdir -p benchserv # serving directory for the server
+
+# start DNS stand-in and server in the background, output of server discarded
+./dnsstub -p $dnsport -l $latency -t $ttl -n $answers -f $failpct > dnsstub.txt &
+stubpid=$!
+./httpserver -p $port -d -s benchserv -q 127.0.0.1:$dnsport -u benchserver > /dev/null &
+serverpid=$!
+sleep 1
+
+./dnsbench -h localhost -p $port -c $conns -T $duration -k $names
+
+kill $serverpid $stubpid
+wait
+cat dnsstub.txt
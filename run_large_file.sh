@@ -0,0 +1,43 @@
+#!/bin/sh
+
+port=$1 # HTTP server port
+parts=${2:-4} # connections of the ranged GET
+timeout=${3:-600000} # request deadline of the server in milliseconds, large enough for a whole file
+
+size=4831838208 # 4.5 GiB, sizes and offsets past 4 GiB need 64 bits all the way
+mark=4294967296 # 4 GiB
+
+mkdir -p largeserv largeclient # serving directory for the server and directory of the client
+rm -f largeserv/large.bin largeserv/large_put.bin largeclient/large.bin largeclient/large_put.bin
+
+# sparse file takes no disk space, marker bytes past 4 GiB catch offsets or lengths cut to 32 bits
+truncate -s $size largeserv/large.bin
+printf 'past 4 GiB' | dd of=largeserv/large.bin bs=1 seek=$mark conv=notrunc 2>/dev/null
+printf 'last bytes' | dd of=largeserv/large.bin bs=1 seek=$((size - 10)) conv=notrunc 2>/dev/null
+
+# start server in the background, output of server discarded (a new file is reported missing before PUT)
+./httpserver -p $port -d -s largeserv -q 127.0.0.1:53 -u largeserver -t $timeout > /dev/null 2>&1 &
+serverpid=$!
+sleep 1
+
+failed=0
+
+# whole file in one GET
+./httpclient -h localhost -p $port -m GET -f /large.bin -u largeclient -d largeclient > largeclient/get.txt
+if cmp largeserv/large.bin largeclient/large.bin; then echo "GET ok"; else echo "GET failed"; failed=1; fi
+
+# the same file back under another name in one PUT
+mv largeclient/large.bin largeclient/large_put.bin
+./httpclient -h localhost -p $port -m PUT -f /large_put.bin -u largeclient -d largeclient > largeclient/put.txt
+if cmp largeclient/large_put.bin largeserv/large_put.bin; then echo "PUT ok"; else echo "PUT failed"; failed=1; fi
+rm -f largeclient/large_put.bin largeserv/large_put.bin
+
+# ranged GET in blocks, hundreds of them starting past 4 GiB
+./httpclient -h localhost -p $port -m GET -f /large.bin -u largeclient -d largeclient -k $parts > largeclient/range.txt
+if cmp largeserv/large.bin largeclient/large.bin; then echo "ranged GET ok"; else echo "ranged GET failed"; failed=1; fi
+rm -f largeclient/large.bin
+
+kill $serverpid
+wait
+rm -f largeserv/large.bin
+exit $failed
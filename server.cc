@@ -1,16 +1,29 @@
+#include <csignal>
 #include <iostream>
+#include <poll.h>
 #include <syslog.h>
 #include <unistd.h>
 
+#include "cas.hh"
 #include "daemon.hh"
+#include "dns.hh"
+#include "durable.hh"
+#include "encoding.hh"
+#include "filecache.hh"
 #include "general.hh"
 #include "http.hh"
 #include "networking.hh"
+#include "proxy.hh"
+#include "stats.hh"
 #include "threading.hh"
 
+#define DEFTIMEOUTMS 5000 // default request deadline
+#define ERRSENDMS 100 // time given for sending error response after deadline
+
 thread_queue joinqueue; // request processing threads ready to be joined
 
 void* process_request(void* parameters);
+bool serve_request(const http_conf& conf, process_req_params* params, bool& cancelled);
 
 /*
  * Main function
@@ -21,9 +34,24 @@ int main(int argc, char *argv[])
 	bool debug = false; // becomes a daemon by default
 	std::string servpath; // path to serving directory
 	std::string dnsservip; // DNS server to use
+	std::string dnsport = DNSPORT;
 	std::string username;
-	if (get_server_opts(argc, argv, port, debug, servpath, dnsservip, username) < 0)
+	unsigned long timeoutms = DEFTIMEOUTMS;
+	size_t cachebytes = 0; // contents of files are not held in memory by default
+	sync_policy syncpolicy = sync_policy::SYNC_NONE; // uploads are not synced by default
+	bool dedup = false; // uploads are stored as is by default
+	std::vector<std::string> proxyroutes; // nothing is forwarded by default
+	if (get_server_opts(argc, argv, port, debug, servpath, dnsservip, dnsport, username, timeoutms, cachebytes, syncpolicy,
+						dedup, proxyroutes) < 0)
 		return -1;
+	std::vector<std::string>::iterator routeit;
+	for (routeit = proxyroutes.begin(); routeit != proxyroutes.end(); routeit++)
+	{
+		if (!proxy_add_route(*routeit))
+			return -1;
+	}
+	durable_set_policy(syncpolicy);
+	cas_set_enabled(dedup);
 
 	if (!debug)
 	{
@@ -34,6 +62,9 @@ int main(int argc, char *argv[])
 		closelog();
 	}
 
+	/* writes to disconnected clients must fail with EPIPE instead of terminating the server */
+	signal(SIGPIPE, SIG_IGN);
+
 	/* create serving directory if it doesn't exist */
 	if (create_dir(servpath) < 0)
 		return -1;
@@ -47,6 +78,15 @@ int main(int argc, char *argv[])
 	if (start_thread(cleaner, &joinqueue, "cleaner") < 0)
 		return -1;
 
+	/* drop cached file descriptors when files change, validated with stat on every GET if watching fails */
+	if (filecache_init() == 0 && start_thread(filecache_watcher, NULL, "filecache") < 0)
+		return -1;
+	filecache_set_memory(cachebytes);
+
+	/* encoded variants are compressed in the background, files are sent as is until theirs is ready */
+	if (start_thread(variant_builder, NULL, "variant builder") < 0)
+		return -1;
+
 	while (1)
 	{
 		std::cout << "listening new connections" << std::endl;
@@ -61,7 +101,9 @@ int main(int argc, char *argv[])
 		parameters->connfd = connfd;
 		parameters->servpath = servpath;
 		parameters->dnsservip = dnsservip;
+		parameters->dnsport = dnsport;
 		parameters->username = username;
+		parameters->timeoutms = timeoutms;
 		parameters->errors = false;
 
 		/* start new thread to process client's request */
@@ -71,7 +113,7 @@ int main(int argc, char *argv[])
 }
 
 /*
- * Thread routine for processing client's request
+ * Thread routine for processing client's requests on one connection
  *
  * parameters: request processing parameters
  */
@@ -80,57 +122,121 @@ void* process_request(void* parameters)
 	process_req_params* params = (process_req_params*)parameters;
 
 	/* HTTP configuration instance for thread */
-	const http_conf conf(params->dnsservip);
+	const http_conf conf(params->dnsservip, params->dnsport);
+
+	/* serve requests until client closes, stays idle past timeout or connection can't be reused */
+	bool keepalive = true;
+	bool cancelled = false; // true if client disconnected before response was sent
+	while (keepalive && await_message(params->connfd, deadline::after_ms(params->timeoutms)))
+		keepalive = serve_request(conf, params, cancelled);
+
+	/* to avoid "connection reset by peer" errors in the client, wait (bounded) for client to close */
+	char buf[100];
+	if (!cancelled && wait_ready(params->connfd, POLLIN, deadline::after_ms(params->timeoutms)) && read(params->connfd, buf, 100) < 0)
+	{
+		perror("read");
+		params->errors = true;
+	}
+
+	/* now it's safe to close the socket */
+	if (close(params->connfd) < 0)
+	{
+		perror("close");
+		params->errors = true;
+	}
+
+	/* thread is now ready to be joined */
+	enter_queue(joinqueue);
+
+	return params;
+}
+
+/*
+ * Serve one request on connection
+ */
+bool serve_request(const http_conf& conf, process_req_params* params, bool& cancelled)
+{
+	/* one deadline covers all stages of the request */
+	const deadline dl = deadline::after_ms(params->timeoutms);
+	bool errors = false;
+	bool keepalive = false;
 
 	try
 	{
 		/* read request header from socket */
-		http_request request = http_request::receive_header(conf, params->connfd);
+		http_request request = http_request::receive_header(conf, params->connfd, dl);
 		request.print_header();
 
+		/* requests under a routed prefix are answered by upstream server */
+		if (proxy_routed(request.uri))
+		{
+			http_status failure;
+			if (proxy_forward(conf, params->connfd, request, dl, keepalive, failure))
+				return keepalive;
+			params->errors = true;
+			if (failure != http_status::NOT_SET_ST)
+			{
+				http_response response = http_response::form_error_header(conf, failure, params->username);
+				response.print_header();
+				if (!response.send(params->connfd, params->servpath, deadline::after_ms(ERRSENDMS)))
+					std::cerr << "failed to send proxy error response" << std::endl;
+			}
+			return false;
+		}
+
 		/* process request and form response header */
-		http_response response = http_response::proc_req_form_header(conf, params->connfd, request, params->servpath, params->username);
+		http_response response = http_response::proc_req_form_header(conf, params->connfd, request, params->servpath, params->username, dl);
 		response.print_header();
 
-		/* write response to socket */
-		if (!response.send(params->connfd, params->servpath))
+		/* write response to socket (timeout responses are formed after deadline, so they get a grace period) */
+		bool timedout = response.status == http_status::REQUEST_TIMEOUT_408 || response.status == http_status::GATEWAY_TIMEOUT_504;
+		if (!response.send(params->connfd, params->servpath, timedout ? deadline::after_ms(ERRSENDMS) : dl))
 		{
 			std::cerr << "failed to send response" << std::endl;
-			params->errors = true;
+			if (!timedout && dl.expired())
+				stat_deadline_overrun(req_stage::STAGE_SEND);
+			else if (peer_hung_up(params->connfd))
+			{
+				stat_cancel(req_stage::STAGE_SEND);
+				cancelled = true;
+			}
+			errors = true;
 		}
+		else
+			keepalive = response.keepalive;
+	}
+	catch (const cancel_exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		cancelled = true;
+		errors = true;
+	}
+	catch (const deadline_exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+
+		/* try to write 408 Request Timeout, no 404 needed after it */
+		http_response response = http_response::form_error_header(conf, http_status::REQUEST_TIMEOUT_408, params->username);
+		response.print_header();
+		if (!response.send(params->connfd, params->servpath, deadline::after_ms(ERRSENDMS)))
+			std::cerr << "failed to send timeout response" << std::endl;
 	}
 	catch (const general_exception& e)
 	{
 		std::cerr << e.what() << std::endl;
-		params->errors = true;
+		errors = true;
 	}
 
-	if (params->errors)
+	if (errors && !cancelled)
 	{
 		/* try to write 404 Not Found as a general error to socket */
 		http_response response = http_response::form_404_header(conf, params->username);
 		response.print_header();
-		if (!response.send(params->connfd, params->servpath))
+		if (!response.send(params->connfd, params->servpath, deadline::after_ms(ERRSENDMS)))
 			std::cerr << "failed to send general error response" << std::endl;
 	}
-
-	/* to avoid "connection reset by peer" errors in the client */
-	char buf[100];
-	if (read(params->connfd, buf, 100) < 0)
-	{
-		perror("read");
+	if (errors)
 		params->errors = true;
-	}
 
-	/* now it's safe to close the socket */
-	if (close(params->connfd) < 0)
-	{
-		perror("close");
-		params->errors = true;
-	}
-
-	/* thread is now ready to be joined */
-	enter_queue(joinqueue);
-
-	return params;
+	return keepalive && !cancelled;
 }
@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <cstring>
+
+#include "sha256.hh"
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/* round constants: first 32 bits of the fractional parts of the cube roots of the first 64 primes */
+const uint32_t round_constants[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+void hash_block(uint32_t state[8], const unsigned char* block);
+
+void sha256_init(sha256_ctx& ctx)
+{
+	/* first 32 bits of the fractional parts of the square roots of the first 8 primes */
+	ctx.state[0] = 0x6a09e667;
+	ctx.state[1] = 0xbb67ae85;
+	ctx.state[2] = 0x3c6ef372;
+	ctx.state[3] = 0xa54ff53a;
+	ctx.state[4] = 0x510e527f;
+	ctx.state[5] = 0x9b05688c;
+	ctx.state[6] = 0x1f83d9ab;
+	ctx.state[7] = 0x5be0cd19;
+	ctx.length = 0;
+	ctx.blocklen = 0;
+}
+
+void sha256_update(sha256_ctx& ctx, const char* data, size_t len)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	ctx.length += len;
+	if (ctx.blocklen > 0)
+	{
+		size_t fill = std::min(len, sizeof(ctx.block) - ctx.blocklen);
+		memcpy(ctx.block + ctx.blocklen, p, fill);
+		ctx.blocklen += fill;
+		p += fill;
+		len -= fill;
+		if (ctx.blocklen < sizeof(ctx.block))
+			return;
+		hash_block(ctx.state, ctx.block);
+		ctx.blocklen = 0;
+	}
+	for (; len >= sizeof(ctx.block); p += sizeof(ctx.block), len -= sizeof(ctx.block))
+		hash_block(ctx.state, p); // whole blocks straight from data
+	memcpy(ctx.block, p, len);
+	ctx.blocklen = len;
+}
+
+std::string sha256_final(sha256_ctx& ctx)
+{
+	/* pad with a one bit, zeros and the length in bits so that the last block is full */
+	uint64_t bits = ctx.length * 8;
+	ctx.block[ctx.blocklen++] = 0x80;
+	if (ctx.blocklen > sizeof(ctx.block) - 8)
+	{
+		memset(ctx.block + ctx.blocklen, 0, sizeof(ctx.block) - ctx.blocklen);
+		hash_block(ctx.state, ctx.block);
+		ctx.blocklen = 0;
+	}
+	memset(ctx.block + ctx.blocklen, 0, sizeof(ctx.block) - 8 - ctx.blocklen);
+	for (int i = 0; i < 8; i++)
+		ctx.block[sizeof(ctx.block) - 1 - i] = (unsigned char)(bits >> (8 * i));
+	hash_block(ctx.state, ctx.block);
+
+	static const char hexdigits[] = "0123456789abcdef";
+	std::string digest(64, '0');
+	for (int i = 0; i < 32; i++)
+	{
+		unsigned char byte = (unsigned char)(ctx.state[i / 4] >> (24 - 8 * (i % 4)));
+		digest[2 * i] = hexdigits[byte >> 4];
+		digest[2 * i + 1] = hexdigits[byte & 0xf];
+	}
+	return digest;
+}
+
+/*
+ * Process one 64-byte block
+ */
+void hash_block(uint32_t state[8], const unsigned char* block)
+{
+	uint32_t w[64];
+	for (int i = 0; i < 16; i++)
+		w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 | (uint32_t)block[4 * i + 2] << 8 | block[4 * i + 3];
+	for (int i = 16; i < 64; i++)
+	{
+		uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+	for (int i = 0; i < 64; i++)
+	{
+		uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + round_constants[i] + w[i];
+		uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
+}
@@ -0,0 +1,42 @@
+/* SHA-256 digest (FIPS 180-4) computed incrementally */
+
+#ifndef NETPROG_SHA256_HH
+#define NETPROG_SHA256_HH
+
+#include <cstdint>
+#include <string>
+
+/* state of a digest being computed */
+struct sha256_ctx
+{
+	uint32_t state[8];
+	uint64_t length; // bytes hashed so far
+	unsigned char block[64]; // partial block not yet hashed
+	size_t blocklen;
+};
+
+/*
+ * Start digest
+ *
+ * ctx: state to initialize
+ */
+void sha256_init(sha256_ctx& ctx);
+
+/*
+ * Add data to digest
+ *
+ * ctx: state
+ * data: data to add
+ * len: length of data
+ */
+void sha256_update(sha256_ctx& ctx, const char* data, size_t len);
+
+/*
+ * Finish digest, after which the state has to be initialized again before use
+ *
+ * ctx: state
+ * return: digest as 64 lowercase hex digits
+ */
+std::string sha256_final(sha256_ctx& ctx);
+
+#endif
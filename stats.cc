@@ -0,0 +1,88 @@
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+
+#include "stats.hh"
+
+#define REPORTCHUNKLINES 16 // counters per piece of report handed out by source
+
+std::atomic<unsigned long> counters[NUM_COUNTERS]; // zero-initialized as static storage
+
+/* counter names in the order of the enum */
+const char* counter_names[NUM_COUNTERS] = {
+	"deadline_header",
+	"deadline_body",
+	"deadline_file",
+	"deadline_dns",
+	"deadline_send",
+	"cancel_header",
+	"cancel_body",
+	"cancel_file",
+	"cancel_dns",
+	"cancel_send",
+	"filecache_hit",
+	"filecache_miss",
+	"memcache_hit",
+	"memcache_miss",
+	"memcache_evict",
+	"compress_files",
+	"compress_in_bytes",
+	"compress_out_bytes",
+	"compress_cpu_us",
+	"compress_deferred",
+	"encoded_responses",
+	"encoded_bytes_saved",
+	"sync_calls",
+	"sync_files",
+	"pathlock_waits",
+	"pathlock_wait_us",
+	"cas_stored",
+	"cas_deduplicated",
+	"cas_bytes_saved",
+	"bundle_requests",
+	"bundle_files",
+	"proxy_requests",
+	"proxy_connects",
+	"proxy_reuses",
+	"proxy_errors"
+};
+
+void stat_add(stat_counter counter, unsigned long value)
+{
+	counters[counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+void stat_deadline_overrun(req_stage stage)
+{
+	stat_add((stat_counter)(DEADLINE_HEADER + stage), 1);
+}
+
+void stat_cancel(req_stage stage)
+{
+	stat_add((stat_counter)(CANCEL_HEADER + stage), 1);
+}
+
+unsigned long stat_get(stat_counter counter)
+{
+	return counters[counter].load(std::memory_order_relaxed);
+}
+
+std::string stats_report()
+{
+	std::stringstream ss;
+	int i;
+	for (i = 0; i < NUM_COUNTERS; i++)
+		ss << counter_names[i] << " " << stat_get((stat_counter)i) << "\n";
+	return ss.str();
+}
+
+bool stats_report_source(void* ctx, std::string& chunk)
+{
+	int& next = *(int*)ctx;
+	std::stringstream ss;
+	int last = std::min(next + REPORTCHUNKLINES, (int)NUM_COUNTERS);
+	for (; next < last; next++)
+		ss << counter_names[next] << " " << stat_get((stat_counter)next) << "\n";
+	chunk = ss.str();
+	return true;
+}
@@ -0,0 +1,106 @@
+/* Server statistics counters */
+
+#ifndef NETPROG_STATS_HH
+#define NETPROG_STATS_HH
+
+#include <string>
+
+/* request processing stages */
+typedef enum
+{
+	STAGE_HEADER, // reading request header
+	STAGE_BODY, // reading request body (DNS query parameters)
+	STAGE_FILE, // receiving uploaded file
+	STAGE_DNS, // waiting for DNS server
+	STAGE_SEND, // sending response
+	NUM_STAGES
+} req_stage;
+
+/* statistics counters, per-stage counters in the order of stages */
+typedef enum
+{
+	DEADLINE_HEADER,
+	DEADLINE_BODY,
+	DEADLINE_FILE,
+	DEADLINE_DNS,
+	DEADLINE_SEND,
+	CANCEL_HEADER,
+	CANCEL_BODY,
+	CANCEL_FILE,
+	CANCEL_DNS,
+	CANCEL_SEND,
+	FILECACHE_HIT, // GET served from an already open file
+	FILECACHE_MISS,
+	MEMCACHE_HIT, // GET served from contents held in memory
+	MEMCACHE_MISS, // GET read from file while contents cache is enabled
+	MEMCACHE_EVICT,
+	COMPRESS_FILES, // encoded variants created
+	COMPRESS_IN_BYTES, // bytes compressed
+	COMPRESS_OUT_BYTES, // bytes after compression
+	COMPRESS_CPU_US, // CPU time of compression
+	COMPRESS_DEFERRED, // GETs answered as is while their variant was not built yet
+	ENCODED_RESPONSES, // GETs answered with an encoded variant
+	ENCODED_BYTES_SAVED, // payload bytes not sent thanks to encoding
+	SYNC_CALLS, // fdatasync and fsync calls for uploads
+	SYNC_FILES, // uploads made durable
+	PATHLOCK_WAITS, // requests that waited for another request to the same path (or one sharing its lock)
+	PATHLOCK_WAIT_US, // time spent waiting
+	CAS_STORED, // uploads stored as new content
+	CAS_DEDUPLICATED, // uploads linked to content stored already
+	CAS_BYTES_SAVED, // bytes of deduplicated uploads
+	BUNDLE_REQUESTS, // bundle POSTs answered with a bundle
+	BUNDLE_FILES, // files sent in bundles
+	PROXY_REQUESTS, // requests forwarded to an upstream server
+	PROXY_CONNECTS, // upstream connections opened
+	PROXY_REUSES, // requests sent on a pooled upstream connection
+	PROXY_ERRORS, // forwarded requests answered with 502 or 504
+	NUM_COUNTERS
+} stat_counter;
+
+/*
+ * Increment counter (thread-safe)
+ *
+ * counter: counter to increment
+ * value: amount to add
+ */
+void stat_add(stat_counter counter, unsigned long value);
+
+/*
+ * Increment deadline overrun counter of a stage (thread-safe)
+ *
+ * stage: stage that overran
+ */
+void stat_deadline_overrun(req_stage stage);
+
+/*
+ * Increment cancellation counter of a stage (thread-safe)
+ *
+ * stage: stage during which client disconnected
+ */
+void stat_cancel(req_stage stage);
+
+/*
+ * Get counter value
+ *
+ * counter: counter to read
+ * return: counter value
+ */
+unsigned long stat_get(stat_counter counter);
+
+/*
+ * Form report of all counters, one "name value" line per counter
+ *
+ * return: report as string
+ */
+std::string stats_report();
+
+/*
+ * Source of the same report handing out a few counters at a time, so that it is sent as it is formed
+ *
+ * ctx: pointer to index of next counter (int), 0 to start
+ * chunk: next lines of report, left empty when all counters are reported
+ * return: true
+ */
+bool stats_report_source(void* ctx, std::string& chunk);
+
+#endif
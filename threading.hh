@@ -21,7 +21,9 @@ struct process_req_params
 	int connfd;
 	std::string servpath;
 	std::string dnsservip;
+	std::string dnsport;
 	std::string username;
+	unsigned long timeoutms; // request deadline in milliseconds
 	bool errors; // true if errors occured in thread routine
 };
 